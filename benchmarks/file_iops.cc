@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "latency_report.h"
+#include "uringpp/bulk_io.h"
+#include "uringpp/direct_file.h"
+#include "uringpp/event_loop.h"
+#include "uringpp/file.h"
+#include "uringpp/task.h"
+
+/**
+ * Measures random 4 KiB read IOPS at various queue depths with O_DIRECT, so
+ * that reads reach the device instead of the page cache. The file is created
+ * and filled first unless it is already large enough.
+ */
+
+static constexpr size_t kBlockSize = 4096;
+
+uringpp::task<void> reader(uringpp::direct_file &f, size_t blocks,
+                           size_t iterations, uint64_t seed,
+                           latency_samples &samples) {
+  auto buf = f.allocate(kBlockSize);
+  uint64_t x = seed * 0x9e3779b97f4a7c15 + 1;
+  for (size_t i = 0; i < iterations; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    auto start = latency_samples::now_ns();
+    int rc = co_await f.read(buf.data(), kBlockSize, (x % blocks) * kBlockSize);
+    uringpp::check_nerrno(rc, "failed to read");
+    samples.add(latency_samples::now_ns() - start);
+  }
+}
+
+uringpp::task<void> run(std::shared_ptr<uringpp::event_loop> loop,
+                        char const *path, size_t size, size_t iterations) {
+  auto f = co_await uringpp::direct_file::open(loop, path, O_RDWR | O_CREAT,
+                                               0644);
+  struct stat st;
+  uringpp::check_errno(::fstat(f.lower().fd(), &st), "failed to stat");
+  if (static_cast<size_t>(st.st_size) < size) {
+    auto data = f.allocate(size);
+    std::fill_n(data.data(), size, 0x5a);
+    co_await uringpp::bulk_write(f.lower(), data.data(), size, 0,
+                                 uringpp::bulk_sync::data);
+  }
+  for (size_t depth : {1, 4, 16, 64, 128}) {
+    latency_samples samples(iterations);
+    auto enters = loop->submit_stats().enters;
+    auto start = latency_samples::now_ns();
+    std::vector<uringpp::task<void>> readers;
+    for (size_t i = 0; i < depth; ++i) {
+      readers.push_back(
+          reader(f, size / kBlockSize, iterations / depth, i, samples));
+    }
+    for (auto &r : readers) {
+      co_await r;
+    }
+    double seconds = (latency_samples::now_ns() - start) / 1e9;
+    auto label = "4k randread depth " + std::to_string(depth);
+    samples.report(label.c_str(), samples.size(), seconds,
+                   loop->submit_stats().enters - enters);
+  }
+  co_await f.close();
+}
+
+int main(int argc, char *argv[]) {
+  char const *path = argc > 1 ? argv[1] : "uringpp_bench.dat";
+  size_t size = (argc > 2 ? ::atol(argv[2]) : 1024) << 20;
+  size_t iterations = argc > 3 ? ::atol(argv[3]) : 200000;
+  auto loop = uringpp::event_loop::create(512);
+  loop->block_on(run(loop, path, size, iterations));
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <unistd.h>
+
+#include "uringpp/bulk_io.h"
+#include "uringpp/direct_file.h"
+#include "uringpp/event_loop.h"
+#include "uringpp/file.h"
+#include "uringpp/task.h"
+
+/**
+ * Measures sequential file throughput of bulk_write (with a final
+ * fdatasync) and bulk_read over O_DIRECT, for various chunk sizes and
+ * numbers of chunks in flight.
+ */
+
+static void report(char const *name, uringpp::bulk_options options,
+                   size_t size, double seconds, uint64_t enters) {
+  auto chunks = (size + options.chunk_size - 1) / options.chunk_size;
+  ::printf("%-6s chunk %5zu KiB depth %3u: %8.1f MiB/s %6.3f enters/chunk\n",
+           name, options.chunk_size >> 10, options.depth,
+           (size >> 20) / seconds, static_cast<double>(enters) / chunks);
+}
+
+template <class F>
+uringpp::task<void> measure(std::shared_ptr<uringpp::event_loop> loop,
+                            char const *name, uringpp::bulk_options options,
+                            size_t size, F f) {
+  auto enters = loop->submit_stats().enters;
+  auto start = std::chrono::steady_clock::now();
+  co_await f();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  report(name, options, size, elapsed.count(),
+         loop->submit_stats().enters - enters);
+}
+
+uringpp::task<void> read_all(uringpp::file &f, void *buf, size_t size,
+                             uringpp::bulk_options options) {
+  auto n = co_await uringpp::bulk_read(f, buf, size, 0, options);
+  if (n != size) {
+    ::fprintf(stderr, "short read: %zu\n", n);
+    ::exit(1);
+  }
+}
+
+uringpp::task<void> run(std::shared_ptr<uringpp::event_loop> loop,
+                        char const *path, size_t size) {
+  auto f = co_await uringpp::direct_file::open(loop, path, O_RDWR | O_CREAT,
+                                               0644);
+  auto data = f.allocate(size);
+  std::fill_n(data.data(), size, 0x5a);
+  for (size_t chunk_size : {128 << 10, 1 << 20}) {
+    for (unsigned depth : {1, 8, 32}) {
+      uringpp::bulk_options options{chunk_size, depth};
+      co_await measure(loop, "write", options, size, [&]() {
+        return uringpp::bulk_write(f.lower(), data.data(), size, 0,
+                                   uringpp::bulk_sync::data, options);
+      });
+      co_await measure(loop, "read", options, size, [&]() {
+        return read_all(f.lower(), data.data(), size, options);
+      });
+    }
+  }
+  co_await f.close();
+}
+
+int main(int argc, char *argv[]) {
+  char const *path = argc > 1 ? argv[1] : "uringpp_bench.dat";
+  size_t size = (argc > 2 ? ::atol(argv[2]) : 1024) << 20;
+  auto loop = uringpp::event_loop::create(512);
+  loop->block_on(run(loop, path, size));
+  return 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+/**
+ * Latency samples shared by the benchmarks, reported as one line with the
+ * throughput, the p50, p99 and p99.9 latencies and the io_uring_enter calls
+ * per operation.
+ */
+class latency_samples {
+  std::vector<uint64_t> ns_;
+
+public:
+  explicit latency_samples(size_t expected = 0) { ns_.reserve(expected); }
+
+  static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  void add(uint64_t ns) { ns_.push_back(ns); }
+
+  void merge(latency_samples const &other) {
+    ns_.insert(ns_.end(), other.ns_.begin(), other.ns_.end());
+  }
+
+  size_t size() const { return ns_.size(); }
+
+  double quantile_us(double q) {
+    if (ns_.empty()) {
+      return 0;
+    }
+    auto nth = ns_.begin() + static_cast<size_t>(q * (ns_.size() - 1));
+    std::nth_element(ns_.begin(), nth, ns_.end());
+    return *nth / 1000.0;
+  }
+
+  void report(char const *name, size_t ops, double seconds, uint64_t enters) {
+    ::printf("%-28s %9.0f ops/s p50 %8.2f us p99 %8.2f us p999 %8.2f us "
+             "%6.3f enters/op\n",
+             name, ops / seconds, quantile_us(0.5), quantile_us(0.99),
+             quantile_us(0.999), static_cast<double>(enters) / ops);
+  }
+};
@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "latency_report.h"
+#include "uringpp/event_loop.h"
+#include "uringpp/task.h"
+
+/**
+ * Measures the round trip of a NOP through the ring, awaited by one
+ * coroutine or by many at once so that their SQEs share submissions, and the
+ * cost of resuming a coroutine through the loop with defer() or yield(),
+ * which need no syscall.
+ */
+
+uringpp::task<void> nops(std::shared_ptr<uringpp::event_loop> loop,
+                         size_t iterations, latency_samples &samples) {
+  for (size_t i = 0; i < iterations; ++i) {
+    auto start = latency_samples::now_ns();
+    co_await loop->nop();
+    samples.add(latency_samples::now_ns() - start);
+  }
+}
+
+uringpp::task<void> defers(std::shared_ptr<uringpp::event_loop> loop,
+                           size_t iterations, latency_samples &samples) {
+  for (size_t i = 0; i < iterations; ++i) {
+    auto start = latency_samples::now_ns();
+    co_await loop->defer();
+    samples.add(latency_samples::now_ns() - start);
+  }
+}
+
+uringpp::task<void> yields(std::shared_ptr<uringpp::event_loop> loop,
+                           size_t iterations, latency_samples &samples) {
+  for (size_t i = 0; i < iterations; ++i) {
+    auto start = latency_samples::now_ns();
+    co_await loop->yield();
+    samples.add(latency_samples::now_ns() - start);
+  }
+}
+
+template <class F>
+uringpp::task<void> fan_out(size_t depth, size_t iterations, F f) {
+  std::vector<uringpp::task<void>> tasks;
+  for (size_t i = 0; i < depth; ++i) {
+    tasks.push_back(f(iterations / depth));
+  }
+  for (auto &t : tasks) {
+    co_await t;
+  }
+}
+
+template <class Op>
+static void run(char const *name, size_t depth, size_t iterations, Op op) {
+  auto loop = uringpp::event_loop::create(std::max<size_t>(depth * 2, 128));
+  latency_samples samples(iterations);
+  auto enters = loop->submit_stats().enters;
+  auto start = latency_samples::now_ns();
+  loop->block_on(fan_out(depth, iterations, [&](size_t n) {
+    return op(loop, n, samples);
+  }));
+  double seconds = (latency_samples::now_ns() - start) / 1e9;
+  auto label = std::string(name) + " depth " + std::to_string(depth);
+  samples.report(label.c_str(), samples.size(), seconds,
+                 loop->submit_stats().enters - enters);
+}
+
+int main(int argc, char *argv[]) {
+  size_t iterations = argc > 1 ? ::atol(argv[1]) : 1000000;
+  for (size_t depth : {1, 32, 256}) {
+    run("nop", depth, iterations, nops);
+  }
+  for (size_t depth : {1, 32}) {
+    run("defer", depth, iterations, defers);
+  }
+  for (size_t depth : {1, 32}) {
+    run("yield", depth, iterations, yields);
+  }
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "uringpp/event_loop.h"
+#include "uringpp/rpc.h"
+#include "uringpp/socket.h"
+#include "uringpp/task.h"
+
+/**
+ * Measures the throughput of pipelined RPC calls over loopback TCP, with a
+ * server and a client loop on their own threads and a given number of calls
+ * in flight. The handler echoes the request payload.
+ */
+
+static constexpr uint32_t kEcho = 1;
+
+static int listen_any(uint16_t *port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), len) < 0 ||
+      ::listen(fd, 1) < 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) < 0) {
+    ::perror("listen");
+    ::exit(1);
+  }
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+static int connect_to(uint16_t port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (fd < 0 ||
+      ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    ::perror("connect");
+    ::exit(1);
+  }
+  return fd;
+}
+
+uringpp::task<std::string> echo(uint32_t method, std::string_view payload) {
+  if (method != kEcho) {
+    throw std::runtime_error("unknown method");
+  }
+  co_return std::string(payload);
+}
+
+static void server(int listen_fd) {
+  auto loop = uringpp::event_loop::create(256);
+  auto &buffers = loop->register_buffer_ring(256, 16384, 16);
+  uringpp::rpc_server rpc(
+      uringpp::socket(loop, ::accept(listen_fd, nullptr, nullptr)), buffers,
+      echo);
+  loop->block_on(rpc.serve());
+}
+
+uringpp::task<void> caller(uringpp::rpc_client &client, size_t calls,
+                           std::string const &payload) {
+  for (size_t i = 0; i < calls; ++i) {
+    auto response = co_await client.call(kEcho, payload);
+    if (response.size() != payload.size()) {
+      ::fprintf(stderr, "short response: %zu\n", response.size());
+      ::exit(1);
+    }
+  }
+}
+
+uringpp::task<void> drive(uringpp::rpc_client &client, size_t calls,
+                          size_t depth, size_t payload_size) {
+  std::string payload(payload_size, 'x');
+  std::vector<uringpp::task<void>> callers;
+  for (size_t i = 0; i < depth; ++i) {
+    callers.push_back(caller(client, calls / depth, payload));
+  }
+  for (auto &c : callers) {
+    co_await c;
+  }
+  co_await client.shutdown();
+}
+
+static void run(size_t calls, size_t depth, size_t payload_size) {
+  uint16_t port;
+  int listen_fd = listen_any(&port);
+  std::thread t(server, listen_fd);
+  auto loop = uringpp::event_loop::create(256);
+  auto &buffers = loop->register_buffer_ring(256, 16384, 16);
+  uringpp::rpc_client client(uringpp::socket(loop, connect_to(port)),
+                             buffers);
+  auto start = std::chrono::steady_clock::now();
+  auto receiver = client.run();
+  loop->block_on(drive(client, calls, depth, payload_size));
+  loop->block_on(std::move(receiver));
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  t.join();
+  ::close(listen_fd);
+  calls = calls / depth * depth;
+  ::printf("depth %4zu payload %6zu B: %8zu calls in %7.3f s %10.0f calls/s\n",
+           depth, payload_size, calls, elapsed.count(),
+           calls / elapsed.count());
+}
+
+int main(int argc, char *argv[]) {
+  size_t calls = argc > 1 ? ::atol(argv[1]) : 1000000;
+  size_t payload_size = argc > 2 ? ::atol(argv[2]) : 64;
+  for (size_t depth : {1, 16, 256}) {
+    run(depth == 1 ? calls / 10 : calls, depth, payload_size);
+  }
+  return 0;
+}
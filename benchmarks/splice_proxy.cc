@@ -0,0 +1,170 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "uringpp/event_loop.h"
+#include "uringpp/pipe.h"
+#include "uringpp/proxy.h"
+#include "uringpp/socket.h"
+#include "uringpp/task.h"
+
+/**
+ * Measures the throughput of a TCP proxy forwarding a bulk transfer to an
+ * echo server and back over loopback, with copy_bidirectional splicing
+ * through pooled pipes and with a recv/send loop copying through a userspace
+ * buffer.
+ */
+
+static constexpr size_t kBufferSize = 65536;
+
+static int listen_any(uint16_t *port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), len) < 0 ||
+      ::listen(fd, 1) < 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) < 0) {
+    ::perror("listen");
+    ::exit(1);
+  }
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+static int connect_to(uint16_t port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (fd < 0 ||
+      ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    ::perror("connect");
+    ::exit(1);
+  }
+  return fd;
+}
+
+static void echo_server(int listen_fd) {
+  int fd = ::accept(listen_fd, nullptr, nullptr);
+  std::vector<char> buf(kBufferSize);
+  for (;;) {
+    auto n = ::read(fd, buf.data(), buf.size());
+    if (n <= 0) {
+      break;
+    }
+    for (ssize_t sent = 0; sent < n;) {
+      auto rc = ::write(fd, buf.data() + sent, n - sent);
+      if (rc <= 0) {
+        ::perror("echo");
+        ::exit(1);
+      }
+      sent += rc;
+    }
+  }
+  ::shutdown(fd, SHUT_WR);
+  ::close(fd);
+}
+
+static void client(uint16_t port, size_t bytes, size_t *received) {
+  int fd = connect_to(port);
+  std::thread writer([fd, bytes]() {
+    std::vector<char> buf(kBufferSize, 'x');
+    for (size_t sent = 0; sent < bytes;) {
+      auto rc = ::write(fd, buf.data(), std::min(buf.size(), bytes - sent));
+      if (rc <= 0) {
+        ::perror("write");
+        ::exit(1);
+      }
+      sent += rc;
+    }
+    ::shutdown(fd, SHUT_WR);
+  });
+  std::vector<char> buf(kBufferSize);
+  for (ssize_t n; (n = ::read(fd, buf.data(), buf.size())) > 0;) {
+    *received += n;
+  }
+  writer.join();
+  ::close(fd);
+}
+
+uringpp::task<void> copy_forward(uringpp::socket &in, uringpp::socket &out) {
+  std::vector<char> buf(kBufferSize);
+  for (;;) {
+    int n = co_await in.recv(buf.data(), buf.size(), 0);
+    if (n <= 0) {
+      break;
+    }
+    for (int sent = 0; sent < n;) {
+      int rc = co_await out.send(buf.data() + sent, n - sent, MSG_NOSIGNAL);
+      if (rc <= 0) {
+        ::fprintf(stderr, "send: %d\n", rc);
+        ::exit(1);
+      }
+      sent += rc;
+    }
+  }
+  co_await out.shutdown(SHUT_WR);
+}
+
+uringpp::task<void> copy_loop(uringpp::socket &a, uringpp::socket &b) {
+  auto forward = copy_forward(a, b);
+  auto backward = copy_forward(b, a);
+  co_await forward;
+  co_await backward;
+}
+
+uringpp::task<void> splice_loop(uringpp::socket &a, uringpp::socket &b,
+                                uringpp::pipe_pool &pipes) {
+  co_await uringpp::copy_bidirectional(a, b, pipes);
+}
+
+static void run(char const *name, bool splice, size_t bytes, int pipe_size) {
+  auto loop = uringpp::event_loop::create(256);
+  uringpp::pipe_pool pipes(loop, pipe_size);
+  uint16_t proxy_port, echo_port;
+  int proxy_fd = listen_any(&proxy_port);
+  int echo_fd = listen_any(&echo_port);
+  std::thread server(echo_server, echo_fd);
+  size_t received = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::thread user(client, proxy_port, bytes, &received);
+  uringpp::socket downstream(loop, ::accept(proxy_fd, nullptr, nullptr));
+  uringpp::socket upstream(loop, connect_to(echo_port));
+  if (splice) {
+    loop->block_on(splice_loop(downstream, upstream, pipes));
+  } else {
+    loop->block_on(copy_loop(downstream, upstream));
+  }
+  user.join();
+  server.join();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (received != bytes) {
+    ::fprintf(stderr, "%s: received %zu of %zu bytes\n", name, received,
+              bytes);
+    ::exit(1);
+  }
+  ::printf("%-8s %6zu MiB each way in %7.3f s %9.1f MiB/s\n", name,
+           bytes >> 20, elapsed.count(),
+           2.0 * (bytes >> 20) / elapsed.count());
+  ::close(proxy_fd);
+  ::close(echo_fd);
+}
+
+int main(int argc, char *argv[]) {
+  size_t bytes = (argc > 1 ? ::atol(argv[1]) : 256) << 20;
+  int pipe_size = argc > 2 ? ::atoi(argv[2]) : 1 << 20;
+  run("copy", false, bytes, pipe_size);
+  run("splice", true, bytes, pipe_size);
+  return 0;
+}
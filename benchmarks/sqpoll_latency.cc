@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "uringpp/event_loop.h"
+#include "uringpp/task.h"
+
+/**
+ * Measures the round-trip latency of a one-byte ping-pong between a blocking
+ * client thread and an echo coroutine, with the default interrupt-driven ring
+ * and with SQPOLL, either sleeping in io_uring_enter for completions or busy
+ * polling the CQ, where a ping needs no syscall at all on the loop side.
+ */
+
+uringpp::task<void> echo(std::shared_ptr<uringpp::event_loop> loop, int fd,
+                         int iterations) {
+  char c;
+  for (int i = 0; i < iterations; ++i) {
+    co_await loop->recv(fd, &c, 1, 0);
+    co_await loop->send(fd, &c, 1, MSG_NOSIGNAL);
+  }
+}
+
+static void run(char const *name, uringpp::loop_options const &options,
+                bool busy, int iterations) {
+  std::shared_ptr<uringpp::event_loop> loop;
+  try {
+    loop = uringpp::event_loop::create(options);
+  } catch (std::exception const &e) {
+    ::printf("%-12s skipped: %s\n", name, e.what());
+    return;
+  }
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    ::perror("socketpair");
+    ::exit(1);
+  }
+  std::vector<long> samples(iterations);
+  std::thread client([&]() {
+    char c = 0;
+    for (auto &sample : samples) {
+      auto start = std::chrono::steady_clock::now();
+      if (::write(fds[1], &c, 1) != 1 || ::read(fds[1], &c, 1) != 1) {
+        ::perror("ping");
+        ::exit(1);
+      }
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      sample =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+  });
+  auto t = echo(loop, fds[0], iterations);
+  while (!t.h_.done()) {
+    if (busy) {
+      loop->poll_no_wait();
+    } else {
+      loop->poll();
+    }
+  }
+  client.join();
+  auto stats = loop->submit_stats();
+  std::sort(samples.begin(), samples.end());
+  ::printf("%-12s %8d iterations p50 %8.2f us p99 %8.2f us %6.2f enters/op\n",
+           name, iterations, samples[iterations / 2] / 1000.0,
+           samples[iterations * 99 / 100] / 1000.0,
+           static_cast<double>(stats.enters) / iterations);
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? ::atoi(argv[1]) : 100000;
+  int sq_thread_cpu = argc > 2 ? ::atoi(argv[2]) : -1;
+  run("interrupt", {}, false, iterations);
+  uringpp::loop_options sqpoll;
+  sqpoll.sqpoll = true;
+  sqpoll.sq_thread_cpu = sq_thread_cpu;
+  sqpoll.sq_thread_idle = 1000;
+  run("sqpoll", sqpoll, false, iterations);
+  run("sqpoll busy", sqpoll, true, iterations);
+  return 0;
+}
@@ -0,0 +1,66 @@
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+
+#include "uringpp/task.h"
+
+/**
+ * Measures the cost of co_await on a task<T>, both for a task which completes
+ * synchronously and for one which suspends and is resumed later.
+ */
+
+static std::coroutine_handle<> pending;
+
+struct manual_resume {
+  bool await_ready() noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) noexcept { pending = h; }
+  void await_resume() noexcept {}
+};
+
+uringpp::task<int> ready_leaf(int i) { co_return i; }
+
+uringpp::task<int> suspending_leaf(int i) {
+  co_await manual_resume{};
+  co_return i;
+}
+
+uringpp::task<long> await_ready_tasks(int iterations) {
+  long sum = 0;
+  for (int i = 0; i < iterations; ++i) {
+    sum += co_await ready_leaf(i);
+  }
+  co_return sum;
+}
+
+uringpp::task<long> await_suspending_tasks(int iterations) {
+  long sum = 0;
+  for (int i = 0; i < iterations; ++i) {
+    sum += co_await suspending_leaf(i);
+  }
+  co_return sum;
+}
+
+template <class F> static void run(char const *name, int iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+  ::printf("%-24s %10d iterations %8.2f ns/op\n", name, iterations,
+           static_cast<double>(ns.count()) / iterations);
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? ::atoi(argv[1]) : 10000000;
+  run("co_await ready task", iterations, [iterations]() {
+    auto t = await_ready_tasks(iterations);
+  });
+  run("co_await suspended task", iterations, [iterations]() {
+    auto t = await_suspending_tasks(iterations);
+    while (!t.h_.done()) {
+      std::exchange(pending, nullptr).resume();
+    }
+  });
+  return 0;
+}
@@ -0,0 +1,161 @@
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "latency_report.h"
+#include "uringpp/error.h"
+#include "uringpp/event_loop.h"
+#include "uringpp/socket.h"
+#include "uringpp/task.h"
+
+/**
+ * Measures the throughput and latency of an echo server over loopback TCP
+ * with a given number of connections. The server loop and the load generator
+ * loop run on their own threads; every connection of the generator sends a
+ * message, waits for the echo and repeats.
+ */
+
+static int listen_any(uint16_t *port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), len) < 0 ||
+      ::listen(fd, 1024) < 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) < 0) {
+    ::perror("listen");
+    ::exit(1);
+  }
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+static int connect_to(uint16_t port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  int one = 1;
+  if (fd < 0 ||
+      ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+    ::perror("connect");
+    ::exit(1);
+  }
+  return fd;
+}
+
+static uringpp::task<bool> recv_exact(uringpp::socket &s, char *buf,
+                                      size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    int rc = co_await s.recv(buf + done, len - done);
+    if (rc <= 0) {
+      co_return false;
+    }
+    done += rc;
+  }
+  co_return true;
+}
+
+uringpp::task<void> echo(uringpp::socket s, size_t message_size) {
+  std::vector<char> buf(message_size);
+  for (;;) {
+    bool received = co_await recv_exact(s, buf.data(), buf.size());
+    if (!received) {
+      break;
+    }
+    co_await s.send(buf.data(), buf.size(), MSG_NOSIGNAL);
+  }
+  co_await s.close();
+}
+
+uringpp::task<void> serve(std::shared_ptr<uringpp::event_loop> loop,
+                          int listen_fd, size_t connections,
+                          size_t message_size) {
+  std::vector<uringpp::task<void>> echoes;
+  for (size_t i = 0; i < connections; ++i) {
+    int fd = co_await loop->accept(listen_fd, nullptr, nullptr);
+    uringpp::check_nerrno(fd, "failed to accept");
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    echoes.push_back(echo(uringpp::socket(loop, fd), message_size));
+  }
+  for (auto &e : echoes) {
+    co_await e;
+  }
+}
+
+uringpp::task<void> ping(uringpp::socket &s, size_t iterations,
+                         size_t message_size, latency_samples &samples) {
+  std::vector<char> buf(message_size, 'x');
+  for (size_t i = 0; i < iterations; ++i) {
+    auto start = latency_samples::now_ns();
+    co_await s.send(buf.data(), buf.size(), MSG_NOSIGNAL);
+    bool received = co_await recv_exact(s, buf.data(), buf.size());
+    if (!received) {
+      ::fprintf(stderr, "connection closed\n");
+      ::exit(1);
+    }
+    samples.add(latency_samples::now_ns() - start);
+  }
+  co_await s.close();
+}
+
+uringpp::task<void> generate(std::vector<uringpp::socket> &sockets,
+                             size_t iterations, size_t message_size,
+                             latency_samples &samples) {
+  std::vector<uringpp::task<void>> pings;
+  for (auto &s : sockets) {
+    pings.push_back(
+        ping(s, iterations / sockets.size(), message_size, samples));
+  }
+  for (auto &p : pings) {
+    co_await p;
+  }
+}
+
+static void run(size_t connections, size_t iterations, size_t message_size) {
+  uint16_t port;
+  int listen_fd = listen_any(&port);
+  uint64_t server_enters = 0;
+  std::thread server([&]() {
+    auto loop = uringpp::event_loop::create(1024);
+    loop->block_on(serve(loop, listen_fd, connections, message_size));
+    server_enters = loop->submit_stats().enters;
+  });
+  auto loop = uringpp::event_loop::create(1024);
+  std::vector<uringpp::socket> sockets;
+  for (size_t i = 0; i < connections; ++i) {
+    sockets.emplace_back(loop, connect_to(port));
+  }
+  latency_samples samples(iterations);
+  auto start = latency_samples::now_ns();
+  loop->block_on(generate(sockets, iterations, message_size, samples));
+  double seconds = (latency_samples::now_ns() - start) / 1e9;
+  server.join();
+  ::close(listen_fd);
+  auto label = std::to_string(connections) + " conns " +
+               std::to_string(message_size) + " B";
+  /* The enters are the server's, per echo. */
+  samples.report(label.c_str(), samples.size(), seconds, server_enters);
+}
+
+int main(int argc, char *argv[]) {
+  size_t iterations = argc > 1 ? ::atol(argv[1]) : 200000;
+  size_t message_size = argc > 2 ? ::atol(argv[2]) : 64;
+  for (size_t connections : {1, 16, 64, 256}) {
+    run(connections, iterations, message_size);
+  }
+  return 0;
+}
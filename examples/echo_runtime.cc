@@ -0,0 +1,28 @@
+#include <cstdio>
+#include <sys/socket.h>
+
+#include <uringpp/uringpp.h>
+
+uringpp::task<void> echo(std::shared_ptr<uringpp::event_loop> loop) {
+  auto listener =
+      uringpp::tcp_listener::listen(loop, "0.0.0.0", "8888", 128, true);
+  auto &buffers = loop->register_buffer_ring(1024, 4096, 64);
+  auto handler = [&buffers](uringpp::socket socket) -> uringpp::task<void> {
+    auto stream = socket.recv_multishot(buffers);
+    while (auto buf = co_await stream.next()) {
+      co_await socket.send(buf.data(), buf.size(), MSG_NOSIGNAL);
+    }
+  };
+  auto connections = listener.accept_multishot();
+  while (true) {
+    handler(co_await connections.next()).detach();
+  }
+}
+
+int main() {
+  uringpp::runtime rt;
+  ::printf("serving on %zu loops\n", rt.size());
+  rt.spawn_all(echo);
+  rt.join();
+  return 0;
+}
@@ -13,18 +13,18 @@
 
 uringpp::task<void> echo_server(std::shared_ptr<uringpp::event_loop> loop) {
   auto listener = uringpp::tcp_listener::listen(loop, "0.0.0.0", "8888");
-  auto handler = [loop](uringpp::socket socket) -> uringpp::task<void> {
-    char buf[1024];
-    int n = 0;
-    while ((n = co_await socket.recv(buf, sizeof(buf))) > 0) {
-      co_await socket.send(buf, n, MSG_NOSIGNAL);
+  auto &buffers = loop->register_buffer_ring(1024, 4096, 64);
+  auto handler = [&buffers](uringpp::socket socket) -> uringpp::task<void> {
+    auto stream = socket.recv_multishot(buffers);
+    while (auto buf = co_await stream.next()) {
+      co_await socket.send(buf.data(), buf.size(), MSG_NOSIGNAL);
     }
-    ::printf("client fd=%d disconnected n=%d\n", socket.fd(), n);
+    ::printf("client fd=%d disconnected\n", socket.fd());
   };
+  auto connections = listener.accept_multishot();
   while (true) {
-    auto [addr, socket] = co_await listener.accept();
-    ::printf("accepted connection fd=%d from %s:%d\n", socket.fd(),
-             addr.ip().c_str(), addr.port());
+    auto socket = co_await connections.next();
+    ::printf("accepted connection fd=%d\n", socket.fd());
     handler(std::move(socket)).detach();
   }
 }
@@ -2,26 +2,106 @@
 
 #include <coroutine>
 #include <liburing.h>
+#include <utility>
+
+#include "uringpp/metrics.h"
 
 #include "uringpp/detail/debug.h"
 
 namespace uringpp {
 
+namespace detail {
+
+/* A blocking call standing for an op the kernel lacks, run off the loop. */
+struct offloaded_call {
+  int rc_ = 0;
+  virtual void start(std::coroutine_handle<> h) = 0;
+  virtual ~offloaded_call() = default;
+};
+
+} // namespace detail
+
 class sqe_awaitable {
   friend class event_loop;
+  friend class sqe_chain;
   struct io_uring_sqe *sqe_;
+  detail::offloaded_call *call_ = nullptr;
   std::coroutine_handle<> h_;
   int rc_;
+  uint32_t flags_ = 0;
+#ifdef URINGPP_METRICS
+  uint8_t opcode_;
+  uint64_t start_ns_;
+#endif
 
 public:
   sqe_awaitable(struct io_uring_sqe *sqe) : sqe_(sqe) {}
-  bool await_ready() noexcept { return false; }
+
+  /**
+   * @brief Make an awaitable which is already complete, e.g. with the result
+   * of a blocking call made because the kernel lacks the op.
+   *
+   * @param rc The result, or a negated errno.
+   * @return sqe_awaitable The awaitable, which does not suspend.
+   */
+  static sqe_awaitable completed(int rc) {
+    sqe_awaitable op(nullptr);
+    op.rc_ = rc;
+    return op;
+  }
+
+  /**
+   * @brief Make an awaitable which runs a call off the loop when awaited,
+   * e.g. a blocking call standing for an op the kernel lacks.
+   *
+   * @param call The call, freed once awaited.
+   * @return sqe_awaitable The awaitable.
+   */
+  static sqe_awaitable offloaded(detail::offloaded_call *call) {
+    sqe_awaitable op(nullptr);
+    op.call_ = call;
+    return op;
+  }
+
+  bool await_ready() noexcept { return sqe_ == nullptr && call_ == nullptr; }
   bool await_suspend(std::coroutine_handle<> h) {
+    if (call_ != nullptr) [[unlikely]] {
+      call_->start(h);
+      return true;
+    }
     h_ = h;
+#ifdef URINGPP_METRICS
+    opcode_ = sqe_->opcode;
+    start_ns_ = detail::monotonic_ns();
+#endif
     ::io_uring_sqe_set_data(sqe_, this);
     return true;
   }
-  int await_resume() { return rc_; }
+  int await_resume() {
+    if (call_ != nullptr) [[unlikely]] {
+      rc_ = call_->rc_;
+      delete std::exchange(call_, nullptr);
+    }
+    return rc_;
+  }
+
+  /**
+   * @brief Get the flags of the CQE, once the op has completed.
+   *
+   * @return uint32_t The IORING_CQE_F_* flags, e.g. IORING_CQE_F_BUFFER.
+   */
+  uint32_t cqe_flags() const { return flags_; }
+
+  /**
+   * @brief Get the buffer the kernel picked for an op submitted with
+   * IOSQE_BUFFER_SELECT, once it has completed.
+   *
+   * @return int The buffer ID, or -1 if no buffer was consumed.
+   */
+  int buffer_id() const {
+    return (flags_ & IORING_CQE_F_BUFFER) ? flags_ >> IORING_CQE_BUFFER_SHIFT
+                                          : -1;
+  }
 };
 
 } // namespace uringpp
\ No newline at end of file
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <liburing.h>
+#include <utility>
+#include <vector>
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+class fixed_buffer;
+
+/**
+ * @brief A pool of buffers registered with the kernel (IORING_REGISTER_BUFFERS)
+ * for read_fixed and write_fixed, which skip pinning and unpinning the pages of
+ * the buffer on every operation.
+ *
+ * The memory is mapped upfront as contiguous slabs backed by huge pages if
+ * available. Each slab is registered as one buffer and split into buffers of
+ * the pool, so a leased buffer is identified by the index of its slab.
+ */
+class fixed_buffer_pool : public noncopyable {
+  struct io_uring *ring_;
+  size_t buffer_size_;
+  size_t slab_size_;
+  unsigned capacity_;
+  uint8_t *base_;
+  size_t mapped_size_;
+  std::vector<uint8_t *> free_buffers_;
+  bool huge_pages_;
+
+  friend class fixed_buffer;
+
+  void give_back(uint8_t *buffer) { free_buffers_.push_back(buffer); }
+
+public:
+  static constexpr size_t kSlabSize = 2 * 1024 * 1024;
+
+  /**
+   * @brief Allocate and register a new pool. The ring must have no other
+   * buffers registered.
+   *
+   * @param ring The io_uring to register with.
+   * @param buffer_size The size of each buffer.
+   * @param nr_buffers The number of buffers.
+   * @param huge_pages Whether to try to back the slabs by huge pages, first
+   * with MAP_HUGETLB and then with transparent huge pages.
+   */
+  fixed_buffer_pool(struct io_uring *ring, size_t buffer_size,
+                    unsigned nr_buffers, bool huge_pages = true);
+
+  /**
+   * @brief Unregister the pool and free its memory. All leases must have been
+   * returned.
+   *
+   */
+  ~fixed_buffer_pool();
+
+  /**
+   * @brief Get the size of each buffer.
+   *
+   * @return size_t The size of each buffer.
+   */
+  size_t buffer_size() const { return buffer_size_; }
+
+  /**
+   * @brief Get the number of buffers in the pool.
+   *
+   * @return unsigned The number of buffers.
+   */
+  unsigned capacity() const { return capacity_; }
+
+  /**
+   * @brief Get the number of buffers not leased.
+   *
+   * @return unsigned The number of free buffers.
+   */
+  unsigned available() const { return free_buffers_.size(); }
+
+  /**
+   * @brief Whether the slabs are backed by MAP_HUGETLB pages.
+   *
+   * @return bool True if hugetlbfs pages are used.
+   */
+  bool huge_pages() const { return huge_pages_; }
+
+  /**
+   * @brief Get the registered buffer index of a buffer of the pool.
+   *
+   * @param buffer The start of the buffer.
+   * @return int The index of the slab holding the buffer.
+   */
+  int index_of(uint8_t const *buffer) const {
+    return (buffer - base_) / slab_size_;
+  }
+
+  /**
+   * @brief Lease a buffer.
+   *
+   * @return fixed_buffer The buffer, or an empty lease if all buffers are
+   * leased.
+   */
+  fixed_buffer lease();
+};
+
+/**
+ * @brief A buffer leased from a fixed buffer pool. It is returned to the pool
+ * when destroyed, so it must outlive the operations using it.
+ *
+ */
+class fixed_buffer : public noncopyable {
+  fixed_buffer_pool *pool_ = nullptr;
+  uint8_t *data_ = nullptr;
+  int index_ = -1;
+
+public:
+  fixed_buffer() = default;
+
+  /**
+   * @brief Construct a new fixed buffer object
+   *
+   * @param pool The pool the buffer belongs to.
+   * @param data The start of the buffer.
+   */
+  fixed_buffer(fixed_buffer_pool *pool, uint8_t *data)
+      : pool_(pool), data_(data), index_(pool->index_of(data)) {}
+
+  /**
+   * @brief Move construct a new fixed buffer object
+   *
+   * @param other
+   */
+  fixed_buffer(fixed_buffer &&other) noexcept
+      : pool_(std::exchange(other.pool_, nullptr)),
+        data_(std::exchange(other.data_, nullptr)),
+        index_(std::exchange(other.index_, -1)) {}
+
+  fixed_buffer &operator=(fixed_buffer &&other) noexcept {
+    if (this != &other) {
+      release();
+      pool_ = std::exchange(other.pool_, nullptr);
+      data_ = std::exchange(other.data_, nullptr);
+      index_ = std::exchange(other.index_, -1);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Get the start of the buffer.
+   *
+   * @return uint8_t* The start of the buffer.
+   */
+  uint8_t *data() const { return data_; }
+
+  /**
+   * @brief Get the size of the buffer.
+   *
+   * @return size_t The size of the buffer.
+   */
+  size_t size() const { return pool_ ? pool_->buffer_size() : 0; }
+
+  /**
+   * @brief Get the registered buffer index to pass to read_fixed and
+   * write_fixed.
+   *
+   * @return int The buffer index.
+   */
+  int index() const { return index_; }
+
+  /**
+   * @brief Whether the lease holds a buffer.
+   *
+   */
+  explicit operator bool() const { return pool_ != nullptr; }
+
+  /**
+   * @brief Return the buffer to the pool before destruction.
+   *
+   */
+  void release() {
+    if (pool_ != nullptr) {
+      std::exchange(pool_, nullptr)->give_back(data_);
+      data_ = nullptr;
+      index_ = -1;
+    }
+  }
+
+  ~fixed_buffer() { release(); }
+};
+
+inline fixed_buffer fixed_buffer_pool::lease() {
+  if (free_buffers_.empty()) [[unlikely]] {
+    return {};
+  }
+  auto buffer = free_buffers_.back();
+  free_buffers_.pop_back();
+  return fixed_buffer(this, buffer);
+}
+
+} // namespace uringpp
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <liburing.h>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief A ring of buffers provided to the kernel (IORING_REGISTER_PBUF_RING).
+ * Operations submitted with IOSQE_BUFFER_SELECT pick a buffer from the ring
+ * only when data arrives, so memory scales with in-flight bytes rather than
+ * with the number of pending operations.
+ *
+ * The ring has a fixed capacity, but buffers are only allocated when the ring
+ * grows, so it can start small and expand under load.
+ */
+class provided_buffer_ring : public noncopyable {
+public:
+  /**
+   * @brief Something to notify when a buffer is recycled, e.g. a multishot
+   * receive terminated by ENOBUFS while the ring is at capacity.
+   *
+   */
+  class waiter {
+    friend class provided_buffer_ring;
+    bool waiting_ = false;
+
+  protected:
+    /**
+     * @brief Called once a buffer has been given back to the kernel, on the
+     * thread recycling it.
+     *
+     */
+    virtual void on_recycle() = 0;
+    ~waiter() = default;
+  };
+
+private:
+  struct io_uring *ring_;
+  struct io_uring_buf_ring *br_;
+  uint16_t bgid_;
+  unsigned entries_;
+  size_t buffer_size_;
+  std::vector<std::unique_ptr<uint8_t[]>> chunks_;
+  std::vector<uint8_t *> buffers_;
+  std::vector<waiter *> waiters_;
+  uint64_t recycled_ = 0;
+
+  void notify_waiters();
+
+public:
+  /**
+   * @brief Register a new buffer ring.
+   *
+   * @param ring The io_uring to register with.
+   * @param bgid The buffer group ID.
+   * @param entries The capacity of the ring. Must be a power of 2.
+   * @param buffer_size The size of each buffer.
+   * @param initial_buffers The number of buffers to allocate upfront.
+   */
+  provided_buffer_ring(struct io_uring *ring, uint16_t bgid, unsigned entries,
+                       size_t buffer_size, unsigned initial_buffers);
+
+  /**
+   * @brief Unregister the ring and free all buffers.
+   *
+   */
+  ~provided_buffer_ring();
+
+  /**
+   * @brief Get the buffer group ID to use with IOSQE_BUFFER_SELECT.
+   *
+   * @return uint16_t The buffer group ID.
+   */
+  uint16_t group_id() const { return bgid_; }
+
+  /**
+   * @brief Get the size of each buffer.
+   *
+   * @return size_t The size of each buffer.
+   */
+  size_t buffer_size() const { return buffer_size_; }
+
+  /**
+   * @brief Get the maximum number of buffers in the ring.
+   *
+   * @return unsigned The capacity of the ring.
+   */
+  unsigned capacity() const { return entries_; }
+
+  /**
+   * @brief Get the number of buffers allocated so far.
+   *
+   * @return unsigned The number of buffers.
+   */
+  unsigned size() const { return buffers_.size(); }
+
+  /**
+   * @brief Get the address of a buffer.
+   *
+   * @param bid The buffer ID.
+   * @return uint8_t* The start of the buffer.
+   */
+  uint8_t *buffer(uint16_t bid) const { return buffers_[bid]; }
+
+  /**
+   * @brief Give a buffer back to the kernel.
+   *
+   * @param bid The buffer ID.
+   */
+  void recycle(uint16_t bid) {
+    ::io_uring_buf_ring_add(br_, buffers_[bid], buffer_size_, bid,
+                            ::io_uring_buf_ring_mask(entries_), 0);
+    ::io_uring_buf_ring_advance(br_, 1);
+    ++recycled_;
+    if (!waiters_.empty()) [[unlikely]] {
+      notify_waiters();
+    }
+  }
+
+  /**
+   * @brief Get the number of buffers recycled so far.
+   *
+   * @return uint64_t The number of recycles.
+   */
+  uint64_t recycled() const { return recycled_; }
+
+  /**
+   * @brief Notify a waiter once, when the next buffer is recycled.
+   *
+   * @param w The waiter. Must be cancelled before it is destroyed.
+   */
+  void wait(waiter *w) {
+    if (!w->waiting_) {
+      w->waiting_ = true;
+      waiters_.push_back(w);
+    }
+  }
+
+  /**
+   * @brief Whether an operation terminated by ENOBUFS should wait for a
+   * buffer to be recycled rather than be re-armed. Grows the ring if it is
+   * not at capacity yet.
+   *
+   * @param recycled The value of recycled() when the operation was armed.
+   * The kernel may have run out before buffers recycled since then.
+   * @return true if the ring is at capacity and no buffer came back since.
+   */
+  bool starved(uint64_t recycled) {
+    return grow(std::max(size(), 1U)) == 0 && recycled == recycled_;
+  }
+
+  /**
+   * @brief Stop notifying a waiter.
+   *
+   * @param w The waiter.
+   */
+  void cancel_wait(waiter *w) {
+    if (w->waiting_) {
+      w->waiting_ = false;
+      std::erase(waiters_, w);
+    }
+  }
+
+  /**
+   * @brief Allocate more buffers and provide them to the kernel.
+   *
+   * @param count The number of buffers to add.
+   * @return unsigned The number of buffers actually added, which is limited by
+   * the capacity of the ring.
+   */
+  unsigned grow(unsigned count);
+};
+
+/**
+ * @brief A buffer borrowed from a provided buffer ring. It is given back to the
+ * kernel when destroyed.
+ *
+ */
+class provided_buffer : public noncopyable {
+  provided_buffer_ring *ring_ = nullptr;
+  uint16_t bid_ = 0;
+  size_t size_ = 0;
+
+public:
+  provided_buffer() = default;
+
+  /**
+   * @brief Construct a new provided buffer object
+   *
+   * @param ring The ring the buffer belongs to.
+   * @param bid The buffer ID.
+   * @param size The number of valid bytes in the buffer.
+   */
+  provided_buffer(provided_buffer_ring *ring, uint16_t bid, size_t size)
+      : ring_(ring), bid_(bid), size_(size) {}
+
+  /**
+   * @brief Move construct a new provided buffer object
+   *
+   * @param other
+   */
+  provided_buffer(provided_buffer &&other) noexcept
+      : ring_(std::exchange(other.ring_, nullptr)), bid_(other.bid_),
+        size_(std::exchange(other.size_, 0)) {}
+
+  provided_buffer &operator=(provided_buffer &&other) noexcept {
+    if (this != &other) {
+      release();
+      ring_ = std::exchange(other.ring_, nullptr);
+      bid_ = other.bid_;
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Get the data in the buffer.
+   *
+   * @return uint8_t* The start of the data.
+   */
+  uint8_t *data() const { return ring_ ? ring_->buffer(bid_) : nullptr; }
+
+  /**
+   * @brief Get the number of valid bytes in the buffer.
+   *
+   * @return size_t The number of bytes.
+   */
+  size_t size() const { return size_; }
+
+  /**
+   * @brief Get the buffer ID.
+   *
+   * @return uint16_t The buffer ID.
+   */
+  uint16_t id() const { return bid_; }
+
+  /**
+   * @brief Whether the buffer holds any data.
+   *
+   */
+  explicit operator bool() const { return size_ > 0; }
+
+  /**
+   * @brief Give the buffer back to the kernel before destruction.
+   *
+   */
+  void release() {
+    if (ring_ != nullptr) {
+      std::exchange(ring_, nullptr)->recycle(bid_);
+      size_ = 0;
+    }
+  }
+
+  ~provided_buffer() { release(); }
+};
+
+} // namespace uringpp
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string_view>
+#include <sys/uio.h>
+#include <utility>
+#include <vector>
+
+#include "uringpp/socket.h"
+#include "uringpp/task.h"
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief A socket with a read-ahead buffer and coalesced writes.
+ *
+ * Writes are copied into segments, or adopt large buffers as segments of their
+ * own, and all writes made during a completion pass of the loop are sent by a
+ * single sendmsg over the segments at the end of the pass. Reads fill a buffer
+ * with as much as the socket has, and the views returned by the read helpers
+ * point into it until the next read.
+ *
+ * The stream may be moved or destroyed while a flush is in flight: the data
+ * queued so far is still sent, and the socket is closed once it is.
+ */
+class buffered_stream : public noncopyable {
+  /* The socket and the write side, shared with the flush in flight. */
+  struct state {
+    socket socket_;
+    size_t segment_size_;
+    std::vector<std::vector<char>> pending_;
+    std::vector<std::vector<char>> sending_;
+    std::vector<std::vector<char>> spare_;
+    std::vector<struct iovec> iovecs_;
+    size_t pending_bytes_ = 0;
+    size_t prepared_ = 0;
+    std::vector<std::coroutine_handle<>> flush_waiters_;
+    std::exception_ptr write_error_;
+    bool flushing_ = false;
+
+    state(socket s, size_t segment_size)
+        : socket_(std::move(s)), segment_size_(segment_size) {}
+  };
+
+  std::shared_ptr<state> state_;
+  std::vector<char> read_buffer_;
+  size_t read_head_ = 0;
+  size_t read_tail_ = 0;
+  size_t consumed_ = 0;
+
+  static task<void> flush_pending(std::shared_ptr<state> s);
+
+  task<bool> fill();
+
+  void consume() {
+    read_head_ += consumed_;
+    consumed_ = 0;
+  }
+
+  void reserve(size_t capacity);
+
+  std::vector<char> &writable_segment(size_t room);
+
+  void schedule_flush() {
+    if (!state_->flushing_) {
+      state_->flushing_ = true;
+      flush_pending(state_).detach();
+    }
+  }
+
+public:
+  static constexpr size_t kDefaultReadBufferSize = 65536;
+  static constexpr size_t kDefaultSegmentSize = 16384;
+
+  /**
+   * @brief Construct a new buffered stream object
+   *
+   * @param s The socket.
+   * @param read_buffer_size The initial size of the read buffer. It grows to
+   * fit the longest message read.
+   * @param segment_size The size of the segments writes are copied into.
+   * Writes adopting buffers of at least this size are not copied.
+   */
+  explicit buffered_stream(socket s,
+                           size_t read_buffer_size = kDefaultReadBufferSize,
+                           size_t segment_size = kDefaultSegmentSize);
+
+  /**
+   * @brief Get the underlying socket.
+   *
+   * @return socket& The socket.
+   */
+  socket &lower() { return state_->socket_; }
+
+  /**
+   * @brief Get the number of bytes read ahead and not consumed yet.
+   *
+   * @return size_t The number of buffered bytes.
+   */
+  size_t buffered() const { return read_tail_ - read_head_ - consumed_; }
+
+  /**
+   * @brief Get the number of bytes written and not sent yet.
+   *
+   * @return size_t The number of pending bytes.
+   */
+  size_t pending() const { return state_->pending_bytes_; }
+
+  /**
+   * @brief Queue data to be sent at the end of the current completion pass.
+   * Throws if an earlier send failed.
+   *
+   * @param data The data, copied into the stream.
+   * @param len The length of the data.
+   */
+  void write(void const *data, size_t len);
+
+  /**
+   * @brief Queue data to be sent at the end of the current completion pass.
+   * Throws if an earlier send failed.
+   *
+   * @param data The data, copied into the stream.
+   */
+  void write(std::string_view data) { write(data.data(), data.size()); }
+
+  /**
+   * @brief Queue a buffer to be sent at the end of the current completion
+   * pass. Buffers of at least the segment size are sent as they are. Throws if
+   * an earlier send failed.
+   *
+   * @param data The buffer.
+   */
+  void write(std::vector<char> &&data);
+
+  /**
+   * @brief Get room for n bytes at the end of the queued data, to encode into
+   * it in place. Must be followed by commit() before the coroutine suspends or
+   * writes anything else. Throws if an earlier send failed.
+   *
+   * @param n The number of bytes to reserve.
+   * @return char* The room, uninitialized as far as the caller is concerned.
+   */
+  char *prepare(size_t n);
+
+  /**
+   * @brief Queue the first n bytes of the room returned by prepare() to be
+   * sent at the end of the current completion pass.
+   *
+   * @param n The number of bytes written, at most the number prepared.
+   */
+  void commit(size_t n);
+
+  /**
+   * @brief Wait until all queued data has been sent. Writers which may
+   * outpace the peer should flush once pending() grows large.
+   *
+   * @return task<void> Completes once the data is sent. Errors are thrown.
+   */
+  task<void> flush();
+
+  /**
+   * @brief Read up to and including a delimiter.
+   *
+   * @param delimiter The delimiter.
+   * @param max_length The maximum length of the data including the delimiter.
+   * @return task<std::string_view> The data, valid until the next read. Empty
+   * if the peer closed the connection before sending any data. Throws if the
+   * connection is closed in the middle of the data or no delimiter is found in
+   * max_length bytes.
+   */
+  task<std::string_view> read_until(std::string_view delimiter,
+                                    size_t max_length = SIZE_MAX);
+
+  /**
+   * @brief Read exactly the given number of bytes.
+   *
+   * @param n The number of bytes.
+   * @return task<std::string_view> The data, valid until the next read. Empty
+   * if the peer closed the connection before sending any data. Throws if the
+   * connection is closed in the middle of the data.
+   */
+  task<std::string_view> read_exact(size_t n);
+
+  /**
+   * @brief Read whatever is buffered, or receive once if nothing is.
+   *
+   * @param buf The buffer to copy the data to.
+   * @param len The size of the buffer.
+   * @return task<size_t> The number of bytes read, 0 if the peer closed the
+   * connection. Errors are thrown.
+   */
+  task<size_t> read_some(void *buf, size_t len);
+
+  /**
+   * @brief Flush the stream and close the socket.
+   *
+   * @return task<void>
+   */
+  task<void> close();
+};
+
+} // namespace uringpp
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fcntl.h>
+#include <vector>
+
+#include "uringpp/buffer_pool.h"
+#include "uringpp/error.h"
+#include "uringpp/file.h"
+#include "uringpp/task.h"
+
+namespace uringpp {
+
+/**
+ * @brief How a bulk transfer is split. With O_DIRECT, the chunk size and the
+ * offset must be multiples of the alignment of the file.
+ *
+ */
+struct bulk_options {
+  /**
+   * @brief The size of each read or write, at most 1 GiB.
+   */
+  size_t chunk_size = 1 << 20;
+  /**
+   * @brief The maximum number of chunks in flight.
+   */
+  unsigned depth = 16;
+};
+
+/**
+ * @brief What a bulk write makes durable once all chunks are written.
+ *
+ */
+enum class bulk_sync {
+  none,
+  /* Start writeback of each chunk as it lands, then fdatasync. */
+  data,
+  /* Start writeback of each chunk as it lands, then fsync. */
+  all,
+};
+
+namespace detail {
+
+/**
+ * @brief Hands out the chunks of a range to the workers of a bulk transfer,
+ * in order of offset.
+ *
+ */
+class bulk_cursor {
+  off_t next_;
+  off_t end_;
+  size_t chunk_size_;
+
+public:
+  bulk_cursor(off_t offset, size_t count, size_t chunk_size)
+      : next_(offset), end_(offset + static_cast<off_t>(count)),
+        chunk_size_(std::clamp<size_t>(chunk_size, 1, 1 << 30)) {}
+
+  bool claim(off_t &offset, size_t &len) {
+    if (next_ >= end_) {
+      return false;
+    }
+    offset = next_;
+    len = std::min<size_t>(chunk_size_, end_ - next_);
+    next_ += len;
+    return true;
+  }
+
+  /* No chunks are handed out past end, e.g. the end of the file. */
+  void truncate(off_t end) { end_ = std::min(end_, end); }
+
+  void stop() { end_ = next_; }
+};
+
+template <class Work>
+task<void> bulk_worker(bulk_cursor &cursor, Work &work) {
+  off_t offset;
+  size_t len;
+  try {
+    while (cursor.claim(offset, len)) {
+      co_await work(offset, len);
+    }
+  } catch (...) {
+    cursor.stop();
+    throw;
+  }
+}
+
+/**
+ * @brief Run up to depth workers over the chunks of the cursor and wait for
+ * all of them, rethrowing the first error once none is left in flight.
+ *
+ */
+template <class Work>
+task<void> run_bulk(bulk_cursor &cursor, unsigned depth, Work &work) {
+  std::vector<task<void>> workers;
+  workers.reserve(std::max(depth, 1u));
+  for (unsigned i = 0; i < std::max(depth, 1u); ++i) {
+    workers.push_back(bulk_worker(cursor, work));
+  }
+  std::exception_ptr error;
+  for (auto &worker : workers) {
+    try {
+      co_await worker;
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace detail
+
+/**
+ * @brief Read a range of a file into memory, splitting it into chunks read
+ * concurrently.
+ *
+ * @param f The file.
+ * @param buf The buffer to read into, of at least count bytes.
+ * @param count The number of bytes to read.
+ * @param offset The offset to start reading from.
+ * @param options How the range is split.
+ * @return task<size_t> The number of bytes read, fewer than count if the file
+ * ends first. Errors are thrown once no chunk is in flight.
+ */
+inline task<size_t> bulk_read(file &f, void *buf, size_t count, off_t offset,
+                              bulk_options options = {}) {
+  detail::bulk_cursor cursor(offset, count, options.chunk_size);
+  auto base = static_cast<uint8_t *>(buf);
+  off_t eof = offset + static_cast<off_t>(count);
+  auto work = [&](off_t chunk, size_t len) -> task<void> {
+    size_t done = 0;
+    while (done < len) {
+      int rc = co_await f.read(base + (chunk - offset) + done, len - done,
+                               chunk + done);
+      check_nerrno(rc, "failed to read file");
+      if (rc == 0) {
+        eof = std::min<off_t>(eof, chunk + done);
+        cursor.truncate(eof);
+        break;
+      }
+      done += rc;
+    }
+  };
+  co_await detail::run_bulk(cursor, options.depth, work);
+  co_return eof - offset;
+}
+
+/**
+ * @brief Read a range of a file through leased fixed buffers, passing each
+ * chunk to a callback as it lands instead of copying it. The chunk size is
+ * the buffer size of the pool, and at most one chunk per available buffer is
+ * in flight.
+ *
+ * @param f The file.
+ * @param pool The pool to lease buffers from.
+ * @param count The number of bytes to read.
+ * @param offset The offset to start reading from.
+ * @param on_chunk Called as on_chunk(offset, data, len) for each chunk, in
+ * completion order. The data is only valid during the call, which must not
+ * suspend.
+ * @param depth The maximum number of chunks in flight.
+ * @return task<size_t> The number of bytes read, fewer than count if the file
+ * ends first. Errors are thrown once no chunk is in flight.
+ */
+template <class OnChunk>
+task<size_t> bulk_read_fixed(file &f, fixed_buffer_pool &pool, size_t count,
+                             off_t offset, OnChunk on_chunk,
+                             unsigned depth = bulk_options{}.depth) {
+  depth = std::min(depth, pool.available());
+  if (depth == 0 && count > 0) [[unlikely]] {
+    throw_with("failed to read file: no fixed buffer available");
+  }
+  detail::bulk_cursor cursor(offset, count, pool.buffer_size());
+  off_t eof = offset + static_cast<off_t>(count);
+  auto work = [&](off_t chunk, size_t len) -> task<void> {
+    auto buf = pool.lease();
+    if (!buf) [[unlikely]] {
+      throw_with("failed to read file: no fixed buffer available");
+    }
+    size_t done = 0;
+    while (done < len) {
+      int rc = co_await f.read_fixed(buf.data() + done, len - done,
+                                     chunk + done, buf.index());
+      check_nerrno(rc, "failed to read file");
+      if (rc == 0) {
+        eof = std::min<off_t>(eof, chunk + done);
+        cursor.truncate(eof);
+        break;
+      }
+      done += rc;
+    }
+    if (done > 0) {
+      on_chunk(chunk, static_cast<uint8_t const *>(buf.data()), done);
+    }
+  };
+  co_await detail::run_bulk(cursor, depth, work);
+  co_return eof - offset;
+}
+
+/**
+ * @brief Write a buffer to a range of a file, splitting it into chunks
+ * written concurrently. Chunks may land in any order; only once all of them
+ * are written is the file synced. Syncing is not supported on loops created
+ * with loop_options::iopoll.
+ *
+ * @param f The file.
+ * @param buf The buffer to write from.
+ * @param count The number of bytes to write.
+ * @param offset The offset to start writing at.
+ * @param sync What to make durable once written.
+ * @param options How the range is split.
+ * @return task<void> Completes once written and synced. Errors are thrown
+ * once no chunk is in flight.
+ */
+inline task<void> bulk_write(file &f, void const *buf, size_t count,
+                             off_t offset, bulk_sync sync = bulk_sync::none,
+                             bulk_options options = {}) {
+  detail::bulk_cursor cursor(offset, count, options.chunk_size);
+  auto base = static_cast<uint8_t const *>(buf);
+  auto work = [&](off_t chunk, size_t len) -> task<void> {
+    size_t done = 0;
+    while (done < len) {
+      int rc = co_await f.write(base + (chunk - offset) + done, len - done,
+                                chunk + done);
+      check_nerrno(rc, "failed to write file");
+      if (rc == 0) [[unlikely]] {
+        throw_with("failed to write file: no progress at offset %jd",
+                   static_cast<intmax_t>(chunk + done));
+      }
+      done += rc;
+    }
+    if (sync != bulk_sync::none) {
+      /* Overlap writeback with the remaining chunks instead of leaving all
+       * of it to the final sync. */
+      int rc = co_await f.sync_file_range(chunk, len, SYNC_FILE_RANGE_WRITE);
+      check_nerrno(rc, "failed to start writeback");
+    }
+  };
+  co_await detail::run_bulk(cursor, options.depth, work);
+  if (sync != bulk_sync::none) {
+    int rc =
+        co_await f.fsync(sync == bulk_sync::data ? IORING_FSYNC_DATASYNC : 0);
+    check_nerrno(rc, "failed to sync file");
+  }
+}
+
+} // namespace uringpp
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "uringpp/buffer_pool.h"
+#include "uringpp/buffered_stream.h"
+#include "uringpp/error.h"
+#include "uringpp/task.h"
+
+#include "uringpp/detail/serdes.h"
+
+namespace uringpp {
+
+/**
+ * @brief Encodes values into a caller-provided buffer, such as a fixed buffer
+ * lease or the room prepared in a buffered stream. Fixed-size values are in
+ * network byte order unless the _le variants are used. Throws if the buffer is
+ * too small.
+ *
+ */
+class encoder {
+  uint8_t *begin_;
+  uint8_t *pos_;
+  uint8_t *end_;
+
+  uint8_t *advance(size_t n) {
+    if (static_cast<size_t>(end_ - pos_) < n) [[unlikely]] {
+      throw_with("failed to encode: %zu bytes needed, %zu left", n,
+                 static_cast<size_t>(end_ - pos_));
+    }
+    return std::exchange(pos_, pos_ + n);
+  }
+
+public:
+  /**
+   * @brief Construct a new encoder object
+   *
+   * @param data The buffer to encode into.
+   * @param size The size of the buffer.
+   */
+  encoder(void *data, size_t size)
+      : begin_(static_cast<uint8_t *>(data)), pos_(begin_),
+        end_(begin_ + size) {}
+
+  /**
+   * @brief Construct a new encoder object encoding into a fixed buffer.
+   *
+   * @param buffer The buffer.
+   */
+  explicit encoder(fixed_buffer &buffer)
+      : encoder(buffer.data(), buffer.size()) {}
+
+  /**
+   * @brief Get the start of the buffer.
+   *
+   * @return uint8_t* The start of the buffer.
+   */
+  uint8_t *data() const { return begin_; }
+
+  /**
+   * @brief Get the number of bytes encoded.
+   *
+   * @return size_t The number of bytes encoded.
+   */
+  size_t size() const { return pos_ - begin_; }
+
+  /**
+   * @brief Get the number of bytes left in the buffer.
+   *
+   * @return size_t The number of bytes left.
+   */
+  size_t remaining() const { return end_ - pos_; }
+
+  /**
+   * @brief Encode a value in network byte order.
+   *
+   * @param value The value.
+   * @return encoder& The encoder.
+   */
+  template <detail::wire_scalar T> encoder &put(T value) {
+    detail::store<std::endian::big>(advance(sizeof(T)), value);
+    return *this;
+  }
+
+  /**
+   * @brief Encode a value in little-endian byte order.
+   *
+   * @param value The value.
+   * @return encoder& The encoder.
+   */
+  template <detail::wire_scalar T> encoder &put_le(T value) {
+    detail::store<std::endian::little>(advance(sizeof(T)), value);
+    return *this;
+  }
+
+  /**
+   * @brief Encode an array in network byte order.
+   *
+   * @param values The array.
+   * @param n The number of elements.
+   * @return encoder& The encoder.
+   */
+  template <detail::wire_scalar T>
+  encoder &put_array(T const *values, size_t n) {
+    detail::store_array<std::endian::big>(advance(n * sizeof(T)), values, n);
+    return *this;
+  }
+
+  /**
+   * @brief Encode an array in little-endian byte order.
+   *
+   * @param values The array.
+   * @param n The number of elements.
+   * @return encoder& The encoder.
+   */
+  template <detail::wire_scalar T>
+  encoder &put_array_le(T const *values, size_t n) {
+    detail::store_array<std::endian::little>(advance(n * sizeof(T)), values,
+                                             n);
+    return *this;
+  }
+
+  /**
+   * @brief Encode an unsigned value as LEB128.
+   *
+   * @param value The value.
+   * @return encoder& The encoder.
+   */
+  encoder &put_varint(uint64_t value) {
+    if (remaining() >= detail::kMaxVarintSize) [[likely]] {
+      pos_ = detail::store_varint(pos_, value);
+    } else {
+      detail::store_varint(advance(detail::varint_size(value)), value);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Encode a signed value as zigzag LEB128, so that values close to 0
+   * are short.
+   *
+   * @param value The value.
+   * @return encoder& The encoder.
+   */
+  encoder &put_zigzag(int64_t value) {
+    return put_varint(detail::zigzag_encode(value));
+  }
+
+  /**
+   * @brief Copy raw bytes.
+   *
+   * @param data The bytes.
+   * @param len The number of bytes.
+   * @return encoder& The encoder.
+   */
+  encoder &put_bytes(void const *data, size_t len) {
+    std::memcpy(advance(len), data, len);
+    return *this;
+  }
+
+  /**
+   * @brief Encode a string as its LEB128 length followed by its bytes.
+   *
+   * @param s The string.
+   * @return encoder& The encoder.
+   */
+  encoder &put_string(std::string_view s) {
+    return put_varint(s.size()).put_bytes(s.data(), s.size());
+  }
+};
+
+/**
+ * @brief Decodes values from a buffer encoded by an encoder. Throws if the
+ * buffer ends before a value.
+ *
+ */
+class decoder {
+  uint8_t const *pos_;
+  uint8_t const *end_;
+
+  uint8_t const *advance(size_t n) {
+    if (static_cast<size_t>(end_ - pos_) < n) [[unlikely]] {
+      throw_with("failed to decode: %zu bytes needed, %zu left", n,
+                 static_cast<size_t>(end_ - pos_));
+    }
+    return std::exchange(pos_, pos_ + n);
+  }
+
+public:
+  /**
+   * @brief Construct a new decoder object
+   *
+   * @param data The buffer to decode.
+   * @param size The size of the buffer.
+   */
+  decoder(void const *data, size_t size)
+      : pos_(static_cast<uint8_t const *>(data)), end_(pos_ + size) {}
+
+  /**
+   * @brief Construct a new decoder object
+   *
+   * @param data The buffer to decode, e.g. a frame read from a stream.
+   */
+  explicit decoder(std::string_view data)
+      : decoder(data.data(), data.size()) {}
+
+  /**
+   * @brief Get the number of bytes left to decode.
+   *
+   * @return size_t The number of bytes left.
+   */
+  size_t remaining() const { return end_ - pos_; }
+
+  /**
+   * @brief Decode a value in network byte order.
+   *
+   * @return T The value.
+   */
+  template <detail::wire_scalar T> T get() {
+    return detail::load<std::endian::big, T>(advance(sizeof(T)));
+  }
+
+  /**
+   * @brief Decode a value in little-endian byte order.
+   *
+   * @return T The value.
+   */
+  template <detail::wire_scalar T> T get_le() {
+    return detail::load<std::endian::little, T>(advance(sizeof(T)));
+  }
+
+  /**
+   * @brief Decode an array in network byte order.
+   *
+   * @param values The array to decode into.
+   * @param n The number of elements.
+   */
+  template <detail::wire_scalar T> void get_array(T *values, size_t n) {
+    detail::load_array<std::endian::big>(values, advance(n * sizeof(T)), n);
+  }
+
+  /**
+   * @brief Decode an array in little-endian byte order.
+   *
+   * @param values The array to decode into.
+   * @param n The number of elements.
+   */
+  template <detail::wire_scalar T> void get_array_le(T *values, size_t n) {
+    detail::load_array<std::endian::little>(values, advance(n * sizeof(T)),
+                                            n);
+  }
+
+  /**
+   * @brief Decode an unsigned LEB128 value.
+   *
+   * @return uint64_t The value.
+   */
+  uint64_t get_varint() {
+    uint64_t value;
+    auto next = detail::load_varint(pos_, end_, value);
+    if (next == nullptr) [[unlikely]] {
+      throw_with("failed to decode: malformed varint");
+    }
+    pos_ = next;
+    return value;
+  }
+
+  /**
+   * @brief Decode a signed zigzag LEB128 value.
+   *
+   * @return int64_t The value.
+   */
+  int64_t get_zigzag() { return detail::zigzag_decode(get_varint()); }
+
+  /**
+   * @brief Take raw bytes without copying them.
+   *
+   * @param len The number of bytes.
+   * @return std::string_view The bytes, pointing into the buffer.
+   */
+  std::string_view get_bytes(size_t len) {
+    return {reinterpret_cast<char const *>(advance(len)), len};
+  }
+
+  /**
+   * @brief Decode a string encoded by encoder::put_string without copying it.
+   *
+   * @return std::string_view The string, pointing into the buffer.
+   */
+  std::string_view get_string() {
+    auto len = get_varint();
+    if (len > remaining()) [[unlikely]] {
+      throw_with("failed to decode: string of %zu bytes, %zu left",
+                 static_cast<size_t>(len), remaining());
+    }
+    return get_bytes(len);
+  }
+};
+
+/* Frames are prefixed with their length as a 32-bit big-endian integer. */
+constexpr size_t kFrameHeaderSize = sizeof(uint32_t);
+
+/**
+ * @brief Queue a length-prefixed frame on a stream, encoding its payload in
+ * place in the stream's segments.
+ *
+ * @param stream The stream.
+ * @param max_size The maximum size of the payload.
+ * @param encode Called with an encoder over max_size bytes to encode the
+ * payload. It must not suspend.
+ */
+template <class Encode>
+void write_frame(buffered_stream &stream, size_t max_size, Encode &&encode) {
+  auto room = stream.prepare(kFrameHeaderSize + max_size);
+  encoder payload(room + kFrameHeaderSize, max_size);
+  try {
+    encode(payload);
+  } catch (...) {
+    stream.commit(0);
+    throw;
+  }
+  detail::store<std::endian::big>(room,
+                                  static_cast<uint32_t>(payload.size()));
+  stream.commit(kFrameHeaderSize + payload.size());
+}
+
+/**
+ * @brief Queue a length-prefixed frame on a stream.
+ *
+ * @param stream The stream.
+ * @param payload The payload, copied into the stream.
+ */
+static inline void write_frame(buffered_stream &stream,
+                               std::string_view payload) {
+  write_frame(stream, payload.size(), [payload](encoder &e) {
+    e.put_bytes(payload.data(), payload.size());
+  });
+}
+
+/**
+ * @brief Read a length-prefixed frame from a stream.
+ *
+ * @param stream The stream.
+ * @param max_size The maximum size of the payload accepted.
+ * @return task<std::optional<std::string_view>> The payload, valid until the
+ * next read, or std::nullopt if the peer closed the connection between frames.
+ * Throws if the frame is too large or the connection is closed in the middle of
+ * it.
+ */
+static inline task<std::optional<std::string_view>>
+read_frame(buffered_stream &stream, size_t max_size = UINT32_MAX) {
+  auto header = co_await stream.read_exact(kFrameHeaderSize);
+  std::optional<std::string_view> payload;
+  if (!header.empty()) {
+    size_t size = detail::load<std::endian::big, uint32_t>(header.data());
+    if (size > max_size) [[unlikely]] {
+      throw_with("frame of %zu bytes exceeds %zu bytes", size, max_size);
+    }
+    payload = co_await stream.read_exact(size);
+    if (payload->size() != size) [[unlikely]] {
+      throw_with("connection closed before frame of %zu bytes", size);
+    }
+  }
+  co_return payload;
+}
+
+} // namespace uringpp
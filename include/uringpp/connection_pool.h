@@ -0,0 +1,272 @@
+#pragma once
+
+#include <cerrno>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <utility>
+
+#include "uringpp/event_loop.h"
+#include "uringpp/io_queue.h"
+#include "uringpp/socket.h"
+#include "uringpp/task.h"
+#include "uringpp/timer.h"
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief How a connection pool caps and keeps connections.
+ *
+ */
+struct pool_options {
+  /**
+   * @brief The maximum number of connections leased or being established per
+   * host. Further acquisitions wait in FIFO order.
+   */
+  unsigned max_per_host = 64;
+  /** @brief The maximum number of idle connections kept per host. */
+  unsigned max_idle_per_host = 16;
+  /** @brief How long a connection may stay idle before it is closed. */
+  std::chrono::milliseconds idle_timeout{30000};
+  /** @brief Whether to connect with direct descriptors, see socket::connect. */
+  bool direct = false;
+};
+
+/**
+ * @brief Counters of a connection pool.
+ *
+ */
+struct pool_stats {
+  /** @brief The number of acquisitions served by an idle connection. */
+  uint64_t hits = 0;
+  /** @brief The number of acquisitions which had to connect. */
+  uint64_t misses = 0;
+  /** @brief The number of acquisitions which waited for the host limit. */
+  uint64_t waits = 0;
+  /** @brief The number of idle connections found closed by the peer. */
+  uint64_t stale = 0;
+  /** @brief The number of idle connections closed after the idle timeout. */
+  uint64_t reaped = 0;
+};
+
+/**
+ * @brief A pool of client connections of a loop, keyed by host and port, so
+ * that repeated calls to a backend reuse established connections instead of
+ * paying a handshake each. Idle connections are checked with a non-blocking
+ * peek before being handed out and closed by a timer on the wheel of the
+ * loop once idle for too long.
+ *
+ * A pool belongs to a single loop; it is not synchronized. It must outlive
+ * its leases.
+ */
+class connection_pool : public noncopyable {
+  struct idle_connection {
+    socket socket_;
+    std::chrono::steady_clock::time_point since_;
+  };
+
+  struct host : public noncopyable {
+    std::string hostname_;
+    std::string port_;
+    io_queue limit_;
+    /* Oldest first; connections are reused newest first. */
+    std::deque<idle_connection> idle_;
+
+    host(std::string hostname, std::string port, unsigned max_connections)
+        : hostname_(std::move(hostname)), port_(std::move(port)),
+          limit_(max_connections) {}
+  };
+
+  std::shared_ptr<event_loop> loop_;
+  pool_options options_;
+  std::unordered_map<std::string, std::unique_ptr<host>> hosts_;
+  size_t nr_idle_ = 0;
+  pool_stats stats_;
+  timer reaper_;
+  bool reaping_ = false;
+
+  host &host_of(std::string const &hostname, std::string const &port) {
+    auto key = hostname + ':' + port;
+    auto it = hosts_.find(key);
+    if (it == hosts_.end()) {
+      it = hosts_
+               .emplace(std::move(key),
+                        std::make_unique<host>(hostname, port,
+                                               options_.max_per_host))
+               .first;
+    }
+    return *it->second;
+  }
+
+  /* Whether an idle connection is still open and has nothing to read: a
+   * pending byte is either the end of the stream or data nobody asked for. */
+  task<bool> usable(socket &s) {
+    char byte;
+    if (!s.fixed()) {
+      auto n = ::recv(s.fd(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+      co_return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    int n = co_await loop_->recv(s.fd(), &byte, 1, MSG_PEEK | MSG_DONTWAIT,
+                                 IOSQE_FIXED_FILE);
+    co_return n == -EAGAIN;
+  }
+
+  void put(host &h, socket s) {
+    if (h.idle_.size() >= options_.max_idle_per_host) {
+      return;
+    }
+    h.idle_.push_back({std::move(s), std::chrono::steady_clock::now()});
+    ++nr_idle_;
+    if (!reaping_) {
+      reaper_.expires_at(h.idle_.back().since_ + options_.idle_timeout);
+      reaping_ = true;
+    }
+  }
+
+  void reap() {
+    reaping_ = false;
+    auto now = std::chrono::steady_clock::now();
+    auto next = std::chrono::steady_clock::time_point::max();
+    for (auto &[key, h] : hosts_) {
+      while (!h->idle_.empty() &&
+             h->idle_.front().since_ + options_.idle_timeout <= now) {
+        h->idle_.pop_front();
+        --nr_idle_;
+        ++stats_.reaped;
+      }
+      if (!h->idle_.empty()) {
+        next = std::min(next, h->idle_.front().since_ + options_.idle_timeout);
+      }
+    }
+    if (nr_idle_ > 0) {
+      reaper_.expires_at(next);
+      reaping_ = true;
+    }
+  }
+
+public:
+  /**
+   * @brief A connection handed out by the pool. It counts against the limit
+   * of its host until released or destroyed.
+   *
+   */
+  class lease : public noncopyable {
+    connection_pool *pool_;
+    host *host_;
+    std::optional<socket> socket_;
+    io_queue::permit permit_;
+
+  public:
+    lease(connection_pool *pool, host *h, socket s, io_queue::permit permit)
+        : pool_(pool), host_(h), socket_(std::move(s)),
+          permit_(std::move(permit)) {}
+
+    lease(lease &&other) noexcept
+        : pool_(other.pool_), host_(other.host_),
+          socket_(std::move(other.socket_)),
+          permit_(std::move(other.permit_)) {
+      other.socket_.reset();
+    }
+
+    socket &operator*() { return *socket_; }
+
+    socket *operator->() { return &*socket_; }
+
+    /**
+     * @brief Give the connection back to the pool to be reused. Only release
+     * a connection with no request or response in flight.
+     *
+     */
+    void release() {
+      if (socket_) {
+        pool_->put(*host_, std::move(*socket_));
+        socket_.reset();
+      }
+      permit_.release();
+    }
+
+    /**
+     * @brief Destroy the lease object. A connection which was not released
+     * is closed, e.g. after a failed request left it in an unknown state.
+     *
+     */
+    ~lease() = default;
+  };
+
+  /**
+   * @brief Construct a new connection pool object
+   *
+   * @param loop The loop the connections are used on.
+   * @param options How connections are capped and kept.
+   */
+  explicit connection_pool(std::shared_ptr<event_loop> loop,
+                           pool_options options = {})
+      : loop_(loop), options_(options), reaper_(loop, [this]() { reap(); }) {}
+
+  /**
+   * @brief Lease a connection to a host, reusing an idle one if possible.
+   *
+   * @param hostname The hostname of the remote host.
+   * @param port The port of the remote host.
+   * @return task<lease> The lease. Waits while the host is at its limit, and
+   * throws if a new connection fails.
+   */
+  task<lease> acquire(std::string const &hostname, std::string const &port) {
+    auto &h = host_of(hostname, port);
+    if (h.limit_.waiting() > 0 || h.limit_.in_flight() >= h.limit_.depth()) {
+      ++stats_.waits;
+    }
+    auto permit = co_await h.limit_.acquire();
+    while (!h.idle_.empty()) {
+      auto s = std::move(h.idle_.back().socket_);
+      h.idle_.pop_back();
+      --nr_idle_;
+      bool ok = co_await usable(s);
+      if (ok) {
+        ++stats_.hits;
+        co_return lease(this, &h, std::move(s), std::move(permit));
+      }
+      ++stats_.stale;
+    }
+    ++stats_.misses;
+    auto s = co_await socket::connect(loop_, hostname, port, options_.direct);
+    co_return lease(this, &h, std::move(s), std::move(permit));
+  }
+
+  /**
+   * @brief Get the number of idle connections, over all hosts.
+   *
+   * @return size_t The number of idle connections.
+   */
+  size_t idle() const { return nr_idle_; }
+
+  /**
+   * @brief Get the counters of the pool.
+   *
+   * @return pool_stats const& The counters.
+   */
+  pool_stats const &stats() const { return stats_; }
+
+  /**
+   * @brief Close all idle connections.
+   *
+   */
+  void clear() {
+    for (auto &[key, h] : hosts_) {
+      h->idle_.clear();
+    }
+    nr_idle_ = 0;
+    reaper_.cancel();
+    reaping_ = false;
+  }
+};
+
+} // namespace uringpp
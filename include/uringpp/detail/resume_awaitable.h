@@ -0,0 +1,21 @@
+#pragma once
+
+#include <coroutine>
+
+namespace uringpp {
+namespace detail {
+
+/**
+ * @brief Suspends the awaiting coroutine and stores its handle, for whoever
+ * completes the awaited event to resume it.
+ *
+ */
+struct resume_awaitable {
+  std::coroutine_handle<> &h_;
+  bool await_ready() noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) noexcept { h_ = h; }
+  void await_resume() noexcept {}
+};
+
+} // namespace detail
+} // namespace uringpp
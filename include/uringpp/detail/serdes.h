@@ -1,7 +1,10 @@
 #pragma once
 
 #include <algorithm>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <endian.h>
 #include <netinet/in.h>
 #include <type_traits>
@@ -25,7 +28,7 @@ template <class T, class It,
           class U = typename std::enable_if<std::is_integral<T>::value>::type>
 void serialize(T const &value, It &it) {
   T nvalue = hton(value);
-  std::copy_n(reinterpret_cast<uint8_t *>(&nvalue), sizeof(T), it);
+  it = std::copy_n(reinterpret_cast<uint8_t *>(&nvalue), sizeof(T), it);
 }
 
 template <class T, class It,
@@ -36,5 +39,184 @@ void deserialize(It &it, T &value) {
   value = ntoh(value);
 }
 
+/**
+ * @brief Arithmetic types with a fixed-size wire representation.
+ *
+ */
+template <class T>
+concept wire_scalar =
+    std::is_arithmetic_v<T> && !std::is_same_v<T, bool> &&
+    (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+
+template <size_t Size> struct wire_bits;
+template <> struct wire_bits<1> { using type = uint8_t; };
+template <> struct wire_bits<2> { using type = uint16_t; };
+template <> struct wire_bits<4> { using type = uint32_t; };
+template <> struct wire_bits<8> { using type = uint64_t; };
+
+template <class T> using wire_bits_t = typename wire_bits<sizeof(T)>::type;
+
+template <class T> constexpr T byteswap(T value) {
+  if constexpr (sizeof(T) == 1) {
+    return value;
+  } else if constexpr (sizeof(T) == 2) {
+    return __builtin_bswap16(value);
+  } else if constexpr (sizeof(T) == 4) {
+    return __builtin_bswap32(value);
+  } else {
+    return __builtin_bswap64(value);
+  }
+}
+
+/**
+ * @brief Convert between the native byte order and Order, which is its own
+ * inverse.
+ *
+ */
+template <std::endian Order, wire_scalar T>
+static inline wire_bits_t<T> to_order(T value) {
+  auto bits = std::bit_cast<wire_bits_t<T>>(value);
+  if constexpr (Order != std::endian::native) {
+    bits = byteswap(bits);
+  }
+  return bits;
+}
+
+template <std::endian Order, wire_scalar T>
+static inline void store(void *out, T value) {
+  auto bits = to_order<Order>(value);
+  std::memcpy(out, &bits, sizeof(bits));
+}
+
+template <std::endian Order, wire_scalar T>
+static inline T load(void const *in) {
+  wire_bits_t<T> bits;
+  std::memcpy(&bits, in, sizeof(bits));
+  if constexpr (Order != std::endian::native) {
+    bits = byteswap(bits);
+  }
+  return std::bit_cast<T>(bits);
+}
+
+/**
+ * @brief Copy n elements of Size bytes, reversing the bytes of each one. With
+ * SSSE3 or NEON, 16 bytes are swapped at a time by a single byte shuffle. It
+ * is compiled into the library, which picks SSSE3 at run time on x86-64.
+ *
+ */
+template <size_t Size>
+void copy_swapped(uint8_t *out, uint8_t const *in, size_t n);
+
+extern template void copy_swapped<2>(uint8_t *, uint8_t const *, size_t);
+extern template void copy_swapped<4>(uint8_t *, uint8_t const *, size_t);
+extern template void copy_swapped<8>(uint8_t *, uint8_t const *, size_t);
+
+/**
+ * @brief Store an array in the given byte order.
+ *
+ * @param out The output, of n * sizeof(T) bytes, with no alignment
+ * requirement.
+ * @param in The array.
+ * @param n The number of elements.
+ */
+template <std::endian Order, wire_scalar T>
+static inline void store_array(void *out, T const *in, size_t n) {
+  if constexpr (Order == std::endian::native || sizeof(T) == 1) {
+    std::memcpy(out, in, n * sizeof(T));
+  } else {
+    copy_swapped<sizeof(T)>(static_cast<uint8_t *>(out),
+                            reinterpret_cast<uint8_t const *>(in), n);
+  }
+}
+
+/**
+ * @brief Load an array stored in the given byte order.
+ *
+ * @param out The array.
+ * @param in The input, of n * sizeof(T) bytes, with no alignment requirement.
+ * @param n The number of elements.
+ */
+template <std::endian Order, wire_scalar T>
+static inline void load_array(T *out, void const *in, size_t n) {
+  if constexpr (Order == std::endian::native || sizeof(T) == 1) {
+    std::memcpy(out, in, n * sizeof(T));
+  } else {
+    copy_swapped<sizeof(T)>(reinterpret_cast<uint8_t *>(out),
+                            static_cast<uint8_t const *>(in), n);
+  }
+}
+
+constexpr size_t kMaxVarintSize = 10;
+
+/**
+ * @brief Get the size of the LEB128 encoding of a value.
+ *
+ * @param value The value.
+ * @return size_t The size, between 1 and kMaxVarintSize.
+ */
+static inline size_t varint_size(uint64_t value) {
+  /* Every 7 significant bits take a byte: (bits * 9 + 64) / 64 == ceil(/7). */
+  int bits = 64 - std::countl_zero(value | 1);
+  return (bits * 9 + 64) / 64;
+}
+
+/**
+ * @brief Encode a value as LEB128.
+ *
+ * @param out The output, with room for kMaxVarintSize bytes or
+ * varint_size(value) bytes.
+ * @param value The value.
+ * @return uint8_t* The end of the encoding.
+ */
+static inline uint8_t *store_varint(uint8_t *out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  *out++ = static_cast<uint8_t>(value);
+  return out;
+}
+
+/**
+ * @brief Decode a LEB128 value.
+ *
+ * @param in The input.
+ * @param end The end of the input.
+ * @param value The decoded value.
+ * @return uint8_t const* The end of the encoding, or nullptr if the input is
+ * truncated or the encoding does not fit in 64 bits.
+ */
+static inline uint8_t const *load_varint(uint8_t const *in,
+                                         uint8_t const *end,
+                                         uint64_t &value) {
+  /* Most values written by a protocol fit in a byte. */
+  if (in != end && *in < 0x80) [[likely]] {
+    value = *in;
+    return in + 1;
+  }
+  uint64_t result = 0;
+  for (unsigned shift = 0; in != end && shift < 64; shift += 7) {
+    uint8_t byte = *in++;
+    if (shift == 63 && byte > 1) [[unlikely]] {
+      return nullptr;
+    }
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      value = result;
+      return in;
+    }
+  }
+  return nullptr;
+}
+
+static inline uint64_t zigzag_encode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
 } // namespace detail
-} // namespace uringpp
\ No newline at end of file
+} // namespace uringpp
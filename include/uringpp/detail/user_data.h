@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+namespace uringpp {
+namespace detail {
+
+/**
+ * @brief The kind of object a CQE's user_data points to. The tag lives in the
+ * low bits of the pointer, which are always zero for the objects we submit.
+ *
+ */
+enum class user_data_tag : uint64_t {
+  awaitable = 0,
+  multishot = 1,
+  message = 2,
+  message_source = 3,
+  wakeup = 4,
+  file_slot = 5,
+  zero_copy = 6,
+  timer = 7,
+};
+
+constexpr uint64_t kUserDataTagMask = 0x7;
+
+/**
+ * @brief The user_data of fire-and-forget requests, such as close_detach or
+ * the cancellations and timeout updates the loop submits. Their CQEs are
+ * dropped when the CQ is harvested, without being dispatched.
+ *
+ */
+constexpr uint64_t kDetachedUserData = 0;
+
+template <class T>
+static inline uint64_t make_user_data(T *ptr, user_data_tag tag) {
+  return reinterpret_cast<uint64_t>(ptr) | static_cast<uint64_t>(tag);
+}
+
+static inline user_data_tag get_user_data_tag(uint64_t data) {
+  return static_cast<user_data_tag>(data & kUserDataTagMask);
+}
+
+template <class T> static inline T *get_user_data_ptr(uint64_t data) {
+  return reinterpret_cast<T *>(data & ~kUserDataTagMask);
+}
+
+static inline uint64_t make_user_data(unsigned value, user_data_tag tag) {
+  return (static_cast<uint64_t>(value) << 3) | static_cast<uint64_t>(tag);
+}
+
+static inline unsigned get_user_data_value(uint64_t data) {
+  return static_cast<unsigned>(data >> 3);
+}
+
+} // namespace detail
+} // namespace uringpp
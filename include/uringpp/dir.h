@@ -1,10 +1,18 @@
 #pragma once
 
+#include <cstddef>
+#include <cstring>
+#include <dirent.h>
 #include <fcntl.h>
 #include <memory>
+#include <string_view>
+#include <unistd.h>
 
 #include "uringpp/awaitable.h"
+#include "uringpp/error.h"
 #include "uringpp/event_loop.h"
+#include "uringpp/offload.h"
+#include "uringpp/task.h"
 
 #include "uringpp/detail/noncopyable.h"
 
@@ -27,6 +35,13 @@ public:
    */
   int fd() const { return fd_; }
 
+  /**
+   * @brief Get the event loop of the directory.
+   *
+   * @return std::shared_ptr<event_loop> const& The event loop.
+   */
+  std::shared_ptr<event_loop> const &loop() const { return loop_; }
+
   /**
    * @brief Construct a new dir object from a file descriptor.
    *
@@ -228,4 +243,101 @@ public:
   }
 };
 
-} // namespace uringpp
\ No newline at end of file
+/**
+ * @brief An entry of a directory listing.
+ *
+ */
+struct dir_entry {
+  /* The name, only valid until the next batch is read. */
+  std::string_view name;
+  ino_t ino;
+  /* The DT_* type, or DT_UNKNOWN if the file system does not report it. */
+  unsigned char type;
+};
+
+/**
+ * @brief Lists a directory in batches read with getdents64, which has no
+ * io_uring op. Each batch is read on an offload pool so that a cold
+ * directory does not block the loop, and its entries are then iterated
+ * without suspending.
+ *
+ */
+class dir_reader : public noncopyable {
+  std::shared_ptr<event_loop> loop_;
+  int fd_;
+  offload_pool *pool_;
+  std::unique_ptr<char[]> buf_;
+  size_t size_;
+  size_t pos_ = 0;
+  size_t end_ = 0;
+  bool eof_ = false;
+
+public:
+  static constexpr size_t kDefaultBufferSize = 64 * 1024;
+
+  /**
+   * @brief Construct a new dir reader object listing from the start of the
+   * directory.
+   *
+   * @param d The directory. It must outlive the reader.
+   * @param pool The pool to read batches on, or nullptr to read them on the
+   * loop thread.
+   * @param buffer_size The size of a batch in bytes.
+   */
+  explicit dir_reader(dir const &d,
+                      offload_pool *pool = &offload_pool::shared(),
+                      size_t buffer_size = kDefaultBufferSize)
+      : loop_(d.loop()), fd_(d.fd()), pool_(pool),
+        buf_(new char[buffer_size]), size_(buffer_size) {
+    check_errno(::lseek(fd_, 0, SEEK_SET), "failed to rewind dir");
+  }
+
+  /**
+   * @brief Read the next batch of entries, invalidating the previous one.
+   *
+   * @return task<bool> False at the end of the directory. Errors are thrown.
+   */
+  task<bool> fill() {
+    if (eof_) {
+      co_return false;
+    }
+    auto read = [fd = fd_, buf = buf_.get(), size = size_]() {
+      auto rc = ::getdents64(fd, buf, size);
+      return rc < 0 ? -errno : rc;
+    };
+    ssize_t rc;
+    if (pool_ != nullptr) {
+      rc = co_await pool_->run(*loop_, read);
+    } else {
+      rc = read();
+    }
+    check_nerrno(rc, "failed to read dir");
+    pos_ = 0;
+    end_ = rc;
+    eof_ = rc == 0;
+    co_return !eof_;
+  }
+
+  /**
+   * @brief Take the next entry of the current batch, skipping "." and "..".
+   *
+   * @param entry The entry.
+   * @return bool False once the batch is exhausted.
+   */
+  bool next(dir_entry &entry) {
+    while (pos_ < end_) {
+      auto d = reinterpret_cast<struct dirent64 const *>(buf_.get() + pos_);
+      pos_ += d->d_reclen;
+      if (d->d_name[0] == '.' &&
+          (d->d_name[1] == '\0' ||
+           (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+        continue;
+      }
+      entry = {d->d_name, d->d_ino, d->d_type};
+      return true;
+    }
+    return false;
+  }
+};
+
+} // namespace uringpp
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <dirent.h>
+#include <exception>
+#include <fcntl.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <utility>
+
+#include "uringpp/dir.h"
+#include "uringpp/error.h"
+#include "uringpp/event_loop.h"
+#include "uringpp/io_queue.h"
+#include "uringpp/offload.h"
+#include "uringpp/task.h"
+
+#include "uringpp/detail/noncopyable.h"
+#include "uringpp/detail/resume_awaitable.h"
+
+namespace uringpp {
+
+/**
+ * @brief How a directory tree is walked.
+ *
+ */
+struct walk_options {
+  /**
+   * @brief The maximum number of statx and openat ops in flight.
+   */
+  unsigned depth = 64;
+  /**
+   * @brief The maximum number of directories listed at once, which bounds
+   * the descriptors the walk holds open.
+   */
+  unsigned max_open_dirs = 32;
+  /**
+   * @brief The STATX_* fields to fetch for every entry, or 0 to only report
+   * the names and types of entries. Entries whose type the file system does
+   * not report are always stat'ed.
+   */
+  unsigned statx_mask = 0;
+  /**
+   * @brief The pool to read directories on, or nullptr to read them on the
+   * loop thread.
+   */
+  offload_pool *pool = &offload_pool::shared();
+};
+
+/**
+ * @brief An entry found by a walk.
+ *
+ */
+struct walk_entry {
+  /* The path relative to the root of the walk. */
+  std::string_view path;
+  /* The last component of the path. */
+  std::string_view name;
+  /* The DT_* type. */
+  unsigned char type;
+  /* The fields requested by walk_options::statx_mask, or nullptr if none. */
+  struct statx const *stx;
+};
+
+namespace detail {
+
+template <class OnEntry> class dir_walker : public noncopyable {
+  struct listing {
+    size_t stats_ = 0;
+    std::coroutine_handle<> drained_;
+  };
+
+  std::shared_ptr<event_loop> loop_;
+  dir const &root_;
+  OnEntry &on_entry_;
+  walk_options const &options_;
+  io_queue ops_;
+  io_queue dirs_;
+  size_t dirs_pending_ = 0;
+  std::coroutine_handle<> done_;
+  std::exception_ptr error_;
+
+  void fail(std::exception_ptr error) {
+    if (!error_) {
+      error_ = error;
+    }
+  }
+
+  void visit(std::string path, size_t name_offset, unsigned char type,
+             struct statx const *stx) {
+    std::string_view p = path;
+    bool descend = on_entry_(walk_entry{p, p.substr(name_offset), type, stx});
+    if (descend && type == DT_DIR && !error_) {
+      list(std::move(path));
+    }
+  }
+
+  task<void> stat_entry(int dfd, std::string path, size_t name_offset,
+                        unsigned char type, io_queue::permit op,
+                        listing &parent) {
+    try {
+      struct statx stx;
+      int rc = co_await loop_->statx(dfd, path.c_str() + name_offset,
+                                     AT_SYMLINK_NOFOLLOW,
+                                     options_.statx_mask | STATX_TYPE, &stx);
+      op.release();
+      /* Entries removed while the walk runs are skipped. */
+      if (rc != -ENOENT) {
+        check_nerrno(rc, "failed to stat dir entry");
+        if (type == DT_UNKNOWN) {
+          type = IFTODT(stx.stx_mode);
+        }
+        visit(std::move(path), name_offset, type,
+              options_.statx_mask ? &stx : nullptr);
+      }
+    } catch (...) {
+      fail(std::current_exception());
+    }
+    if (--parent.stats_ == 0 && parent.drained_) {
+      std::exchange(parent.drained_, nullptr).resume();
+    }
+  }
+
+  task<void> list_dir(std::string path) {
+    try {
+      auto slot = co_await dirs_.acquire();
+      std::optional<dir> opened;
+      if (!path.empty() && !error_) {
+        auto op = co_await ops_.acquire();
+        int fd = co_await loop_->openat(root_.fd(), path.c_str(),
+                                        O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+        if (fd != -ENOENT) {
+          check_nerrno(fd, "failed to open dir");
+          opened.emplace(loop_, fd);
+        }
+      }
+      if (path.empty() || opened) {
+        co_await read_dir(opened ? *opened : root_, path);
+      }
+    } catch (...) {
+      fail(std::current_exception());
+    }
+    if (--dirs_pending_ == 0 && done_) {
+      std::exchange(done_, nullptr).resume();
+    }
+  }
+
+  task<void> read_dir(dir const &d, std::string const &path) {
+    listing state;
+    try {
+      dir_reader reader(d, options_.pool);
+      dir_entry entry;
+      while (!error_) {
+        bool more = co_await reader.fill();
+        if (!more) {
+          break;
+        }
+        while (!error_ && reader.next(entry)) {
+          size_t name_offset = path.empty() ? 0 : path.size() + 1;
+          std::string child;
+          child.reserve(name_offset + entry.name.size());
+          if (!path.empty()) {
+            child.append(path).push_back('/');
+          }
+          child.append(entry.name);
+          if (options_.statx_mask == 0 && entry.type != DT_UNKNOWN) {
+            visit(std::move(child), name_offset, entry.type, nullptr);
+            continue;
+          }
+          auto op = co_await ops_.acquire();
+          ++state.stats_;
+          stat_entry(d.fd(), std::move(child), name_offset, entry.type,
+                     std::move(op), state);
+        }
+      }
+    } catch (...) {
+      fail(std::current_exception());
+    }
+    if (state.stats_ > 0) {
+      co_await detail::resume_awaitable{state.drained_};
+    }
+  }
+
+  void list(std::string path) {
+    ++dirs_pending_;
+    list_dir(std::move(path));
+  }
+
+public:
+  dir_walker(dir const &root, OnEntry &on_entry, walk_options const &options)
+      : loop_(root.loop()), root_(root), on_entry_(on_entry),
+        options_(options), ops_(options.depth), dirs_(options.max_open_dirs) {}
+
+  task<void> run() {
+    list({});
+    if (dirs_pending_ > 0) {
+      co_await detail::resume_awaitable{done_};
+    }
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+};
+
+} // namespace detail
+
+/**
+ * @brief Walk a directory tree. Directories are listed concurrently with
+ * dir_reader, and the statx and openat ops their entries need are fanned out
+ * on the ring, bounded by the options. Entries are reported in no particular
+ * order, and entries removed during the walk are skipped. Symbolic links are
+ * reported but not followed.
+ *
+ * @param root The root of the walk. It must outlive the walk, and its listing
+ * position is reset.
+ * @param on_entry Called as on_entry(walk_entry const &) for every entry below
+ * the root, returning whether to descend into it if it is a directory. It must
+ * not suspend; the entry is only valid during the call.
+ * @param options How to walk the tree.
+ * @return task<void> Completes once every entry has been reported. The first
+ * error stops the walk and is thrown once no op is in flight.
+ */
+template <class OnEntry>
+task<void> walk(dir const &root, OnEntry on_entry, walk_options options = {}) {
+  detail::dir_walker<OnEntry> walker(root, on_entry, options);
+  co_await walker.run();
+}
+
+} // namespace uringpp
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <new>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "uringpp/buffer_pool.h"
+#include "uringpp/error.h"
+#include "uringpp/event_loop.h"
+#include "uringpp/file.h"
+#include "uringpp/io_queue.h"
+#include "uringpp/task.h"
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/* The alignment assumed when the kernel does not report the direct I/O
+ * alignment of a file. It satisfies every common logical block size. */
+constexpr size_t kDefaultDirectAlignment = 4096;
+
+/**
+ * @brief A heap buffer with its start and size aligned for direct I/O.
+ *
+ */
+class aligned_buffer : public noncopyable {
+  struct deleter {
+    void operator()(uint8_t *p) const { std::free(p); }
+  };
+
+  std::unique_ptr<uint8_t, deleter> data_;
+  size_t size_ = 0;
+
+public:
+  aligned_buffer() = default;
+
+  /**
+   * @brief Allocate a new aligned buffer. Throws std::bad_alloc on failure.
+   *
+   * @param size The minimum size, rounded up to the alignment.
+   * @param alignment The alignment, a power of 2.
+   */
+  explicit aligned_buffer(size_t size,
+                          size_t alignment = kDefaultDirectAlignment)
+      : size_((size + alignment - 1) & ~(alignment - 1)) {
+    data_.reset(static_cast<uint8_t *>(
+        std::aligned_alloc(alignment, std::max(size_, alignment))));
+    if (!data_) [[unlikely]] {
+      throw std::bad_alloc();
+    }
+  }
+
+  aligned_buffer(aligned_buffer &&other) noexcept
+      : data_(std::move(other.data_)), size_(std::exchange(other.size_, 0)) {}
+
+  aligned_buffer &operator=(aligned_buffer &&other) noexcept {
+    data_ = std::move(other.data_);
+    size_ = std::exchange(other.size_, 0);
+    return *this;
+  }
+
+  /**
+   * @brief Get the start of the buffer.
+   *
+   * @return uint8_t* The start of the buffer.
+   */
+  uint8_t *data() const { return data_.get(); }
+
+  /**
+   * @brief Get the size of the buffer.
+   *
+   * @return size_t The size of the buffer.
+   */
+  size_t size() const { return size_; }
+};
+
+/**
+ * @brief A file opened with O_DIRECT. Transfers bypass the page cache and
+ * must use buffers, lengths and offsets aligned as the kernel reports for the
+ * file, which is checked before submitting. Operations may go through an
+ * io_queue to cap the number in flight on the device.
+ *
+ */
+class direct_file : public noncopyable {
+  file file_;
+  size_t memory_alignment_;
+  size_t offset_alignment_;
+  io_queue *queue_;
+  bool polled_;
+
+  static constexpr size_t kStatxDioMemAlignOffset = 0x98;
+  static constexpr size_t kStatxDioOffsetAlignOffset = 0x9c;
+
+  direct_file(file f, size_t memory_alignment, size_t offset_alignment,
+              io_queue *queue, bool polled)
+      : file_(std::move(f)), memory_alignment_(memory_alignment),
+        offset_alignment_(offset_alignment), queue_(queue), polled_(polled) {}
+
+  static void read_alignment(struct statx const &stx, size_t &memory,
+                             size_t &offset) {
+    /* glibc's struct statx predates the direct I/O alignment fields, which
+     * the kernel writes into its padding. */
+    static_assert(sizeof(struct statx) >= kStatxDioOffsetAlignOffset + 4);
+    if (!(stx.stx_mask & STATX_DIOALIGN)) {
+      return;
+    }
+    uint32_t align[2];
+    std::memcpy(align,
+                reinterpret_cast<char const *>(&stx) + kStatxDioMemAlignOffset,
+                sizeof(align));
+    if (align[0] != 0 && align[1] != 0) {
+      memory = align[0];
+      offset = align[1];
+    }
+  }
+
+  void check_aligned(void const *buf, size_t len, off_t offset) const {
+    if ((reinterpret_cast<uintptr_t>(buf) & (memory_alignment_ - 1)) ||
+        ((len | static_cast<size_t>(offset)) & (offset_alignment_ - 1)))
+        [[unlikely]] {
+      throw_with("misaligned direct I/O of %zu bytes at offset %jd to %p, "
+                 "alignment is %zu in memory and %zu in the file",
+                 len, static_cast<intmax_t>(offset), buf, memory_alignment_,
+                 offset_alignment_);
+    }
+  }
+
+  template <class Operation> task<int> submit(Operation operation) {
+    if (queue_ == nullptr) {
+      co_return co_await operation();
+    }
+    auto slot = co_await queue_->acquire();
+    co_return co_await operation();
+  }
+
+public:
+  /**
+   * @brief Open a file for direct I/O. The alignment is queried with
+   * STATX_DIOALIGN and defaults to kDefaultDirectAlignment on kernels and
+   * file systems which do not report it. On a loop created with
+   * loop_options::iopoll the file is opened and closed synchronously.
+   *
+   * @param loop The event loop.
+   * @param path The path to the file.
+   * @param flags The flags to use when opening the file, O_DIRECT is added.
+   * @param mode The mode to use when opening the file.
+   * @param queue The queue to submit transfers through, or nullptr. It must
+   * outlive the file.
+   * @return task<direct_file> The file object.
+   */
+  static task<direct_file> open(std::shared_ptr<event_loop> loop,
+                                char const *path, int flags, mode_t mode,
+                                io_queue *queue = nullptr) {
+    struct statx stx = {};
+    size_t memory_alignment = kDefaultDirectAlignment;
+    size_t offset_alignment = kDefaultDirectAlignment;
+    if (loop->setup_flags() & IORING_SETUP_IOPOLL) {
+      /* Only reads and writes complete on a polled ring. */
+      int fd = ::open(path, flags | O_DIRECT | O_CLOEXEC, mode);
+      check_errno(fd, "failed to open file");
+      if (::statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0) {
+        read_alignment(stx, memory_alignment, offset_alignment);
+      }
+      co_return direct_file(file(loop, fd), memory_alignment,
+                            offset_alignment, queue, true);
+    }
+    auto f = co_await file::open(loop, path, flags | O_DIRECT, mode);
+    /* statx takes no direct descriptor: those are queried by path. */
+    int rc;
+    if (f.fixed()) {
+      rc = co_await loop->statx(AT_FDCWD, path, 0, STATX_DIOALIGN, &stx);
+    } else {
+      rc = co_await loop->statx(f.fd(), "", AT_EMPTY_PATH, STATX_DIOALIGN,
+                                &stx);
+    }
+    if (rc == 0) {
+      read_alignment(stx, memory_alignment, offset_alignment);
+    }
+    co_return direct_file(std::move(f), memory_alignment, offset_alignment,
+                          queue, false);
+  }
+
+  direct_file(direct_file &&other) = default;
+
+  /**
+   * @brief Get the underlying file.
+   *
+   * @return file& The file.
+   */
+  file &lower() { return file_; }
+
+  /**
+   * @brief Get the alignment required of buffers.
+   *
+   * @return size_t The memory alignment.
+   */
+  size_t memory_alignment() const { return memory_alignment_; }
+
+  /**
+   * @brief Get the alignment required of offsets and lengths.
+   *
+   * @return size_t The offset alignment.
+   */
+  size_t offset_alignment() const { return offset_alignment_; }
+
+  /**
+   * @brief Allocate a buffer suitable for transfers with this file.
+   *
+   * @param size The minimum size of the buffer.
+   * @return aligned_buffer The buffer.
+   */
+  aligned_buffer allocate(size_t size) const {
+    return aligned_buffer(std::max(size, offset_alignment_),
+                          std::max(memory_alignment_, offset_alignment_));
+  }
+
+  /**
+   * @brief Read into an aligned buffer.
+   *
+   * @param buf The buffer to read into.
+   * @param count The number of bytes to read.
+   * @param offset The offset to start reading from.
+   * @return task<int> The number of bytes read or a negative errno, like
+   * file::read. Misaligned arguments are thrown.
+   */
+  task<int> read(void *buf, size_t count, off_t offset) {
+    check_aligned(buf, count, offset);
+    return submit([this, buf, count, offset]() {
+      return file_.read(buf, count, offset);
+    });
+  }
+
+  /**
+   * @brief Write from an aligned buffer.
+   *
+   * @param buf The buffer to write from.
+   * @param count The number of bytes to write.
+   * @param offset The offset to start writing at.
+   * @return task<int> The number of bytes written or a negative errno, like
+   * file::write. Misaligned arguments are thrown.
+   */
+  task<int> write(void const *buf, size_t count, off_t offset) {
+    check_aligned(buf, count, offset);
+    return submit([this, buf, count, offset]() {
+      return file_.write(buf, count, offset);
+    });
+  }
+
+  /**
+   * @brief Fill a leased fixed buffer, whose size must be a multiple of the
+   * alignment.
+   *
+   * @param buf The leased buffer to read into.
+   * @param offset The offset to start reading from.
+   * @return task<int> The number of bytes read or a negative errno.
+   */
+  task<int> read_fixed(fixed_buffer &buf, off_t offset) {
+    check_aligned(buf.data(), buf.size(), offset);
+    return submit(
+        [this, &buf, offset]() { return file_.read_fixed(buf, offset); });
+  }
+
+  /**
+   * @brief Write from a leased fixed buffer.
+   *
+   * @param buf The leased buffer to write from.
+   * @param count The number of bytes to write.
+   * @param offset The offset to start writing at.
+   * @return task<int> The number of bytes written or a negative errno.
+   */
+  task<int> write_fixed(fixed_buffer const &buf, size_t count, off_t offset) {
+    check_aligned(buf.data(), count, offset);
+    return submit([this, &buf, count, offset]() {
+      return file_.write_fixed(buf, count, offset);
+    });
+  }
+
+  /**
+   * @brief Read any range of the file into any buffer, by reading the
+   * enclosing aligned range into a bounce buffer and copying the requested
+   * part.
+   *
+   * @param buf The buffer to read into.
+   * @param count The number of bytes to read.
+   * @param offset The offset to start reading from.
+   * @return task<size_t> The number of bytes read, fewer than count at the end
+   * of the file. Errors are thrown.
+   */
+  task<size_t> read_unaligned(void *buf, size_t count, off_t offset) {
+    auto mask = static_cast<off_t>(offset_alignment_ - 1);
+    off_t start = offset & ~mask;
+    off_t end = (offset + static_cast<off_t>(count) + mask) & ~mask;
+    auto bounce = allocate(end - start);
+    size_t head = offset - start;
+    size_t done = 0;
+    while (start + static_cast<off_t>(done) < end) {
+      int rc = co_await read(bounce.data() + done, end - start - done,
+                             start + done);
+      check_nerrno(rc, "failed to read direct file");
+      /* Direct reads only come up short at the end of the file. */
+      if (rc == 0 || (static_cast<size_t>(rc) & mask)) {
+        done += rc;
+        break;
+      }
+      done += rc;
+    }
+    size_t n = done > head ? std::min(count, done - head) : 0;
+    std::memcpy(buf, bounce.data() + head, n);
+    co_return n;
+  }
+
+  /**
+   * @brief Close the file.
+   *
+   * @return task<void>
+   */
+  task<void> close() {
+    if (polled_) {
+      if (file_.fd() >= 0) {
+        ::close(file_.release());
+      }
+      co_return;
+    }
+    co_await file_.close();
+  }
+
+  /**
+   * @brief Destroy the direct file object. If the file is still open, it will
+   * be closed.
+   *
+   */
+  ~direct_file() {
+    if (polled_ && file_.fd() >= 0) {
+      ::close(file_.release());
+    }
+  }
+};
+
+} // namespace uringpp
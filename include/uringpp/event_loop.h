@@ -1,22 +1,68 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <bitset>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <liburing.h>
+#include <iterator>
 #include <memory>
 #include <new>
+#include <stdio.h>
 #include <stdexcept>
-#include <unordered_set>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
 
 #include "uringpp/awaitable.h"
+#include "uringpp/buffer_pool.h"
+#include "uringpp/buffer_ring.h"
 #include "uringpp/error.h"
+#include "uringpp/file_table.h"
+#include "uringpp/metrics.h"
+#include "uringpp/multishot.h"
+#include "uringpp/sqe_chain.h"
 #include "uringpp/task.h"
+#include "uringpp/timer_wheel.h"
+#include "uringpp/zero_copy.h"
 
 #include "uringpp/detail/noncopyable.h"
+#include "uringpp/detail/user_data.h"
+
+#ifndef URINGPP_BASELINE_OP
+/* Ops below this one are assumed to be supported and are not checked per
+ * call. A loop needs IORING_REGISTER_PROBE, added in 5.6 along with every op
+ * up to IORING_OP_EPOLL_CTL, and records on creation whether the assumption
+ * holds; if not, these ops are checked per call too. */
+#define URINGPP_BASELINE_OP IORING_OP_SPLICE
+#endif
 
 namespace uringpp {
 
+namespace detail {
+
+template <class Rep, class Period>
+static inline __kernel_timespec
+to_timespec(std::chrono::duration<Rep, Period> duration) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
+  if (ns.count() < 0) {
+    ns = ns.zero();
+  }
+  return {.tv_sec = ns.count() / 1000000000,
+          .tv_nsec = ns.count() % 1000000000};
+}
+
+} // namespace detail
+
 enum class feature {
   SINGLE_MMAP,
   NODROP,
@@ -31,12 +77,164 @@ enum class feature {
   RSRC_TAGS,
 };
 
+static_assert(static_cast<unsigned>(feature::RSRC_TAGS) < 32,
+              "features are stored in a 32-bit mask");
+
+/**
+ * @brief Options for creating an event loop.
+ *
+ */
+struct loop_options {
+  static constexpr unsigned kDefaultFixedFiles = 1024;
+
+  /** @brief The number of SQ entries. */
+  unsigned entries = 128;
+  /** @brief Extra io_uring setup flags, always requested. */
+  uint32_t flags = 0;
+  /** @brief The ring whose kernel async worker pool to share, or -1. */
+  int wq_fd = -1;
+  /**
+   * @brief Let a kernel thread poll the SQ (IORING_SETUP_SQPOLL), so
+   * submitting needs no syscall while the thread is awake.
+   */
+  bool sqpoll = false;
+  /** @brief The CPU to pin the SQ polling thread to, or -1. */
+  int sq_thread_cpu = -1;
+  /**
+   * @brief The idle time in milliseconds before the SQ polling thread sleeps,
+   * or -1 for the kernel default.
+   */
+  int sq_thread_idle = -1;
+  /**
+   * @brief The size of the sparse file table registered on creation, or 0 for
+   * none. With SQPOLL on kernels without IORING_FEAT_SQPOLL_NONFIXED a table
+   * of kDefaultFixedFiles is registered if this is 0.
+   */
+  unsigned fixed_files = 0;
+  /**
+   * @brief Submit in the middle of a completion pass once this many SQEs are
+   * queued. With 0 SQEs are only submitted at the end of a pass, or when the
+   * SQ is full.
+   */
+  unsigned submit_batch = 0;
+  /**
+   * @brief Zero-copy sends of fewer bytes fall back to copying, which is
+   * cheaper for small messages.
+   */
+  size_t zero_copy_threshold = 16384;
+  /**
+   * @brief Request IORING_SETUP_SUBMIT_ALL and IORING_SETUP_COOP_TASKRUN if
+   * the kernel supports them.
+   */
+  bool coop_taskrun = true;
+  /**
+   * @brief Request IORING_SETUP_SINGLE_ISSUER if the kernel supports it. Only
+   * the creating thread may then submit to the loop.
+   */
+  bool single_issuer = false;
+  /**
+   * @brief Request IORING_SETUP_DEFER_TASKRUN if the kernel supports it.
+   * Completions are then only posted while the loop polls. Implies
+   * single_issuer.
+   */
+  bool defer_taskrun = false;
+  /**
+   * @brief Busy-poll the devices for completions (IORING_SETUP_IOPOLL)
+   * instead of waiting for interrupts. Only O_DIRECT reads and writes to
+   * devices supporting polling may be submitted, so this is meant for a loop
+   * dedicated to storage. Such a loop never sleeps and has no timers.
+   */
+  bool iopoll = false;
+  /**
+   * @brief The maximum number of coroutines resumed from the ready queue per
+   * pass, so that tasks yielding in a tight loop cannot hold back the next
+   * submission and completion pass. 0 for no limit.
+   */
+  unsigned ready_budget = 64;
+  /**
+   * @brief How long the loop may run coroutines after a completion pass
+   * before maybe_yield() suspends the caller.
+   */
+  std::chrono::microseconds time_slice{500};
+};
+
+/**
+ * @brief Counters of the submissions of a loop.
+ *
+ */
+struct submit_stats {
+  /** @brief The number of io_uring_enter calls made to submit or wait. */
+  uint64_t enters = 0;
+  /** @brief The number of SQEs submitted. */
+  uint64_t sqes = 0;
+
+  /**
+   * @brief Get the average number of SQEs submitted per io_uring_enter.
+   *
+   * @return double The average batch size.
+   */
+  double sqes_per_enter() const {
+    return enters == 0 ? 0 : static_cast<double>(sqes) / enters;
+  }
+};
+
 class event_loop : public noncopyable,
                    public std::enable_shared_from_this<event_loop> {
+public:
+  /**
+   * @brief A coroutine sent to a loop to be resumed there. It lives in the
+   * frame of the suspended coroutine, so sending needs no allocation.
+   *
+   */
+  struct message {
+    message *next_;
+    std::coroutine_handle<> h_;
+    event_loop *target_;
+  };
+
+private:
+  /* A CQE copied out of the CQ, to be dispatched once the CQ is released. */
+  struct harvested_cqe {
+    uint64_t data;
+    int res;
+    uint32_t flags;
+  };
+
   struct io_uring ring_;
-  unsigned int cqe_count_;
-  std::unordered_set<feature> supported_features_;
+  std::vector<harvested_cqe> harvested_;
+  uint32_t setup_flags_;
+  unsigned submit_batch_;
+  size_t zero_copy_threshold_;
+  /* Sends of fewer bytes copy; SIZE_MAX if the zero-copy op is missing. */
+  size_t send_zc_threshold_;
+  size_t sendmsg_zc_threshold_;
+  bool fixed_files_required_;
+  bool multishot_accept_;
+  bool multishot_recv_;
+  struct submit_stats submit_stats_;
+#ifdef URINGPP_METRICS
+  detail::loop_metrics metrics_;
+#endif
+  uint32_t supported_features_;
   std::bitset<IORING_OP_LAST> supported_ops_;
+  bool baseline_ops_;
+  std::vector<std::unique_ptr<provided_buffer_ring>> buffer_rings_;
+  std::unique_ptr<fixed_file_table> files_;
+  std::unique_ptr<fixed_buffer_pool> buffer_pool_;
+  std::vector<std::coroutine_handle<>> deferred_;
+  std::vector<std::coroutine_handle<>> running_deferred_;
+  std::deque<std::coroutine_handle<>> ready_;
+  size_t ready_budget_;
+  uint64_t time_slice_ns_;
+  uint64_t pass_start_ns_;
+  timer_wheel timers_;
+  __kernel_timespec timer_ts_;
+  uint64_t timer_armed_at_;
+  bool timer_armed_;
+  std::atomic<message *> inbox_;
+  int wakeup_fd_;
+  uint64_t wakeup_buf_;
+  static inline thread_local event_loop *current_ = nullptr;
   class probe_ring {
     struct io_uring_probe *probe_;
 
@@ -50,73 +248,784 @@ class event_loop : public noncopyable,
 
   void init_supported_features(struct io_uring_params const &params);
 
+  void init_capabilities();
+
+  template <int Op> void require_op() const {
+    static_assert(Op >= 0 && Op < IORING_OP_LAST);
+    if constexpr (Op < URINGPP_BASELINE_OP) {
+      if (baseline_ops_) [[likely]] {
+        return;
+      }
+    }
+    if (!supported_ops_[Op]) [[unlikely]] {
+      throw_with("io_uring op %d is not supported by the kernel", Op);
+    }
+  }
+
+  /* Whether to prep an op, or false to make the blocking call it stands for
+   * instead. Flags that only make sense on an SQE rule the fallback out. */
+  template <int Op> bool use_op(uint8_t sqe_flags) const {
+    static_assert(Op >= 0 && Op < IORING_OP_LAST);
+    if constexpr (Op < URINGPP_BASELINE_OP) {
+      if (baseline_ops_) [[likely]] {
+        return true;
+      }
+    }
+    if (supported_ops_[Op]) [[likely]] {
+      return true;
+    }
+    if (sqe_flags & (IOSQE_FIXED_FILE | IOSQE_IO_LINK | IOSQE_IO_HARDLINK |
+                     IOSQE_BUFFER_SELECT)) {
+      require_op<Op>();
+    }
+    return false;
+  }
+
+  /* Run the blocking call an op stands for on offload_pool::shared(), and
+   * resume the awaiting coroutine on this loop with its result. */
+  sqe_awaitable offload_call(std::function<int()> call);
+
   struct io_uring_sqe *get_sqe() {
-    auto sqe = ::io_uring_get_sqe(&ring_);
+    /* The last entry is left for the timeout linked to an operation, so the
+     * link is never split by a submission. */
+    struct io_uring_sqe *sqe = nullptr;
+    if (::io_uring_sq_space_left(&ring_) > 1) [[likely]] {
+      sqe = ::io_uring_get_sqe(&ring_);
+    }
     if (sqe != nullptr) [[likely]] {
       return sqe;
     }
-    ::io_uring_cq_advance(&ring_, cqe_count_);
-    cqe_count_ = 0;
-    ::io_uring_submit(&ring_);
-    sqe = ::io_uring_get_sqe(&ring_);
+#ifdef URINGPP_METRICS
+    metrics_.on_sq_full();
+#endif
+    submit();
+    if (::io_uring_sq_space_left(&ring_) > 1) {
+      sqe = ::io_uring_get_sqe(&ring_);
+    }
     if (sqe == nullptr) [[unlikely]] {
       throw std::runtime_error("failed to allocate sqe");
     }
     return sqe;
   }
 
+  bool cq_needs_enter() const {
+    /* Polled completions are only reaped by entering the kernel. */
+    if (setup_flags_ & (IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_IOPOLL)) {
+      return true;
+    }
+    return __atomic_load_n(ring_.sq.kflags, __ATOMIC_RELAXED) &
+           (IORING_SQ_CQ_OVERFLOW | IORING_SQ_TASKRUN);
+  }
+
+  void account_submit(int rc, bool entered = true) {
+    if (entered) {
+      ++submit_stats_.enters;
+#ifdef URINGPP_METRICS
+      metrics_.on_enter();
+#endif
+    }
+    if (rc > 0) {
+      submit_stats_.sqes += rc;
+    }
+  }
+
+#ifdef URINGPP_METRICS
+  void count_sqes() {
+    if (ring_.sq.sqe_head == ring_.sq.sqe_tail) {
+      return;
+    }
+    metrics_.on_submit();
+    /* The SQEs queued since the last submission, before liburing flushes
+     * them to the kernel. */
+    unsigned shift = (setup_flags_ & IORING_SETUP_SQE128) ? 1 : 0;
+    for (auto i = ring_.sq.sqe_head; i != ring_.sq.sqe_tail; ++i) {
+      metrics_.on_sqe(ring_.sq.sqes[(i & ring_.sq.ring_mask) << shift].opcode);
+    }
+  }
+#endif
+
   sqe_awaitable await_sqe(struct io_uring_sqe *sqe, uint8_t flags) {
     ::io_uring_sqe_set_flags(sqe, flags);
     return sqe_awaitable(sqe);
   }
 
+  auto link_timeout(sqe_awaitable op, __kernel_timespec const &ts,
+                    unsigned flags) {
+    struct awaitable {
+      sqe_awaitable op_;
+      __kernel_timespec ts_;
+      struct io_uring_sqe *timeout_sqe_;
+      bool await_ready() noexcept {
+        return timeout_sqe_ == nullptr && op_.await_ready();
+      }
+      bool await_suspend(std::coroutine_handle<> h) {
+        /* The timespec is read on submission, from the awaiting frame. */
+        if (timeout_sqe_ != nullptr) [[likely]] {
+          timeout_sqe_->addr = reinterpret_cast<uint64_t>(&ts_);
+        }
+        return op_.await_suspend(h);
+      }
+      int await_resume() { return op_.await_resume(); }
+    };
+    if (op.sqe_ == nullptr) [[unlikely]] {
+      /* A fallback run off the loop, which cannot time out. */
+      return awaitable{op, ts, nullptr};
+    }
+    require_op<IORING_OP_LINK_TIMEOUT>();
+    /* get_sqe keeps this entry free. */
+    auto *sqe = ::io_uring_get_sqe(&ring_);
+    if (sqe == nullptr) [[unlikely]] {
+      throw std::runtime_error("failed to allocate sqe");
+    }
+    op.sqe_->flags |= IOSQE_IO_LINK;
+    ::io_uring_prep_link_timeout(sqe, nullptr, flags);
+    ::io_uring_sqe_set_data64(sqe, detail::kDetachedUserData);
+    return awaitable{op, ts, sqe};
+  }
+
+  static uint64_t timer_tick(std::chrono::steady_clock::time_point time) {
+    /* Rounded up so that timers never fire early. */
+    return std::chrono::ceil<std::chrono::milliseconds>(
+               time.time_since_epoch())
+        .count();
+  }
+
+  static uint64_t timer_now() {
+    return std::chrono::floor<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  void arm_timer() {
+    auto next = timers_.next_expiration();
+    if (next == timer_wheel::kNever ||
+        (timer_armed_ && timer_armed_at_ <= next)) {
+      return;
+    }
+    /* steady_clock is CLOCK_MONOTONIC, the clock of absolute timeouts. */
+    timer_ts_ = detail::to_timespec(std::chrono::milliseconds(next));
+    auto data = detail::make_user_data(this, detail::user_data_tag::timer);
+    auto *sqe = get_sqe();
+    if (timer_armed_) {
+      ::io_uring_prep_timeout_update(sqe, &timer_ts_, data,
+                                     IORING_TIMEOUT_ABS);
+      ::io_uring_sqe_set_data64(sqe, detail::kDetachedUserData);
+    } else {
+      ::io_uring_prep_timeout(sqe, &timer_ts_, 0, IORING_TIMEOUT_ABS);
+      ::io_uring_sqe_set_data64(sqe, data);
+    }
+    timer_armed_ = true;
+    timer_armed_at_ = next;
+  }
+
+  void run_deferred() {
+    /* Coroutines deferring again run at the end of the next pass. */
+    running_deferred_.swap(deferred_);
+    for (auto h : running_deferred_) {
+      h.resume();
+    }
+    running_deferred_.clear();
+  }
+
+  void run_ready() {
+    if (ready_.empty()) {
+      return;
+    }
+    /* The SQEs of the pass go out before the ready coroutines run. */
+    if (::io_uring_sq_ready(&ring_) > 0) {
+      submit();
+    }
+    /* Coroutines yielding again run in the next pass. */
+    auto n = ready_.size();
+    if (ready_budget_ != 0) {
+      n = std::min(n, ready_budget_);
+    }
+    while (n-- > 0) {
+      auto h = ready_.front();
+      ready_.pop_front();
+      h.resume();
+    }
+  }
+
+  void dispatch_timer() {
+    timer_armed_ = false;
+    timers_.advance(timer_now());
+    arm_timer();
+  }
+
+  void arm_wakeup() {
+    auto *sqe = get_sqe();
+    ::io_uring_prep_read(sqe, wakeup_fd_, &wakeup_buf_, sizeof(wakeup_buf_),
+                         0);
+    ::io_uring_sqe_set_data64(
+        sqe, detail::make_user_data(this, detail::user_data_tag::wakeup));
+  }
+
+  void drain_inbox() {
+    auto head = inbox_.exchange(nullptr, std::memory_order_acquire);
+    message *reversed = nullptr;
+    while (head != nullptr) {
+      auto next = head->next_;
+      head->next_ = reversed;
+      reversed = head;
+      head = next;
+    }
+    while (reversed != nullptr) {
+      auto next = reversed->next_;
+      reversed->h_.resume();
+      reversed = next;
+    }
+  }
+
+  void dispatch_multishot(multishot_operation *op, int res, uint32_t flags) {
+    bool more = flags & IORING_CQE_F_MORE;
+    if (!more) {
+      op->armed_ = false;
+    }
+    if (op->orphaned_) [[unlikely]] {
+      op->discard(res, flags);
+      if (!more) {
+        delete op;
+      }
+      return;
+    }
+    if (!more && op->restart(res)) {
+      if (!op->parked_) {
+        arm_multishot(op);
+      }
+      if (res < 0) {
+        return;
+      }
+    }
+    op->deliver(res, flags);
+  }
+
+  void dispatch_zero_copy(zero_copy_operation *op, int res, uint32_t flags) {
+    if (flags & IORING_CQE_F_NOTIF) {
+      if (op->owned_) {
+        delete op;
+      } else {
+        op->h_.resume();
+      }
+      return;
+    }
+    op->res_ = res;
+    bool more = flags & IORING_CQE_F_MORE;
+    if (op->owned_) {
+      op->h_.resume();
+      if (!more) {
+        delete op;
+      }
+    } else if (!more) {
+      op->h_.resume();
+    }
+  }
+
+  void prep_send_zc(zero_copy_operation *op, int sockfd, void const *buf,
+                    size_t len, int flags, uint8_t sqe_flags, int buf_index) {
+    auto *sqe = get_sqe();
+    if (len < send_zc_threshold_) {
+      ::io_uring_prep_send(sqe, sockfd, buf, len, flags);
+    } else if (buf_index >= 0) {
+      ::io_uring_prep_send_zc_fixed(sqe, sockfd, buf, len, flags, 0,
+                                    buf_index);
+    } else {
+      ::io_uring_prep_send_zc(sqe, sockfd, buf, len, flags, 0);
+    }
+    ::io_uring_sqe_set_flags(sqe, sqe_flags);
+    ::io_uring_sqe_set_data64(
+        sqe, detail::make_user_data(op, detail::user_data_tag::zero_copy));
+  }
+
+  void prep_sendmsg_zc(zero_copy_operation *op, int sockfd,
+                       msghdr const *msg, uint32_t flags, uint8_t sqe_flags) {
+    size_t len = 0;
+    for (size_t i = 0; i < msg->msg_iovlen; ++i) {
+      len += msg->msg_iov[i].iov_len;
+    }
+    auto *sqe = get_sqe();
+    if (len >= sendmsg_zc_threshold_) {
+      ::io_uring_prep_sendmsg_zc(sqe, sockfd, msg, flags);
+    } else {
+      ::io_uring_prep_sendmsg(sqe, sockfd, msg, flags);
+    }
+    ::io_uring_sqe_set_flags(sqe, sqe_flags);
+    ::io_uring_sqe_set_data64(
+        sqe, detail::make_user_data(op, detail::user_data_tag::zero_copy));
+  }
+
+  template <class Buffer>
+  struct owning_zero_copy_operation : public zero_copy_operation {
+    Buffer buffer_;
+    explicit owning_zero_copy_operation(Buffer &&buffer)
+        : zero_copy_operation(true), buffer_(std::move(buffer)) {}
+  };
+
 public:
   static std::shared_ptr<event_loop> create(unsigned int entries = 128,
                                             uint32_t flags = 0, int wq_fd = -1);
 
+  /**
+   * @brief Create an event loop.
+   *
+   * @param options The options of the loop.
+   * @return std::shared_ptr<event_loop> The loop.
+   */
+  static std::shared_ptr<event_loop> create(loop_options const &options);
+
   event_loop(unsigned int entries = 128, uint32_t flags = 0, int wq_fd = -1,
              int sq_thread_cpu = -1, int sq_thread_idle = -1);
 
+  /**
+   * @brief Construct an event loop. Optional setup flags the kernel rejects
+   * are dropped, newest first.
+   *
+   * @param options The options of the loop.
+   */
+  explicit event_loop(loop_options const &options);
+
   template <class T> void block_on(task<T> t) {
-    while (!t.h_.done()) {
+    run_until([&t]() { return t.h_.done(); });
+  }
+
+  /**
+   * @brief Poll the loop on the calling thread until the predicate holds.
+   * While running, the loop is the current loop of the thread. SQEs queued
+   * by the last pass, e.g. detached closes or messages to other loops, are
+   * submitted before returning.
+   *
+   * @param done The predicate, checked after every poll.
+   */
+  template <class Predicate> void run_until(Predicate done) {
+    struct current_guard {
+      event_loop *previous_;
+      ~current_guard() { current_ = previous_; }
+    } guard{std::exchange(current_, this)};
+    while (!done()) {
       poll();
     }
+    if (::io_uring_sq_ready(&ring_) > 0) {
+      submit();
+    }
+  }
+
+  /**
+   * @brief Get the loop running on the calling thread.
+   *
+   * @return event_loop* The current loop, or nullptr if the thread is not
+   * running a loop via block_on or run_until.
+   */
+  static event_loop *current() { return current_; }
+
+  /**
+   * @brief Resume a coroutine on this loop. Safe to call from any thread. The
+   * loop is woken up through an eventfd if it is waiting for completions.
+   *
+   * @param m The message holding the coroutine.
+   */
+  void post(message *m) {
+    auto head = inbox_.load(std::memory_order_relaxed);
+    do {
+      m->next_ = head;
+    } while (!inbox_.compare_exchange_weak(
+        head, m, std::memory_order_release, std::memory_order_relaxed));
+    if (head == nullptr) {
+      wake();
+    }
+  }
+
+  /**
+   * @brief Wake the loop up if it is waiting for completions. Safe to call from
+   * any thread.
+   *
+   */
+  void wake() {
+    uint64_t one = 1;
+    [[maybe_unused]] auto rc = ::write(wakeup_fd_, &one, sizeof(one));
+  }
+
+  /**
+   * @brief Send a message to another loop with IORING_OP_MSG_RING, which
+   * posts a CQE directly to the target ring. Falls back to post() if the
+   * kernel fails to deliver.
+   *
+   * @param m The message to send.
+   */
+  void send_message(message *m) {
+    require_op<IORING_OP_MSG_RING>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_msg_ring(
+        sqe, m->target_->fd(), 0,
+        detail::make_user_data(m, detail::user_data_tag::message), 0);
+    ::io_uring_sqe_set_data64(
+        sqe, detail::make_user_data(m, detail::user_data_tag::message_source));
+  }
+
+  /**
+   * @brief Resume the coroutine of a message on its target loop. Safe to call
+   * from any thread. If the calling thread runs a loop supporting
+   * IORING_OP_MSG_RING the message goes through the rings, otherwise via
+   * post().
+   *
+   * @param m The message holding the coroutine.
+   */
+  static void send_to_target(message *m) {
+    if (current_ != nullptr && current_->supported_ops_[IORING_OP_MSG_RING]) {
+      current_->send_message(m);
+    } else {
+      m->target_->post(m);
+    }
+  }
+
+  /**
+   * @brief Suspend the awaiting coroutine until the end of the current
+   * completion pass, after the coroutines resumed by the CQEs of the pass have
+   * run, e.g. to coalesce the writes they make into a single SQE. Must be
+   * awaited on the thread running the loop.
+   *
+   * @return An awaitable which resumes at the end of the pass.
+   */
+  auto defer() {
+    struct awaitable {
+      event_loop *loop_;
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        loop_->deferred_.push_back(h);
+      }
+      void await_resume() noexcept {}
+    };
+    return awaitable{this};
+  }
+
+  /**
+   * @brief Suspend the awaiting coroutine and put it at the back of the ready
+   * queue, without a round trip through the kernel. Ready coroutines run
+   * after the completion pass, once the SQEs it queued are submitted, and at
+   * most ready_budget of them per pass. Must be awaited on the thread running
+   * the loop.
+   *
+   * @return An awaitable which resumes from the ready queue.
+   */
+  auto yield() {
+    struct awaitable {
+      event_loop *loop_;
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        loop_->ready_.push_back(h);
+      }
+      void await_resume() noexcept {}
+    };
+    return awaitable{this};
+  }
+
+  /**
+   * @brief Yield if the loop has run coroutines for longer than its time
+   * slice since the last completion pass, e.g. in every iteration of a
+   * CPU-heavy loop. Otherwise continue without suspending.
+   *
+   * @return An awaitable which only suspends once the time slice is used up.
+   */
+  auto maybe_yield() {
+    struct awaitable {
+      event_loop *loop_;
+      bool await_ready() noexcept {
+        return detail::monotonic_ns() - loop_->pass_start_ns_ <
+               loop_->time_slice_ns_;
+      }
+      void await_suspend(std::coroutine_handle<> h) {
+        loop_->ready_.push_back(h);
+      }
+      void await_resume() noexcept {}
+    };
+    return awaitable{this};
+  }
+
+  /**
+   * @brief Start a coroutine from the ready queue rather than inline, e.g. to
+   * start many connections' handlers without running them all at once. The
+   * coroutine is detached; exceptions escaping it are dropped. Must be
+   * called on the thread running the loop.
+   *
+   * @param f A callable returning the awaitable to run, e.g. a lambda
+   * returning a task. It is moved into the spawned coroutine.
+   */
+  template <class F> void spawn(F f) {
+    auto t = [](event_loop *loop, F f) -> task<void> {
+      co_await loop->yield();
+      co_await f();
+    }(this, std::move(f));
+    t.detach();
+  }
+
+  /**
+   * @brief Get the number of coroutines in the ready queue.
+   *
+   * @return size_t The number of ready coroutines.
+   */
+  size_t ready() const { return ready_.size(); }
+
+  /**
+   * @brief Move the awaiting coroutine to this loop. If the calling thread runs
+   * a loop supporting IORING_OP_MSG_RING the coroutine is handed over with a
+   * message through the rings, otherwise via post().
+   *
+   * @return An awaitable which resumes on this loop.
+   */
+  auto schedule() {
+    struct awaitable {
+      message m_;
+      bool await_ready() noexcept { return current_ == m_.target_; }
+      void await_suspend(std::coroutine_handle<> h) {
+        m_.h_ = h;
+        send_to_target(&m_);
+      }
+      void await_resume() noexcept {}
+    };
+    return awaitable{{nullptr, nullptr, this}};
   }
 
   int fd() const { return ring_.ring_fd; }
 
+  /**
+   * @brief Get the number of entries of the submission queue.
+   *
+   * @return unsigned The size of the SQ.
+   */
+  unsigned sq_entries() const { return ring_.sq.ring_entries; }
+
+  /**
+   * @brief Get the setup flags the ring was created with, after dropping the
+   * optional flags the kernel does not support.
+   *
+   * @return uint32_t The setup flags.
+   */
+  uint32_t setup_flags() const { return setup_flags_; }
+
+  /**
+   * @brief Get the size below which zero-copy sends fall back to copying.
+   *
+   * @return size_t The threshold in bytes.
+   */
+  size_t zero_copy_threshold() const { return zero_copy_threshold_; }
+
+  /**
+   * @brief Check whether the kernel supports a feature.
+   *
+   * @param f The feature.
+   * @return true if the feature is supported.
+   */
+  bool has_feature(feature f) const {
+    return supported_features_ & (1u << static_cast<unsigned>(f));
+  }
+
+  /**
+   * @brief Check whether the kernel supports an op, as probed on creation.
+   *
+   * @param op The IORING_OP_* opcode.
+   * @return true if the op is supported.
+   */
+  bool has_op(int op) const {
+    return op >= 0 && op < IORING_OP_LAST && supported_ops_[op];
+  }
+
+  /**
+   * @brief Check whether accepts can be multishot (kernel 5.19). Otherwise
+   * accept_stream re-arms a single-shot accept after every connection.
+   *
+   * @return true if multishot accepts are supported.
+   */
+  bool has_multishot_accept() const { return multishot_accept_; }
+
+  /**
+   * @brief Check whether receives can be multishot (kernel 6.0). Otherwise
+   * recv_stream re-arms a single-shot receive after every chunk.
+   *
+   * @return true if multishot receives are supported.
+   */
+  bool has_multishot_recv() const { return multishot_recv_; }
+
+  /**
+   * @brief Check whether file descriptors must be registered to be used, i.e.
+   * the loop runs SQPOLL on a kernel without IORING_FEAT_SQPOLL_NONFIXED. Ops
+   * creating descriptors then install them into the file table.
+   *
+   * @return true if only fixed files may be used.
+   */
+  bool fixed_files_required() const { return fixed_files_required_; }
+
+  /**
+   * @brief Get the submission counters of the loop.
+   *
+   * @return struct submit_stats const& The counters.
+   */
+  struct submit_stats const &submit_stats() const { return submit_stats_; }
+
+  /**
+   * @brief Take a snapshot of the metrics of the loop, e.g. to export them.
+   * Safe to call from any thread. Without URINGPP_METRICS nothing is
+   * collected and the snapshot is empty.
+   *
+   * @return metrics_snapshot The metrics.
+   */
+  metrics_snapshot metrics() const {
+    metrics_snapshot s;
+#ifdef URINGPP_METRICS
+    metrics_.snapshot(s);
+    s.cq_overflow = __atomic_load_n(ring_.cq.koverflow, __ATOMIC_RELAXED);
+#endif
+    return s;
+  }
+
+  /**
+   * @brief Submit the queued SQEs now instead of at the end of the current
+   * completion pass. Does not enter the kernel if there is nothing to do.
+   *
+   * @return int The number of SQEs submitted.
+   */
+  int submit() {
+    if (::io_uring_sq_ready(&ring_) == 0 && !cq_needs_enter()) {
+      return 0;
+    }
+#ifdef URINGPP_METRICS
+    count_sqes();
+#endif
+    if (setup_flags_ & IORING_SETUP_SQPOLL) {
+      /* liburing only enters the kernel to wake the SQ thread up. */
+      bool entered = cq_needs_enter() ||
+                     (__atomic_load_n(ring_.sq.kflags, __ATOMIC_ACQUIRE) &
+                      IORING_SQ_NEED_WAKEUP);
+      auto rc = ::io_uring_submit(&ring_);
+      account_submit(rc, entered);
+      return rc;
+    }
+    auto rc = (setup_flags_ & IORING_SETUP_DEFER_TASKRUN)
+                  ? ::io_uring_submit_and_get_events(&ring_)
+                  : ::io_uring_submit(&ring_);
+    account_submit(rc);
+    return rc;
+  }
+
+  /**
+   * @brief Run a completion pass. The ready CQEs are first copied out and the
+   * CQ released in one step, then dispatched in order, so the coroutines they
+   * resume may submit, and the kernel may post new CQEs, without touching the
+   * entries being dispatched.
+   *
+   * @return int The number of CQEs processed.
+   */
   int process_cqe() {
     io_uring_cqe *cqe;
     unsigned head;
-
+    unsigned nr_cqes = 0;
     io_uring_for_each_cqe(&ring_, head, cqe) {
-      ++cqe_count_;
-      auto awaitable =
-          reinterpret_cast<sqe_awaitable *>(::io_uring_cqe_get_data(cqe));
-      if (awaitable != nullptr) [[likely]] {
-        awaitable->rc_ = cqe->res;
-        awaitable->h_.resume();
+      ++nr_cqes;
+      auto data = ::io_uring_cqe_get_data64(cqe);
+      if (data != detail::kDetachedUserData) [[likely]] {
+        harvested_.push_back({data, cqe->res, cqe->flags});
+      }
+    }
+    if (nr_cqes > 0) {
+      ::io_uring_cq_advance(&ring_, nr_cqes);
+#ifdef URINGPP_METRICS
+      metrics_.on_wakeup(nr_cqes);
+      /* One clock read per pass: latencies include the wait for the pass. */
+      auto now = detail::monotonic_ns();
+#endif
+      for (auto const &c : harvested_) {
+        switch (detail::get_user_data_tag(c.data)) {
+        case detail::user_data_tag::awaitable: {
+          auto awaitable = detail::get_user_data_ptr<sqe_awaitable>(c.data);
+#ifdef URINGPP_METRICS
+          /* Ops submitted during the pass may complete after the clock
+           * was read. */
+          metrics_.on_complete(awaitable->opcode_,
+                               now > awaitable->start_ns_
+                                   ? now - awaitable->start_ns_
+                                   : 0);
+#endif
+          awaitable->rc_ = c.res;
+          awaitable->flags_ = c.flags;
+          awaitable->h_.resume();
+          break;
+        }
+        case detail::user_data_tag::multishot:
+          dispatch_multishot(
+              detail::get_user_data_ptr<multishot_operation>(c.data), c.res,
+              c.flags);
+          break;
+        case detail::user_data_tag::message:
+          detail::get_user_data_ptr<message>(c.data)->h_.resume();
+          break;
+        case detail::user_data_tag::message_source:
+          if (c.res < 0) [[unlikely]] {
+            auto m = detail::get_user_data_ptr<message>(c.data);
+            m->target_->post(m);
+          }
+          break;
+        case detail::user_data_tag::wakeup:
+          /* Re-armed even on errors, or post() could never wake the loop
+           * again. A failed read leaves the counter set, so the next read
+           * completes at once. */
+          arm_wakeup();
+          if (c.res > 0) [[likely]] {
+            drain_inbox();
+          }
+          break;
+        case detail::user_data_tag::file_slot:
+          files_->release(detail::get_user_data_value(c.data));
+          break;
+        case detail::user_data_tag::zero_copy:
+          dispatch_zero_copy(
+              detail::get_user_data_ptr<zero_copy_operation>(c.data), c.res,
+              c.flags);
+          break;
+        case detail::user_data_tag::timer:
+          dispatch_timer();
+          break;
+        }
+        if (submit_batch_ != 0 &&
+            ::io_uring_sq_ready(&ring_) >= submit_batch_) [[unlikely]] {
+          submit();
+        }
       }
+      harvested_.clear();
     }
-    int nr_processed = cqe_count_;
-    ::io_uring_cq_advance(&ring_, cqe_count_);
-    cqe_count_ = 0;
-    return nr_processed;
+    if (!deferred_.empty()) {
+      run_deferred();
+    }
+    return nr_cqes;
   }
 
   int poll_no_wait() {
-    ::io_uring_submit(&ring_);
-    return process_cqe();
+    submit();
+    pass_start_ns_ = detail::monotonic_ns();
+    auto nr_cqes = process_cqe();
+    run_ready();
+    return nr_cqes;
   }
 
   void poll() {
-    ::io_uring_submit_and_wait(&ring_, 1);
+    if (setup_flags_ & IORING_SETUP_IOPOLL) [[unlikely]] {
+      /* The wakeup eventfd cannot be read on a polled ring. */
+      drain_inbox();
+    }
+    if (::io_uring_cq_ready(&ring_) > 0 || !deferred_.empty() ||
+        !ready_.empty()) {
+      submit();
+    } else {
+#ifdef URINGPP_METRICS
+      count_sqes();
+#endif
+      account_submit(::io_uring_submit_and_wait(&ring_, 1));
+    }
+    pass_start_ns_ = detail::monotonic_ns();
     process_cqe();
+    run_ready();
   }
 
   sqe_awaitable openat(int dfd, const char *path, int flags, mode_t mode,
                        uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_OPENAT));
+    require_op<IORING_OP_OPENAT>();
     auto *sqe = get_sqe();
     ::io_uring_prep_openat(sqe, dfd, path, flags, mode);
     return await_sqe(sqe, sqe_flags);
@@ -124,15 +1033,32 @@ public:
 
   sqe_awaitable openat2(int dfd, const char *path, struct open_how *how,
                         uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_OPENAT2));
+    require_op<IORING_OP_OPENAT2>();
     auto *sqe = get_sqe();
     ::io_uring_prep_openat2(sqe, dfd, path, how);
     return await_sqe(sqe, sqe_flags);
   }
 
+  sqe_awaitable openat_direct(int dfd, const char *path, int flags,
+                              mode_t mode, unsigned file_index,
+                              uint8_t sqe_flags = 0) {
+    require_op<IORING_OP_OPENAT>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_openat_direct(sqe, dfd, path, flags, mode, file_index);
+    return await_sqe(sqe, sqe_flags);
+  }
+
+  sqe_awaitable openat2_direct(int dfd, const char *path, struct open_how *how,
+                               unsigned file_index, uint8_t sqe_flags = 0) {
+    require_op<IORING_OP_OPENAT2>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_openat2_direct(sqe, dfd, path, how, file_index);
+    return await_sqe(sqe, sqe_flags);
+  }
+
   sqe_awaitable readv(int fd, const iovec *iovecs, unsigned nr_vecs,
                       off_t offset = 0, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_READV));
+    require_op<IORING_OP_READV>();
     auto *sqe = get_sqe();
     ::io_uring_prep_readv(sqe, fd, iovecs, nr_vecs, offset);
     return await_sqe(sqe, sqe_flags);
@@ -140,7 +1066,7 @@ public:
 
   sqe_awaitable writev(int fd, const iovec *iovecs, unsigned nr_vecs,
                        off_t offset = 0, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_WRITEV));
+    require_op<IORING_OP_WRITEV>();
     auto *sqe = get_sqe();
     ::io_uring_prep_writev(sqe, fd, iovecs, nr_vecs, offset);
     return await_sqe(sqe, sqe_flags);
@@ -148,7 +1074,7 @@ public:
 
   sqe_awaitable read(int fd, void *buf, unsigned nbytes, off_t offset = 0,
                      uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_READ));
+    require_op<IORING_OP_READ>();
     auto *sqe = get_sqe();
     ::io_uring_prep_read(sqe, fd, buf, nbytes, offset);
     return await_sqe(sqe, sqe_flags);
@@ -156,7 +1082,7 @@ public:
 
   sqe_awaitable write(int fd, const void *buf, unsigned nbytes,
                       off_t offset = 0, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_WRITE));
+    require_op<IORING_OP_WRITE>();
     auto *sqe = get_sqe();
     ::io_uring_prep_write(sqe, fd, buf, nbytes, offset);
     return await_sqe(sqe, sqe_flags);
@@ -164,7 +1090,7 @@ public:
 
   sqe_awaitable read_fixed(int fd, void *buf, unsigned nbytes, off_t offset,
                            int buf_index, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_READ_FIXED));
+    require_op<IORING_OP_READ_FIXED>();
     auto *sqe = get_sqe();
     ::io_uring_prep_read_fixed(sqe, fd, buf, nbytes, offset, buf_index);
     return await_sqe(sqe, sqe_flags);
@@ -173,14 +1099,14 @@ public:
   sqe_awaitable write_fixed(int fd, const void *buf, unsigned nbytes,
                             off_t offset, int buf_index,
                             uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_WRITE_FIXED));
+    require_op<IORING_OP_WRITE_FIXED>();
     auto *sqe = get_sqe();
     ::io_uring_prep_write_fixed(sqe, fd, buf, nbytes, offset, buf_index);
     return await_sqe(sqe, sqe_flags);
   }
 
   sqe_awaitable fsync(int fd, unsigned fsync_flags, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_FSYNC));
+    require_op<IORING_OP_FSYNC>();
     auto *sqe = get_sqe();
     ::io_uring_prep_fsync(sqe, fd, fsync_flags);
     return await_sqe(sqe, sqe_flags);
@@ -189,7 +1115,7 @@ public:
   sqe_awaitable sync_file_range(int fd, off64_t offset, off64_t nbytes,
                                 unsigned sync_range_flags,
                                 uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_SYNC_FILE_RANGE));
+    require_op<IORING_OP_SYNC_FILE_RANGE>();
     auto *sqe = get_sqe();
     ::io_uring_prep_rw(IORING_OP_SYNC_FILE_RANGE, sqe, fd, nullptr, nbytes,
                        offset);
@@ -197,9 +1123,17 @@ public:
     return await_sqe(sqe, sqe_flags);
   }
 
+  sqe_awaitable fadvise(int fd, off_t offset, off_t len, int advice,
+                        uint8_t sqe_flags = 0) {
+    require_op<IORING_OP_FADVISE>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_fadvise(sqe, fd, offset, len, advice);
+    return await_sqe(sqe, sqe_flags);
+  }
+
   sqe_awaitable recvmsg(int sockfd, msghdr *msg, uint32_t flags,
                         uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_RECVMSG));
+    require_op<IORING_OP_RECVMSG>();
     auto *sqe = get_sqe();
     ::io_uring_prep_recvmsg(sqe, sockfd, msg, flags);
     return await_sqe(sqe, sqe_flags);
@@ -207,7 +1141,7 @@ public:
 
   sqe_awaitable sendmsg(int sockfd, const msghdr *msg, uint32_t flags,
                         uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_SENDMSG));
+    require_op<IORING_OP_SENDMSG>();
     auto *sqe = get_sqe();
     ::io_uring_prep_sendmsg(sqe, sockfd, msg, flags);
     return await_sqe(sqe, sqe_flags);
@@ -215,7 +1149,7 @@ public:
 
   sqe_awaitable recv(int sockfd, void *buf, unsigned nbytes, uint32_t flags,
                      uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_RECV));
+    require_op<IORING_OP_RECV>();
     auto *sqe = get_sqe();
     ::io_uring_prep_recv(sqe, sockfd, buf, nbytes, flags);
     return await_sqe(sqe, sqe_flags);
@@ -223,21 +1157,153 @@ public:
 
   sqe_awaitable send(int sockfd, const void *buf, unsigned nbytes,
                      uint32_t flags, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_SEND));
+    require_op<IORING_OP_SEND>();
     auto *sqe = get_sqe();
     ::io_uring_prep_send(sqe, sockfd, buf, nbytes, flags);
     return await_sqe(sqe, sqe_flags);
   }
 
+  /**
+   * @brief Send with IORING_OP_SEND_ZC, or copying if the message is below the
+   * zero-copy threshold or the kernel lacks zero-copy sends.
+   *
+   * @return An awaitable resolving to the result once the kernel no longer
+   * references the buffer.
+   */
+  auto send_zc(int sockfd, void const *buf, size_t len, int flags,
+               uint8_t sqe_flags = 0) {
+    struct awaitable : public zero_copy_operation {
+      event_loop *loop_;
+      int sockfd_;
+      void const *buf_;
+      size_t len_;
+      int flags_;
+      uint8_t sqe_flags_;
+      awaitable(event_loop *loop, int sockfd, void const *buf, size_t len,
+                int flags, uint8_t sqe_flags)
+          : zero_copy_operation(false), loop_(loop), sockfd_(sockfd),
+            buf_(buf), len_(len), flags_(flags), sqe_flags_(sqe_flags) {}
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        h_ = h;
+        loop_->prep_send_zc(this, sockfd_, buf_, len_, flags_, sqe_flags_, -1);
+      }
+      int await_resume() noexcept { return res_; }
+    };
+    return awaitable(this, sockfd, buf, len, flags, sqe_flags);
+  }
+
+  /**
+   * @brief Send with IORING_OP_SEND_ZC, or copying if the message is below the
+   * zero-copy threshold or the kernel lacks zero-copy sends. The buffer is
+   * owned by the send and destroyed once the kernel no longer references it.
+   * A fixed_buffer lease is sent with IORING_RECVSEND_FIXED_BUF.
+   *
+   * @param buffer A movable object with data(), e.g. a fixed_buffer or a
+   * std::vector.
+   * @param len The number of bytes to send from the start of the buffer.
+   * @return An awaitable resolving to the result as soon as it is known.
+   */
+  template <class Buffer>
+    requires(!std::is_pointer_v<Buffer>)
+  auto send_zc(int sockfd, Buffer buffer, size_t len, int flags,
+               uint8_t sqe_flags = 0) {
+    struct awaitable {
+      event_loop *loop_;
+      int sockfd_;
+      Buffer buffer_;
+      size_t len_;
+      int flags_;
+      uint8_t sqe_flags_;
+      zero_copy_operation *op_ = nullptr;
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        auto op = new owning_zero_copy_operation<Buffer>(std::move(buffer_));
+        int buf_index = -1;
+        if constexpr (std::is_same_v<Buffer, fixed_buffer>) {
+          buf_index = op->buffer_.index();
+        }
+        op->h_ = h;
+        op_ = op;
+        loop_->prep_send_zc(op, sockfd_, std::data(op->buffer_), len_, flags_,
+                            sqe_flags_, buf_index);
+      }
+      int await_resume() noexcept { return op_->result(); }
+    };
+    return awaitable{this, sockfd, std::move(buffer), len, flags, sqe_flags};
+  }
+
+  /**
+   * @brief Send a message with IORING_OP_SENDMSG_ZC, or copying if it is below
+   * the zero-copy threshold or the kernel lacks zero-copy sends.
+   *
+   * @return An awaitable resolving to the result once the kernel no longer
+   * references the data.
+   */
+  auto sendmsg_zc(int sockfd, msghdr const *msg, uint32_t flags,
+                  uint8_t sqe_flags = 0) {
+    struct awaitable : public zero_copy_operation {
+      event_loop *loop_;
+      int sockfd_;
+      msghdr const *msg_;
+      uint32_t flags_;
+      uint8_t sqe_flags_;
+      awaitable(event_loop *loop, int sockfd, msghdr const *msg,
+                uint32_t flags, uint8_t sqe_flags)
+          : zero_copy_operation(false), loop_(loop), sockfd_(sockfd),
+            msg_(msg), flags_(flags), sqe_flags_(sqe_flags) {}
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        h_ = h;
+        loop_->prep_sendmsg_zc(this, sockfd_, msg_, flags_, sqe_flags_);
+      }
+      int await_resume() noexcept { return res_; }
+    };
+    return awaitable(this, sockfd, msg, flags, sqe_flags);
+  }
+
+  /**
+   * @brief Send a message with IORING_OP_SENDMSG_ZC, or copying if it is below
+   * the zero-copy threshold or the kernel lacks zero-copy sends. The owner of
+   * the data is destroyed once the kernel no longer references it.
+   *
+   * @param owner A movable object owning the data the message points to.
+   * @param msg The message. Must stay valid until the send is submitted.
+   * @return An awaitable resolving to the result as soon as it is known.
+   */
+  template <class Owner>
+    requires(!std::is_pointer_v<Owner>)
+  auto sendmsg_zc(int sockfd, Owner owner, msghdr const *msg, uint32_t flags,
+                  uint8_t sqe_flags = 0) {
+    struct awaitable {
+      event_loop *loop_;
+      int sockfd_;
+      Owner owner_;
+      msghdr const *msg_;
+      uint32_t flags_;
+      uint8_t sqe_flags_;
+      zero_copy_operation *op_ = nullptr;
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        auto op = new owning_zero_copy_operation<Owner>(std::move(owner_));
+        op->h_ = h;
+        op_ = op;
+        loop_->prep_sendmsg_zc(op, sockfd_, msg_, flags_, sqe_flags_);
+      }
+      int await_resume() noexcept { return op_->result(); }
+    };
+    return awaitable{this, sockfd, std::move(owner), msg, flags, sqe_flags};
+  }
+
   sqe_awaitable poll_add(int fd, short poll_mask, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_POLL_ADD));
+    require_op<IORING_OP_POLL_ADD>();
     auto *sqe = get_sqe();
     ::io_uring_prep_poll_add(sqe, fd, poll_mask);
     return await_sqe(sqe, sqe_flags);
   }
 
   sqe_awaitable nop(uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_NOP));
+    require_op<IORING_OP_NOP>();
     auto *sqe = get_sqe();
     ::io_uring_prep_nop(sqe);
     return await_sqe(sqe, sqe_flags);
@@ -245,45 +1311,249 @@ public:
 
   sqe_awaitable accept(int fd, sockaddr *addr, socklen_t *addrlen,
                        int flags = 0, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_ACCEPT));
+    require_op<IORING_OP_ACCEPT>();
     auto *sqe = get_sqe();
     ::io_uring_prep_accept(sqe, fd, addr, addrlen, flags);
     return await_sqe(sqe, sqe_flags);
   }
 
+  sqe_awaitable accept_direct(int fd, sockaddr *addr, socklen_t *addrlen,
+                              int flags, unsigned file_index,
+                              uint8_t sqe_flags = 0) {
+    require_op<IORING_OP_ACCEPT>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_accept_direct(sqe, fd, addr, addrlen, flags, file_index);
+    return await_sqe(sqe, sqe_flags);
+  }
+
+  sqe_awaitable socket_direct(int domain, int type, int protocol,
+                              unsigned file_index, uint8_t sqe_flags = 0) {
+    require_op<IORING_OP_SOCKET>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_socket_direct(sqe, domain, type, protocol, file_index, 0);
+    return await_sqe(sqe, sqe_flags);
+  }
+
   sqe_awaitable connect(int fd, sockaddr *addr, socklen_t addrlen,
                         uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_CONNECT));
+    require_op<IORING_OP_CONNECT>();
     auto *sqe = get_sqe();
     ::io_uring_prep_connect(sqe, fd, addr, addrlen);
     return await_sqe(sqe, sqe_flags);
   }
 
   sqe_awaitable timeout(__kernel_timespec *ts, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_TIMEOUT));
+    require_op<IORING_OP_TIMEOUT>();
     auto *sqe = get_sqe();
     ::io_uring_prep_timeout(sqe, ts, 0, 0);
     return await_sqe(sqe, sqe_flags);
   }
 
+  /**
+   * @brief Bound an operation by a timeout, linked to it with
+   * IORING_OP_LINK_TIMEOUT. The operation must be the last one prepared on the
+   * loop and is awaited through the returned awaitable.
+   *
+   * @param op The operation.
+   * @param timeout The timeout, relative to the submission.
+   * @return An awaitable resolving to the result of the operation, which is
+   * -ECANCELED if the timeout fired first.
+   */
+  template <class Rep, class Period>
+  auto with_timeout(sqe_awaitable op,
+                    std::chrono::duration<Rep, Period> timeout) {
+    return link_timeout(op, detail::to_timespec(timeout), 0);
+  }
+
+  /**
+   * @brief Bound an operation by a deadline, linked to it with
+   * IORING_OP_LINK_TIMEOUT. The operation must be the last one prepared on the
+   * loop and is awaited through the returned awaitable.
+   *
+   * @param op The operation.
+   * @param deadline The deadline.
+   * @return An awaitable resolving to the result of the operation, which is
+   * -ECANCELED if the deadline passed first.
+   */
+  auto with_deadline(sqe_awaitable op,
+                     std::chrono::steady_clock::time_point deadline) {
+    return link_timeout(op, detail::to_timespec(deadline.time_since_epoch()),
+                        IORING_TIMEOUT_ABS);
+  }
+
+  /**
+   * @brief Start a chain of linked operations. Up to capacity operations may
+   * be prepared and added to the chain before it is awaited, without a
+   * submission in between.
+   *
+   * @param capacity The number of operations of the chain.
+   * @param hard Whether to link with IOSQE_IO_HARDLINK.
+   * @return sqe_chain The empty chain.
+   */
+  sqe_chain chain(unsigned capacity, bool hard = false) {
+    /* get_sqe keeps one entry free on top. */
+    if (::io_uring_sq_space_left(&ring_) <= capacity) {
+      submit();
+      if (::io_uring_sq_space_left(&ring_) <= capacity) [[unlikely]] {
+        throw std::runtime_error("chain does not fit in the sq");
+      }
+    }
+    return sqe_chain(capacity, hard);
+  }
+
+  /**
+   * @brief Cancel a request by its user_data.
+   *
+   * @param user_data The user_data of the request.
+   * @param flags IORING_ASYNC_CANCEL_* flags, e.g. IORING_ASYNC_CANCEL_ALL to
+   * cancel all requests with this user_data.
+   * @param sqe_flags The flags of the cancel SQE.
+   * @return sqe_awaitable Resolves to 0 if the request was cancelled, -ENOENT
+   * if it was not found and -EALREADY if it is running and was signalled.
+   * With IORING_ASYNC_CANCEL_ALL, to the number of requests cancelled.
+   */
+  sqe_awaitable cancel(uint64_t user_data, int flags = 0,
+                       uint8_t sqe_flags = 0) {
+    require_op<IORING_OP_ASYNC_CANCEL>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_cancel64(sqe, user_data, flags);
+    return await_sqe(sqe, sqe_flags);
+  }
+
+  /**
+   * @brief Cancel an operation awaited by another coroutine, which resumes
+   * with -ECANCELED.
+   *
+   * @param op The awaited operation.
+   * @param sqe_flags The flags of the cancel SQE.
+   * @return sqe_awaitable Resolves to the result of the cancellation, as for
+   * cancel(uint64_t).
+   */
+  sqe_awaitable cancel(sqe_awaitable const &op, uint8_t sqe_flags = 0) {
+    return cancel(
+        detail::make_user_data(&op, detail::user_data_tag::awaitable), 0,
+        sqe_flags);
+  }
+
+  /**
+   * @brief Cancel all requests on a file descriptor (IORING_ASYNC_CANCEL_FD).
+   *
+   * @param fd The file descriptor, or the slot of a direct descriptor.
+   * @param fixed Whether fd is a direct descriptor.
+   * @param sqe_flags The flags of the cancel SQE.
+   * @return sqe_awaitable Resolves to the number of requests cancelled, or a
+   * negated errno.
+   */
+  sqe_awaitable cancel_fd(int fd, bool fixed = false, uint8_t sqe_flags = 0) {
+    require_op<IORING_OP_ASYNC_CANCEL>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_cancel_fd(
+        sqe, fd,
+        IORING_ASYNC_CANCEL_ALL | (fixed ? IORING_ASYNC_CANCEL_FD_FIXED : 0));
+    return await_sqe(sqe, sqe_flags);
+  }
+
+  /**
+   * @brief Schedule a timer on the timer wheel of the loop. All timers of the
+   * loop share a single kernel timeout armed for the earliest of them, with a
+   * resolution of one millisecond. A pending timer is rescheduled.
+   *
+   * @param entry The timer. It must stay alive until it fires or is
+   * cancelled.
+   * @param deadline The time to fire the timer at.
+   */
+  void add_timer(timer_entry *entry,
+                 std::chrono::steady_clock::time_point deadline) {
+    require_op<IORING_OP_TIMEOUT>();
+    if (timers_.empty()) {
+      timers_.advance(timer_now());
+    }
+    timers_.insert(entry, timer_tick(deadline));
+    arm_timer();
+  }
+
+  /**
+   * @brief Cancel a timer of the timer wheel. The kernel timeout is left
+   * armed and fires without effect if no timer is due then.
+   *
+   * @param entry The timer.
+   */
+  void cancel_timer(timer_entry *entry) { timers_.remove(entry); }
+
+  /**
+   * @brief Suspend the awaiting coroutine until a deadline, on the timer
+   * wheel.
+   *
+   * @param deadline The time to resume at.
+   * @return An awaitable which resumes at the deadline.
+   */
+  auto sleep_until(std::chrono::steady_clock::time_point deadline) {
+    struct awaitable : public timer_entry {
+      event_loop *loop_;
+      std::chrono::steady_clock::time_point deadline_;
+      std::coroutine_handle<> h_;
+      awaitable(event_loop *loop,
+                std::chrono::steady_clock::time_point deadline)
+          : loop_(loop), deadline_(deadline) {}
+      bool await_ready() noexcept {
+        return deadline_ <= std::chrono::steady_clock::now();
+      }
+      void await_suspend(std::coroutine_handle<> h) {
+        h_ = h;
+        loop_->add_timer(this, deadline_);
+      }
+      void await_resume() noexcept {}
+      void fire() override { h_.resume(); }
+    };
+    return awaitable{this, deadline};
+  }
+
+  /**
+   * @brief Suspend the awaiting coroutine for a duration, on the timer wheel.
+   *
+   * @param duration The duration to sleep for.
+   * @return An awaitable which resumes after the duration.
+   */
+  template <class Rep, class Period>
+  auto sleep_for(std::chrono::duration<Rep, Period> duration) {
+    return sleep_until(std::chrono::steady_clock::now() + duration);
+  }
+
   sqe_awaitable close(int fd, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_CLOSE));
+    require_op<IORING_OP_CLOSE>();
     auto *sqe = get_sqe();
     ::io_uring_prep_close(sqe, fd);
     return await_sqe(sqe, sqe_flags);
   }
 
   void close_detach(int fd, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_CLOSE));
+    require_op<IORING_OP_CLOSE>();
     auto *sqe = get_sqe();
     ::io_uring_prep_close(sqe, fd);
     ::io_uring_sqe_set_flags(sqe, sqe_flags);
-    ::io_uring_sqe_set_data(sqe, nullptr);
+    ::io_uring_sqe_set_data64(sqe, detail::kDetachedUserData);
+  }
+
+  sqe_awaitable close_direct(unsigned file_index, uint8_t sqe_flags = 0) {
+    require_op<IORING_OP_CLOSE>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_close_direct(sqe, file_index);
+    return await_sqe(sqe, sqe_flags);
+  }
+
+  void close_direct_detach(unsigned file_index, uint8_t sqe_flags = 0) {
+    require_op<IORING_OP_CLOSE>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_close_direct(sqe, file_index);
+    ::io_uring_sqe_set_flags(sqe, sqe_flags);
+    ::io_uring_sqe_set_data64(
+        sqe,
+        detail::make_user_data(file_index, detail::user_data_tag::file_slot));
   }
 
   sqe_awaitable statx(int dfd, const char *path, int flags, unsigned mask,
                       struct statx *statxbuf, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_STATX));
+    require_op<IORING_OP_STATX>();
     auto *sqe = get_sqe();
     ::io_uring_prep_statx(sqe, dfd, path, flags, mask, statxbuf);
     return await_sqe(sqe, sqe_flags);
@@ -291,7 +1561,7 @@ public:
 
   sqe_awaitable splice(int fd_in, loff_t off_in, int fd_out, loff_t off_out,
                        size_t nbytes, unsigned flags, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_SPLICE));
+    require_op<IORING_OP_SPLICE>();
     auto *sqe = get_sqe();
     ::io_uring_prep_splice(sqe, fd_in, off_in, fd_out, off_out, nbytes, flags);
     return await_sqe(sqe, sqe_flags);
@@ -299,14 +1569,16 @@ public:
 
   sqe_awaitable tee(int fd_in, int fd_out, size_t nbytes, unsigned flags,
                     uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_TEE));
+    require_op<IORING_OP_TEE>();
     auto *sqe = get_sqe();
     ::io_uring_prep_tee(sqe, fd_in, fd_out, nbytes, flags);
     return await_sqe(sqe, sqe_flags);
   }
 
   sqe_awaitable shutdown(int fd, int how, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_SHUTDOWN));
+    if (!use_op<IORING_OP_SHUTDOWN>(sqe_flags)) [[unlikely]] {
+      return offload_call([=]() { return ::shutdown(fd, how); });
+    }
     auto *sqe = get_sqe();
     ::io_uring_prep_shutdown(sqe, fd, how);
     return await_sqe(sqe, sqe_flags);
@@ -315,7 +1587,11 @@ public:
   sqe_awaitable renameat(int olddfd, const char *oldpath, int newdfd,
                          const char *newpath, unsigned flags,
                          uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_RENAMEAT));
+    if (!use_op<IORING_OP_RENAMEAT>(sqe_flags)) [[unlikely]] {
+      return offload_call([=]() {
+        return ::renameat2(olddfd, oldpath, newdfd, newpath, flags);
+      });
+    }
     auto *sqe = get_sqe();
     ::io_uring_prep_renameat(sqe, olddfd, oldpath, newdfd, newpath, flags);
     return await_sqe(sqe, sqe_flags);
@@ -323,7 +1599,9 @@ public:
 
   sqe_awaitable mkdirat(int dirfd, const char *pathname, mode_t mode,
                         uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_MKDIRAT));
+    if (!use_op<IORING_OP_MKDIRAT>(sqe_flags)) [[unlikely]] {
+      return offload_call([=]() { return ::mkdirat(dirfd, pathname, mode); });
+    }
     auto *sqe = get_sqe();
     ::io_uring_prep_mkdirat(sqe, dirfd, pathname, mode);
     return await_sqe(sqe, sqe_flags);
@@ -331,7 +1609,10 @@ public:
 
   sqe_awaitable symlinkat(const char *target, int newdirfd,
                           const char *linkpath, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_SYMLINKAT));
+    if (!use_op<IORING_OP_SYMLINKAT>(sqe_flags)) [[unlikely]] {
+      return offload_call(
+          [=]() { return ::symlinkat(target, newdirfd, linkpath); });
+    }
     auto *sqe = get_sqe();
     ::io_uring_prep_symlinkat(sqe, target, newdirfd, linkpath);
     return await_sqe(sqe, sqe_flags);
@@ -339,7 +1620,11 @@ public:
 
   sqe_awaitable linkat(int olddirfd, const char *oldpath, int newdirfd,
                        const char *newpath, int flags, uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_LINKAT));
+    if (!use_op<IORING_OP_LINKAT>(sqe_flags)) [[unlikely]] {
+      return offload_call([=]() {
+        return ::linkat(olddirfd, oldpath, newdirfd, newpath, flags);
+      });
+    }
     auto *sqe = get_sqe();
     ::io_uring_prep_linkat(sqe, olddirfd, oldpath, newdirfd, newpath, flags);
     return await_sqe(sqe, sqe_flags);
@@ -347,7 +1632,9 @@ public:
 
   sqe_awaitable unlinkat(int dfd, const char *path, unsigned flags,
                          uint8_t sqe_flags = 0) {
-    assert(supported_ops_.test(IORING_OP_UNLINKAT));
+    if (!use_op<IORING_OP_UNLINKAT>(sqe_flags)) [[unlikely]] {
+      return offload_call([=]() { return ::unlinkat(dfd, path, flags); });
+    }
     auto *sqe = get_sqe();
     ::io_uring_prep_unlinkat(sqe, dfd, path, flags);
     return await_sqe(sqe, sqe_flags);
@@ -363,6 +1650,50 @@ public:
                  "failed to register files");
   }
 
+  /**
+   * @brief Register a sparse file table owned by the loop, with half of its
+   * slots left to the kernel's allocator.
+   *
+   * @param nr_files The number of slots.
+   * @return fixed_file_table& The registered table.
+   */
+  fixed_file_table &register_files_sparse(unsigned nr_files) {
+    return register_files_sparse(nr_files, nr_files / 2);
+  }
+
+  /**
+   * @brief Register a sparse file table owned by the loop.
+   *
+   * @param nr_files The number of slots.
+   * @param nr_kernel_slots The number of slots at the end of the table left to
+   * the kernel's allocator, e.g. for multishot accept.
+   * @return fixed_file_table& The registered table.
+   */
+  fixed_file_table &register_files_sparse(unsigned nr_files,
+                                          unsigned nr_kernel_slots) {
+    assert(!files_);
+    files_ =
+        std::make_unique<fixed_file_table>(&ring_, nr_files, nr_kernel_slots);
+    return *files_;
+  }
+
+  /**
+   * @brief Check whether the loop owns a registered file table.
+   *
+   * @return true if register_files_sparse was called.
+   */
+  bool has_files() const { return files_ != nullptr; }
+
+  /**
+   * @brief Get the registered file table of the loop.
+   *
+   * @return fixed_file_table& The file table.
+   */
+  fixed_file_table &files() {
+    assert(files_);
+    return *files_;
+  }
+
   int unregister_files() { return ::io_uring_unregister_files(&ring_); }
 
   void register_buffers(struct iovec const *iovecs, unsigned nr_iovecs) {
@@ -374,6 +1705,103 @@ public:
     return ::io_uring_unregister_buffers(&ring_);
   }
 
+  /**
+   * @brief Register a pool of fixed buffers owned by the loop. It takes the
+   * place of register_buffers, which must not be used with a pool.
+   *
+   * @param buffer_size The size of each buffer.
+   * @param nr_buffers The number of buffers.
+   * @param huge_pages Whether to try to back the pool by huge pages.
+   * @return fixed_buffer_pool& The registered pool. It lives as long as the
+   * loop.
+   */
+  fixed_buffer_pool &register_buffer_pool(size_t buffer_size,
+                                          unsigned nr_buffers,
+                                          bool huge_pages = true) {
+    assert(!buffer_pool_);
+    buffer_pool_ = std::make_unique<fixed_buffer_pool>(&ring_, buffer_size,
+                                                       nr_buffers, huge_pages);
+    return *buffer_pool_;
+  }
+
+  /**
+   * @brief Get the pool of fixed buffers of the loop.
+   *
+   * @return fixed_buffer_pool& The pool.
+   */
+  fixed_buffer_pool &buffer_pool() {
+    assert(buffer_pool_);
+    return *buffer_pool_;
+  }
+
+  /**
+   * @brief Register a provided buffer ring owned by the loop. Its buffer group
+   * ID is assigned by the loop.
+   *
+   * @param entries The capacity of the ring. Must be a power of 2.
+   * @param buffer_size The size of each buffer.
+   * @param initial_buffers The number of buffers to allocate upfront. The ring
+   * grows on demand up to its capacity.
+   * @return provided_buffer_ring& The registered ring. It lives as long as the
+   * loop.
+   */
+  provided_buffer_ring &register_buffer_ring(unsigned entries,
+                                             size_t buffer_size,
+                                             unsigned initial_buffers = 0) {
+    auto bgid = static_cast<uint16_t>(buffer_rings_.size());
+    buffer_rings_.push_back(std::make_unique<provided_buffer_ring>(
+        &ring_, bgid, entries, buffer_size, initial_buffers));
+    return *buffer_rings_.back();
+  }
+
+  /**
+   * @brief Submit the SQE of a multishot operation.
+   *
+   * @param op The operation to arm.
+   */
+  void arm_multishot(multishot_operation *op) {
+    auto *sqe = get_sqe();
+    op->prep(sqe);
+    ::io_uring_sqe_set_data64(
+        sqe, detail::make_user_data(op, detail::user_data_tag::multishot));
+    op->armed_ = true;
+    op->parked_ = false;
+  }
+
+  /**
+   * @brief Arm a multishot operation parked by its restart() again. Does
+   * nothing if the operation is not parked or has been released.
+   *
+   * @param op The operation to resume.
+   */
+  void unpark_multishot(multishot_operation *op) {
+    if (op->parked_ && !op->orphaned_) {
+      arm_multishot(op);
+    }
+  }
+
+  /**
+   * @brief Give up ownership of a multishot operation. Queued completions are
+   * discarded. If the operation is still armed it is cancelled and freed once
+   * the kernel posts its last CQE, otherwise it is freed immediately.
+   *
+   * @param op The operation to release.
+   */
+  void release_multishot(multishot_operation *op) {
+    /* Set first, so that buffers recycled by the drain do not unpark it. */
+    op->orphaned_ = true;
+    op->drain();
+    if (!op->armed_) {
+      delete op;
+      return;
+    }
+    require_op<IORING_OP_ASYNC_CANCEL>();
+    auto *sqe = get_sqe();
+    ::io_uring_prep_cancel64(
+        sqe, detail::make_user_data(op, detail::user_data_tag::multishot), 0);
+    ::io_uring_sqe_set_data64(sqe, detail::kDetachedUserData);
+  }
+
   ~event_loop();
 };
 
@@ -383,4 +1811,7 @@ public:
  * \example helloworld.cc
  * Quick example of opening sockets and files and doing some I/O on them.
  *
+ * \example echo_runtime.cc
+ * An echo server running one SO_REUSEPORT listener per core.
+ *
  */
\ No newline at end of file
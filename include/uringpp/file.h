@@ -4,6 +4,7 @@
 #include <utility>
 
 #include "uringpp/awaitable.h"
+#include "uringpp/buffer_pool.h"
 #include "uringpp/dir.h"
 #include "uringpp/error.h"
 #include "uringpp/event_loop.h"
@@ -22,15 +23,43 @@ class file : public noncopyable {
 protected:
   std::shared_ptr<event_loop> loop_;
   int fd_;
+  bool fixed_ = false;
+
+  uint8_t sqe_flags() const { return fixed_ ? IOSQE_FIXED_FILE : 0; }
+  unsigned splice_flags(unsigned flags) const {
+    return fixed_ ? flags | SPLICE_F_FD_IN_FIXED : flags;
+  }
+
+  static task<file> open_direct(std::shared_ptr<event_loop> loop, int dfd,
+                                char const *path, int flags, mode_t mode) {
+    auto slot = loop->files().acquire();
+    int rc = co_await loop->openat_direct(dfd, path, flags, mode, slot);
+    if (rc < 0) [[unlikely]] {
+      loop->files().release(slot);
+      check_nerrno(rc, "failed to open file");
+    }
+    co_return file(loop, slot, true);
+  }
+
+  friend class socket;
 
 public:
   /**
-   * @brief Get the file descriptor of the file.
+   * @brief Get the file descriptor of the file. For a direct descriptor this
+   * is its index in the registered file table.
    *
    * @return int The file descriptor of the file.
    */
   int fd() const { return fd_; }
 
+  /**
+   * @brief Whether the file is a direct descriptor, i.e. it only lives in the
+   * registered file table of the loop.
+   *
+   * @return bool True if the file is a direct descriptor.
+   */
+  bool fixed() const { return fixed_; }
+
   /**
    * @brief Opens a file in the current working directory.
    *
@@ -38,10 +67,15 @@ public:
    * @param path The path to the file.
    * @param flags The flags to use when opening the file.
    * @param mode The mode to use when opening the file.
+   * @param direct Whether to open the file straight into a free slot of the
+   * registered file table. Always set if the loop requires fixed files.
    * @return task<file> The file object.
    */
   static task<file> open(std::shared_ptr<event_loop> loop, char const *path,
-                         int flags, mode_t mode) {
+                         int flags, mode_t mode, bool direct = false) {
+    if (direct || loop->fixed_files_required()) {
+      co_return co_await open_direct(loop, AT_FDCWD, path, flags, mode);
+    }
     int fd = co_await loop->openat(AT_FDCWD, path, flags, mode);
     check_nerrno(fd, "failed to open file");
     co_return file(loop, fd);
@@ -55,10 +89,16 @@ public:
    * @param path The path to the file.
    * @param flags The flags to use when opening the file.
    * @param mode The mode to use when opening the file.
+   * @param direct Whether to open the file straight into a free slot of the
+   * registered file table. Always set if the loop requires fixed files.
    * @return task<file> The file object.
    */
   static task<file> openat(std::shared_ptr<event_loop> loop, dir const &dir,
-                           char const *path, int flags, mode_t mode) {
+                           char const *path, int flags, mode_t mode,
+                           bool direct = false) {
+    if (direct || loop->fixed_files_required()) {
+      co_return co_await open_direct(loop, dir.fd(), path, flags, mode);
+    }
     int fd = co_await loop->openat(dir.fd(), path, flags, mode);
     check_nerrno(fd, "failed to open file");
     co_return file(loop, fd);
@@ -71,10 +111,22 @@ public:
    * @param dir The directory to open the file in.
    * @param path The path to the file.
    * @param how The open_how struct to use when opening the file.
+   * @param direct Whether to open the file straight into a free slot of the
+   * registered file table. Always set if the loop requires fixed files.
    * @return task<file>
    */
   static task<file> openat2(std::shared_ptr<event_loop> loop, dir const &dir,
-                            char const *path, struct open_how *how) {
+                            char const *path, struct open_how *how,
+                            bool direct = false) {
+    if (direct || loop->fixed_files_required()) {
+      auto slot = loop->files().acquire();
+      int rc = co_await loop->openat2_direct(dir.fd(), path, how, slot);
+      if (rc < 0) [[unlikely]] {
+        loop->files().release(slot);
+        check_nerrno(rc, "failed to open file");
+      }
+      co_return file(loop, slot, true);
+    }
     int fd = co_await loop->openat2(dir.fd(), path, how);
     check_nerrno(fd, "failed to open file");
     co_return file(loop, fd);
@@ -86,7 +138,8 @@ public:
    * @param other The file object to move from.
    */
   file(file &&other) noexcept
-      : loop_(std::move(other.loop_)), fd_(std::exchange(other.fd_, -1)) {}
+      : loop_(std::move(other.loop_)), fd_(std::exchange(other.fd_, -1)),
+        fixed_(other.fixed_) {}
 
   /**
    * @brief Construct a new file object using the given event loop and file
@@ -96,13 +149,36 @@ public:
    */
   file(std::shared_ptr<event_loop> loop, int fd) : loop_(loop), fd_(fd) {}
 
+  /**
+   * @brief Construct a new file object from a file descriptor or a direct
+   * descriptor. Operations on a direct descriptor are submitted with
+   * IOSQE_FIXED_FILE.
+   *
+   * @param loop The event loop.
+   * @param fd The file descriptor, or the index in the registered file table.
+   * @param fixed Whether fd is a direct descriptor.
+   */
+  file(std::shared_ptr<event_loop> loop, int fd, bool fixed)
+      : loop_(loop), fd_(fd), fixed_(fixed) {}
+
+  /**
+   * @brief Give up the ownership of the file descriptor, which is then not
+   * closed by the file object.
+   *
+   * @return int The file descriptor.
+   */
+  int release() { return std::exchange(fd_, -1); }
+
   /**
    * @brief Close the file.
    *
    * @return task<void>
    */
   task<void> close() {
-    if (fd_ > 0) {
+    if (fixed_ && fd_ >= 0) {
+      co_await loop_->close_direct(fd_);
+      loop_->files().release(std::exchange(fd_, -1));
+    } else if (fd_ > 0) {
       co_await loop_->close(fd_);
       fd_ = -1;
     }
@@ -110,10 +186,13 @@ public:
 
   /**
    * @brief Destroy the file object. If the fd is still open, it will be closed.
+   * The slot of a direct descriptor is freed once it is closed.
    *
    */
   ~file() {
-    if (fd_ > 0) {
+    if (fixed_ && fd_ >= 0) {
+      loop_->close_direct_detach(fd_);
+    } else if (fd_ > 0) {
       loop_->close_detach(fd_);
     }
   }
@@ -127,7 +206,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable read(void *buf, size_t count, off_t offset = 0) {
-    return loop_->read(fd_, buf, count, offset);
+    return loop_->read(fd_, buf, count, offset, sqe_flags());
   }
 
   /**
@@ -139,7 +218,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable write(void const *buf, size_t count, off_t offset = 0) {
-    return loop_->write(fd_, buf, count, offset);
+    return loop_->write(fd_, buf, count, offset, sqe_flags());
   }
 
   /**
@@ -151,7 +230,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable readv(struct iovec const *iov, int iovcnt, off_t offset = 0) {
-    return loop_->readv(fd_, iov, iovcnt, offset);
+    return loop_->readv(fd_, iov, iovcnt, offset, sqe_flags());
   }
 
   /**
@@ -163,7 +242,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable writev(struct iovec const *iov, int iovcnt, off_t offset = 0) {
-    return loop_->writev(fd_, iov, iovcnt, offset);
+    return loop_->writev(fd_, iov, iovcnt, offset, sqe_flags());
   }
 
   /**
@@ -177,7 +256,7 @@ public:
    */
   sqe_awaitable read_fixed(void *buf, size_t count, off_t offset,
                            int buf_index) {
-    return loop_->read_fixed(fd_, buf, count, offset, buf_index);
+    return loop_->read_fixed(fd_, buf, count, offset, buf_index, sqe_flags());
   }
 
   /**
@@ -191,7 +270,34 @@ public:
    */
   sqe_awaitable write_fixed(void const *buf, size_t count, off_t offset,
                             int buf_index) {
-    return loop_->write_fixed(fd_, buf, count, offset, buf_index);
+    return loop_->write_fixed(fd_, buf, count, offset, buf_index,
+                              sqe_flags());
+  }
+
+  /**
+   * @brief Fill a leased fixed buffer with data from the file.
+   *
+   * @param buf The leased buffer to read into.
+   * @param offset The offset to start reading from.
+   * @return sqe_awaitable
+   */
+  sqe_awaitable read_fixed(fixed_buffer &buf, off_t offset) {
+    return loop_->read_fixed(fd_, buf.data(), buf.size(), offset, buf.index(),
+                             sqe_flags());
+  }
+
+  /**
+   * @brief Write data from a leased fixed buffer to the file.
+   *
+   * @param buf The leased buffer to write from.
+   * @param count The number of bytes to write.
+   * @param offset The offset to start writing from.
+   * @return sqe_awaitable
+   */
+  sqe_awaitable write_fixed(fixed_buffer const &buf, size_t count,
+                            off_t offset) {
+    return loop_->write_fixed(fd_, buf.data(), count, offset, buf.index(),
+                              sqe_flags());
   }
 
   /**
@@ -200,7 +306,9 @@ public:
    * @param flags The flags to use when flushing the file.
    * @return sqe_awaitable
    */
-  sqe_awaitable fsync(int flags) { return loop_->fsync(fd_, flags); }
+  sqe_awaitable fsync(int flags) {
+    return loop_->fsync(fd_, flags, sqe_flags());
+  }
 
   /**
    * @brief Asynchronously flush a range of the file.
@@ -212,7 +320,22 @@ public:
    */
   sqe_awaitable sync_file_range(off_t offset, off_t nbytes,
                                 unsigned sync_range_flags) {
-    return loop_->sync_file_range(fd_, offset, nbytes, sync_range_flags);
+    return loop_->sync_file_range(fd_, offset, nbytes, sync_range_flags,
+                                  sqe_flags());
+  }
+
+  /**
+   * @brief Asynchronously announce an access pattern for a range of the file,
+   * e.g. POSIX_FADV_WILLNEED to start reading it ahead.
+   *
+   * @param offset The offset of the range.
+   * @param len The length of the range, or 0 for the rest of the file. Only
+   * the low 32 bits are passed to the kernel.
+   * @param advice The POSIX_FADV_* advice.
+   * @return sqe_awaitable
+   */
+  sqe_awaitable fadvise(off_t offset, off_t len, int advice) {
+    return loop_->fadvise(fd_, offset, len, advice, sqe_flags());
   }
 
   /**
@@ -224,7 +347,8 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable tee(file const &out, size_t count, unsigned int flags) {
-    return loop_->tee(fd_, out.fd(), count, flags);
+    return loop_->tee(fd_, out.fd(), count, splice_flags(flags),
+                      out.sqe_flags());
   }
 
   /**
@@ -236,13 +360,15 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable tee(socket const &out, size_t count, unsigned int flags) {
-    return loop_->tee(fd_, out.fd(), count, flags);
+    return loop_->tee(fd_, out.fd(), count, splice_flags(flags),
+                      out.sqe_flags());
   }
 
   /**
    * @brief Splice data from the file to a pipe.
    *
-   * @param off_in The offset to start splicing from.
+   * @param off_in The offset to start splicing from, or -1 for the file
+   * position.
    * @param nbytes The number of bytes to splice.
    * @param out The pipe to splice data to.
    * @param flags The flags to use when splicing the data.
@@ -250,13 +376,15 @@ public:
    */
   sqe_awaitable splice_to(loff_t off_in, size_t nbytes, pipe const &out,
                           unsigned flags) {
-    return loop_->splice(fd_, off_in, out.writable_fd(), 0, nbytes, flags);
+    return loop_->splice(fd_, off_in, out.writable_fd(), -1, nbytes,
+                         splice_flags(flags), out.sqe_flags());
   }
 
   /**
    * @brief Splice data from a pipe to the file.
    *
-   * @param off_out The offset to start splicing to.
+   * @param off_out The offset to start splicing to, or -1 for the file
+   * position.
    * @param in The pipe to splice data from.
    * @param nbytes The number of bytes to splice.
    * @param flags The flags to use when splicing the data.
@@ -264,8 +392,15 @@ public:
    */
   sqe_awaitable splice_from(pipe const &in, loff_t off_out, size_t nbytes,
                             unsigned flags) {
-    return loop_->splice(in.readable_fd(), 0, fd_, off_out, nbytes, flags);
+    return loop_->splice(in.readable_fd(), -1, fd_, off_out, nbytes,
+                         in.splice_flags(flags), sqe_flags());
   }
 };
 
+inline sqe_awaitable socket::tee(file const &out, size_t count,
+                                 unsigned int flags) {
+  return loop_->tee(fd_, out.fd(), count, splice_flags(flags),
+                    out.sqe_flags());
+}
+
 } // namespace uringpp
\ No newline at end of file
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <liburing.h>
+#include <vector>
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief A sparse registered file table (IORING_REGISTER_FILES_SPARSE).
+ * Operations on a direct descriptor submitted with IOSQE_FIXED_FILE skip the
+ * fdget/fdput of the process file table and its lock.
+ *
+ * The table is split in two ranges. Slots below kernel_offset() are handed
+ * out by a free-list for ops taking an explicit slot, e.g. openat_direct. The
+ * remaining slots are the kernel's allocation range
+ * (IORING_REGISTER_FILE_ALLOC_RANGE), used by ops which can only let the
+ * kernel pick a slot, e.g. multishot accept. The kernel reclaims its slots when
+ * they are closed.
+ */
+class fixed_file_table : public noncopyable {
+  struct io_uring *ring_;
+  unsigned size_;
+  unsigned kernel_offset_;
+  std::vector<unsigned> free_slots_;
+
+public:
+  /**
+   * @brief Register a new sparse file table.
+   *
+   * @param ring The io_uring to register with.
+   * @param size The number of slots.
+   * @param kernel_slots The number of slots at the end of the table left to
+   * the kernel's allocator.
+   */
+  fixed_file_table(struct io_uring *ring, unsigned size, unsigned kernel_slots);
+
+  /**
+   * @brief Unregister the table, closing all direct descriptors.
+   *
+   */
+  ~fixed_file_table();
+
+  /**
+   * @brief Get the number of slots.
+   *
+   * @return unsigned The number of slots.
+   */
+  unsigned size() const { return size_; }
+
+  /**
+   * @brief Get the first slot of the kernel's allocation range.
+   *
+   * @return unsigned The first slot allocated by the kernel.
+   */
+  unsigned kernel_offset() const { return kernel_offset_; }
+
+  /**
+   * @brief Get the number of free slots in the free-list.
+   *
+   * @return unsigned The number of free slots.
+   */
+  unsigned available() const { return free_slots_.size(); }
+
+  /**
+   * @brief Take a slot from the free-list.
+   *
+   * @return int The slot, or -1 if no slot is free.
+   */
+  int allocate() noexcept {
+    if (free_slots_.empty()) [[unlikely]] {
+      return -1;
+    }
+    auto slot = free_slots_.back();
+    free_slots_.pop_back();
+    return slot;
+  }
+
+  /**
+   * @brief Take a slot from the free-list.
+   *
+   * @return unsigned The slot. Throws if no slot is free.
+   */
+  unsigned acquire();
+
+  /**
+   * @brief Return a slot to the free-list once its descriptor is closed. Slots
+   * of the kernel's allocation range are ignored.
+   *
+   * @param slot The slot.
+   */
+  void release(unsigned slot) {
+    if (slot < kernel_offset_) {
+      free_slots_.push_back(slot);
+    }
+  }
+
+  /**
+   * @brief Install a file descriptor into a free slot. The table holds its own
+   * reference, so the descriptor may be closed afterwards.
+   *
+   * @param fd The file descriptor.
+   * @return unsigned The slot.
+   */
+  unsigned install(int fd);
+};
+
+} // namespace uringpp
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace uringpp {
+
+/**
+ * @brief A custom allocator for coroutine frames. Frames may be freed on a
+ * different thread than the one they were allocated on, e.g. after a task has
+ * moved to another loop.
+ *
+ */
+struct frame_allocator {
+  void *(*allocate)(size_t size, void *context);
+  void (*deallocate)(void *ptr, size_t size, void *context);
+  void *context;
+};
+
+namespace detail {
+
+inline void close_thread_frame_pool_at_exit() noexcept;
+
+/**
+ * @brief A thread-local cache of coroutine frames, bucketed by size class.
+ * Blocks are allocated from the global heap one by one, so a frame can be
+ * returned to any thread's pool.
+ *
+ * The pool is trivially destructible, so it can still be used by the
+ * destructors of other thread-local objects. Its blocks are freed at thread
+ * exit by close(), after which frames go back to the heap.
+ *
+ */
+class frame_pool {
+  struct free_block {
+    free_block *next;
+  };
+
+  static constexpr size_t kGranularity = 64;
+  static constexpr size_t kClasses = 16;
+  static constexpr size_t kMaxCachedPerClass = 1024;
+
+  free_block *free_lists_[kClasses] = {};
+  size_t cached_[kClasses] = {};
+  bool registered_ = false;
+  bool closed_ = false;
+
+  static size_t size_class(size_t size) {
+    return (size + kGranularity - 1) / kGranularity - 1;
+  }
+
+public:
+  static constexpr size_t kMaxPooledSize = kGranularity * kClasses;
+
+  void *allocate(size_t size) {
+    if (size > kMaxPooledSize) [[unlikely]] {
+      return ::operator new(size);
+    }
+    auto cls = size_class(size);
+    if (auto block = free_lists_[cls]; block != nullptr) [[likely]] {
+      free_lists_[cls] = block->next;
+      --cached_[cls];
+      return block;
+    }
+    return ::operator new((cls + 1) * kGranularity);
+  }
+
+  void deallocate(void *ptr, size_t size) noexcept {
+    if (size > kMaxPooledSize) [[unlikely]] {
+      ::operator delete(ptr);
+      return;
+    }
+    auto cls = size_class(size);
+    if (cached_[cls] >= kMaxCachedPerClass || closed_) [[unlikely]] {
+      ::operator delete(ptr);
+      return;
+    }
+    if (!registered_) [[unlikely]] {
+      registered_ = true;
+      close_thread_frame_pool_at_exit();
+    }
+    auto block = static_cast<free_block *>(ptr);
+    block->next = free_lists_[cls];
+    free_lists_[cls] = block;
+    ++cached_[cls];
+  }
+
+  /**
+   * @brief Free the cached blocks and stop caching.
+   *
+   */
+  void close() noexcept {
+    closed_ = true;
+    for (auto &block : free_lists_) {
+      while (block != nullptr) {
+        ::operator delete(std::exchange(block, block->next));
+      }
+    }
+  }
+};
+
+static_assert(std::is_trivially_destructible_v<frame_pool>);
+
+inline thread_local frame_pool thread_frame_pool;
+
+/* Registered on the first cached frame, so that thread-local objects created
+ * later are destroyed first and those created earlier free to the heap. */
+struct frame_pool_closer {
+  ~frame_pool_closer() { thread_frame_pool.close(); }
+};
+
+inline void close_thread_frame_pool_at_exit() noexcept {
+  static thread_local frame_pool_closer closer;
+  (void)closer;
+}
+inline frame_allocator const *custom_frame_allocator = nullptr;
+
+} // namespace detail
+
+/**
+ * @brief Replace the frame pool with a custom allocator for all coroutine
+ * frames. It must be set before any task is created and outlive all tasks.
+ *
+ * @param allocator The allocator to use, or nullptr to use the frame pool.
+ */
+inline void set_frame_allocator(frame_allocator const *allocator) {
+  detail::custom_frame_allocator = allocator;
+}
+
+/**
+ * @brief Base of promise types whose coroutine frames are allocated from the
+ * thread-local frame pool or the custom frame allocator.
+ *
+ */
+struct pooled_frame {
+  static void *operator new(size_t size) {
+    if (auto allocator = detail::custom_frame_allocator) [[unlikely]] {
+      return allocator->allocate(size, allocator->context);
+    }
+    return detail::thread_frame_pool.allocate(size);
+  }
+
+  static void operator delete(void *ptr, size_t size) noexcept {
+    if (auto allocator = detail::custom_frame_allocator) [[unlikely]] {
+      allocator->deallocate(ptr, size, allocator->context);
+      return;
+    }
+    detail::thread_frame_pool.deallocate(ptr, size);
+  }
+};
+
+} // namespace uringpp
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cassert>
+#include <coroutine>
+#include <utility>
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief Caps the number of operations in flight, e.g. per device, so that a
+ * burst of coroutines does not submit thousands of requests to a device which
+ * performs best at a much lower queue depth. Coroutines beyond the depth wait
+ * in FIFO order and are admitted as earlier operations complete.
+ *
+ * A queue belongs to a single loop; it is not synchronized.
+ */
+class io_queue : public noncopyable {
+  struct waiter {
+    waiter *next_;
+    std::coroutine_handle<> h_;
+  };
+
+  unsigned depth_;
+  unsigned in_flight_ = 0;
+  unsigned waiting_ = 0;
+  waiter *head_ = nullptr;
+  waiter *tail_ = nullptr;
+
+  void admit_waiters() {
+    while (head_ != nullptr && in_flight_ < depth_) {
+      auto w = std::exchange(head_, head_->next_);
+      if (head_ == nullptr) {
+        tail_ = nullptr;
+      }
+      --waiting_;
+      ++in_flight_;
+      w->h_.resume();
+    }
+  }
+
+public:
+  /**
+   * @brief A slot of the queue, given back when destroyed. The operation it
+   * admits must be submitted while the permit is held.
+   *
+   */
+  class permit : public noncopyable {
+    io_queue *queue_;
+
+  public:
+    explicit permit(io_queue *queue) : queue_(queue) {}
+
+    permit(permit &&other) noexcept
+        : queue_(std::exchange(other.queue_, nullptr)) {}
+
+    /**
+     * @brief Give the slot back before destruction, admitting the next
+     * waiter.
+     *
+     */
+    void release() {
+      if (queue_ != nullptr) {
+        std::exchange(queue_, nullptr)->release();
+      }
+    }
+
+    ~permit() { release(); }
+  };
+
+  /**
+   * @brief Construct a new io queue object
+   *
+   * @param depth The maximum number of operations in flight.
+   */
+  explicit io_queue(unsigned depth) : depth_(depth) { assert(depth > 0); }
+
+  /**
+   * @brief Get the maximum number of operations in flight.
+   *
+   * @return unsigned The queue depth.
+   */
+  unsigned depth() const { return depth_; }
+
+  /**
+   * @brief Change the maximum number of operations in flight. Operations
+   * already in flight above a lower depth are not affected.
+   *
+   * @param depth The queue depth.
+   */
+  void set_depth(unsigned depth) {
+    assert(depth > 0);
+    depth_ = depth;
+    admit_waiters();
+  }
+
+  /**
+   * @brief Get the number of operations in flight.
+   *
+   * @return unsigned The number of permits held.
+   */
+  unsigned in_flight() const { return in_flight_; }
+
+  /**
+   * @brief Get the number of coroutines waiting for a permit.
+   *
+   * @return unsigned The number of waiters.
+   */
+  unsigned waiting() const { return waiting_; }
+
+  /**
+   * @brief Wait for a slot of the queue.
+   *
+   * @return An awaitable resolving to the permit. It does not suspend if the
+   * queue has room and nobody is waiting.
+   */
+  auto acquire() {
+    struct awaitable {
+      io_queue *queue_;
+      waiter waiter_;
+      bool await_ready() noexcept {
+        if (queue_->head_ == nullptr && queue_->in_flight_ < queue_->depth_) {
+          ++queue_->in_flight_;
+          return true;
+        }
+        return false;
+      }
+      void await_suspend(std::coroutine_handle<> h) noexcept {
+        waiter_ = {nullptr, h};
+        if (queue_->tail_ != nullptr) {
+          queue_->tail_->next_ = &waiter_;
+        } else {
+          queue_->head_ = &waiter_;
+        }
+        queue_->tail_ = &waiter_;
+        ++queue_->waiting_;
+      }
+      permit await_resume() noexcept { return permit(queue_); }
+    };
+    return awaitable{this, {}};
+  }
+
+  /**
+   * @brief Give a slot back, admitting the next waiter. Prefer letting a
+   * permit go out of scope.
+   *
+   */
+  void release() {
+    assert(in_flight_ > 0);
+    --in_flight_;
+    admit_waiters();
+  }
+};
+
+} // namespace uringpp
@@ -17,20 +17,34 @@ static inline void *get_in_addr(struct sockaddr *sa) {
   return &(((struct sockaddr_in6 *)sa)->sin6_addr);
 }
 
-static inline uint16_t get_in_port(struct sockaddr *sa) {
+static inline uint16_t get_in_port(struct sockaddr const *sa) {
   if (sa->sa_family == AF_INET) {
-    return (((struct sockaddr_in *)sa)->sin_port);
+    return (((struct sockaddr_in const *)sa)->sin_port);
   }
 
-  return (((struct sockaddr_in6 *)sa)->sin6_port);
+  return (((struct sockaddr_in6 const *)sa)->sin6_port);
+}
+
+static inline void set_in_port(struct sockaddr *sa, uint16_t port) {
+  if (sa->sa_family == AF_INET) {
+    ((struct sockaddr_in *)sa)->sin_port = port;
+  } else {
+    ((struct sockaddr_in6 *)sa)->sin6_port = port;
+  }
+}
+
+static inline std::string get_in_addr_string(struct addrinfo *ai) {
+  char s[INET6_ADDRSTRLEN];
+  inet_ntop(ai->ai_family, get_in_addr(ai->ai_addr), s, sizeof(s));
+  return s;
 }
 
 class ip_address {
 public:
   struct sockaddr_storage ss_;
   socklen_t len_ = sizeof(ss_);
-  uint16_t port() {
-    return get_in_port(reinterpret_cast<struct sockaddr *>(&ss_));
+  uint16_t port() const {
+    return get_in_port(reinterpret_cast<struct sockaddr const *>(&ss_));
   }
   std::string ip() {
     char s[INET6_ADDRSTRLEN];
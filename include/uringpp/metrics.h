@@ -0,0 +1,268 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <liburing.h>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief The counts of a latency_histogram at some point in time.
+ *
+ */
+struct histogram_snapshot {
+  static constexpr unsigned kSubBucketBits = 3;
+  static constexpr unsigned kSubBuckets = 1 << kSubBucketBits;
+  static constexpr unsigned kMaxBits = 40;
+  static constexpr unsigned kBuckets =
+      (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+  std::array<uint64_t, kBuckets> counts{};
+  uint64_t total = 0;
+  uint64_t sum = 0;
+
+  /**
+   * @brief Get the bucket holding a value. Values of kMaxBits bits or more
+   * share the last bucket.
+   *
+   * @param value The value.
+   * @return unsigned The index of the bucket.
+   */
+  static unsigned bucket_of(uint64_t value) {
+    if (value < kSubBuckets) {
+      return value;
+    }
+    unsigned bits = 64 - std::countl_zero(value);
+    if (bits > kMaxBits) [[unlikely]] {
+      return kBuckets - 1;
+    }
+    unsigned shift = bits - kSubBucketBits - 1;
+    return (shift + 1) * kSubBuckets +
+           ((value >> shift) & (kSubBuckets - 1));
+  }
+
+  /**
+   * @brief Get the smallest value of a bucket.
+   *
+   * @param bucket The index of the bucket.
+   * @return uint64_t The smallest value held by the bucket.
+   */
+  static uint64_t lower_bound(unsigned bucket) {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    unsigned shift = bucket / kSubBuckets - 1;
+    return static_cast<uint64_t>(kSubBuckets + bucket % kSubBuckets) << shift;
+  }
+
+  /**
+   * @brief Estimate a quantile.
+   *
+   * @param q The quantile, between 0 and 1.
+   * @return uint64_t The lower bound of the bucket holding the quantile, or 0
+   * if nothing was recorded.
+   */
+  uint64_t quantile(double q) const {
+    if (total == 0) {
+      return 0;
+    }
+    auto rank = static_cast<uint64_t>(q * (total - 1));
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < kBuckets; ++b) {
+      seen += counts[b];
+      if (seen > rank) {
+        return lower_bound(b);
+      }
+    }
+    return lower_bound(kBuckets - 1);
+  }
+};
+
+/**
+ * @brief A log-linear histogram in the style of HdrHistogram. Values are
+ * grouped by their highest set bit, and each group is split into
+ * kSubBuckets linear buckets, so a value is reported at most 1/kSubBuckets
+ * below its true value. Only one thread may record, without locks or atomic
+ * read-modify-writes; any thread may take a snapshot.
+ *
+ */
+class latency_histogram : public noncopyable {
+  std::array<std::atomic<uint64_t>, histogram_snapshot::kBuckets> counts_{};
+  std::atomic<uint64_t> total_ = 0;
+  std::atomic<uint64_t> sum_ = 0;
+
+  static void bump(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+public:
+  /**
+   * @brief Record a value. Must only be called by the owning thread.
+   *
+   * @param value The value.
+   */
+  void record(uint64_t value) {
+    bump(counts_[histogram_snapshot::bucket_of(value)], 1);
+    bump(total_, 1);
+    bump(sum_, value);
+  }
+
+  /**
+   * @brief Copy the counts. Safe to call from any thread; counts recorded
+   * meanwhile may be partially included.
+   *
+   * @return histogram_snapshot The counts.
+   */
+  histogram_snapshot snapshot() const {
+    histogram_snapshot s;
+    for (unsigned b = 0; b < histogram_snapshot::kBuckets; ++b) {
+      s.counts[b] = counts_[b].load(std::memory_order_relaxed);
+    }
+    s.total = total_.load(std::memory_order_relaxed);
+    s.sum = sum_.load(std::memory_order_relaxed);
+    return s;
+  }
+};
+
+/**
+ * @brief The metrics of a loop at some point in time. All fields are zero
+ * unless the library is built with URINGPP_METRICS.
+ *
+ */
+struct metrics_snapshot {
+  /** @brief Whether metrics are collected. */
+  bool enabled = false;
+  /** @brief The number of SQEs submitted, by opcode. */
+  std::array<uint64_t, IORING_OP_LAST> sqes_by_op{};
+  /** @brief The number of submissions carrying SQEs. */
+  uint64_t submits = 0;
+  /** @brief The number of io_uring_enter calls made to submit or wait. */
+  uint64_t enters = 0;
+  /** @brief The number of times get_sqe() found the SQ full and submitted. */
+  uint64_t sq_full = 0;
+  /** @brief The number of completion passes which found CQEs. */
+  uint64_t wakeups = 0;
+  /** @brief The number of CQEs processed. */
+  uint64_t cqes = 0;
+  /** @brief The number of CQEs the kernel dropped on a full CQ. */
+  uint64_t cq_overflow = 0;
+  /** @brief The number of CQEs processed per wakeup. */
+  histogram_snapshot cqes_per_wakeup;
+  /**
+   * @brief The latency of awaited ops in nanoseconds, from suspension to the
+   * completion pass, by opcode. Only ops that were awaited have a histogram.
+   */
+  std::array<std::unique_ptr<histogram_snapshot>, IORING_OP_LAST> latency_ns;
+
+  /**
+   * @brief Format the metrics in the Prometheus text exposition format.
+   * Counters are labelled by opcode number and latencies are exported as
+   * summaries in seconds.
+   *
+   * @param prefix The prefix of the metric names.
+   * @param labels Extra labels added to every sample, e.g. loop="0".
+   * @return std::string The metrics.
+   */
+  std::string to_prometheus(std::string_view prefix = "uringpp",
+                            std::string_view labels = {}) const;
+};
+
+namespace detail {
+
+static inline uint64_t monotonic_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief The counters a loop updates when built with URINGPP_METRICS. They
+ * are only written by the loop thread and may be read from any thread.
+ *
+ */
+class loop_metrics : public noncopyable {
+  std::array<std::atomic<uint64_t>, IORING_OP_LAST> sqes_by_op_{};
+  std::atomic<uint64_t> submits_ = 0;
+  std::atomic<uint64_t> enters_ = 0;
+  std::atomic<uint64_t> sq_full_ = 0;
+  std::atomic<uint64_t> wakeups_ = 0;
+  std::atomic<uint64_t> cqes_ = 0;
+  latency_histogram cqes_per_wakeup_;
+  /* Allocated on first use, as most loops only use a few opcodes. */
+  std::array<std::atomic<latency_histogram *>, IORING_OP_LAST> latency_{};
+
+  static void bump(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+public:
+  loop_metrics() = default;
+
+  ~loop_metrics() {
+    for (auto &h : latency_) {
+      delete h.load(std::memory_order_relaxed);
+    }
+  }
+
+  void on_sqe(uint8_t opcode) {
+    if (opcode < IORING_OP_LAST) [[likely]] {
+      bump(sqes_by_op_[opcode]);
+    }
+  }
+
+  void on_submit() { bump(submits_); }
+
+  void on_enter() { bump(enters_); }
+
+  void on_sq_full() { bump(sq_full_); }
+
+  void on_wakeup(unsigned nr_cqes) {
+    bump(wakeups_);
+    bump(cqes_, nr_cqes);
+    cqes_per_wakeup_.record(nr_cqes);
+  }
+
+  void on_complete(uint8_t opcode, uint64_t latency_ns) {
+    if (opcode >= IORING_OP_LAST) [[unlikely]] {
+      return;
+    }
+    auto h = latency_[opcode].load(std::memory_order_relaxed);
+    if (h == nullptr) [[unlikely]] {
+      h = new latency_histogram;
+      latency_[opcode].store(h, std::memory_order_release);
+    }
+    h->record(latency_ns);
+  }
+
+  void snapshot(metrics_snapshot &s) const {
+    s.enabled = true;
+    for (unsigned op = 0; op < IORING_OP_LAST; ++op) {
+      s.sqes_by_op[op] = sqes_by_op_[op].load(std::memory_order_relaxed);
+      if (auto h = latency_[op].load(std::memory_order_acquire);
+          h != nullptr) {
+        s.latency_ns[op] = std::make_unique<histogram_snapshot>(h->snapshot());
+      }
+    }
+    s.submits = submits_.load(std::memory_order_relaxed);
+    s.enters = enters_.load(std::memory_order_relaxed);
+    s.sq_full = sq_full_.load(std::memory_order_relaxed);
+    s.wakeups = wakeups_.load(std::memory_order_relaxed);
+    s.cqes = cqes_.load(std::memory_order_relaxed);
+    s.cqes_per_wakeup = cqes_per_wakeup_.snapshot();
+  }
+};
+
+} // namespace detail
+
+} // namespace uringpp
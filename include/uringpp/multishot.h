@@ -0,0 +1,128 @@
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <liburing.h>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief The result and flags of a single CQE.
+ *
+ */
+struct completion {
+  int res;
+  uint32_t flags;
+};
+
+/**
+ * @brief An operation which keeps a single multishot SQE armed and receives
+ * many CQEs from it. Completions which arrive while nobody is waiting are
+ * queued until the next call to next().
+ *
+ * Operations are heap allocated and owned by the event loop once released, as
+ * the kernel may still post CQEs for them until the cancellation completes.
+ */
+class multishot_operation : public noncopyable {
+  friend class event_loop;
+  std::vector<completion> completions_;
+  size_t head_ = 0;
+  std::coroutine_handle<> h_;
+  bool armed_ = false;
+  bool parked_ = false;
+  bool orphaned_ = false;
+
+  void deliver(int res, uint32_t flags) {
+    completions_.push_back({res, flags});
+    if (h_) {
+      std::exchange(h_, nullptr).resume();
+    }
+  }
+
+  std::optional<completion> pop() {
+    if (head_ == completions_.size()) {
+      return std::nullopt;
+    }
+    auto c = completions_[head_++];
+    if (head_ == completions_.size()) {
+      completions_.clear();
+      head_ = 0;
+    }
+    return c;
+  }
+
+  void drain() {
+    while (auto c = pop()) {
+      discard(c->res, c->flags);
+    }
+  }
+
+protected:
+  /**
+   * @brief Prepare the multishot SQE. Called every time the operation is
+   * (re-)armed.
+   *
+   * @param sqe The SQE to prepare.
+   */
+  virtual void prep(struct io_uring_sqe *sqe) = 0;
+
+  /**
+   * @brief Decide whether to re-arm after the kernel terminated the request.
+   * A terminating error for which this returns true is not delivered.
+   *
+   * @param res The result of the terminating CQE.
+   * @return true if the operation should be armed again.
+   */
+  virtual bool restart(int res) { return res >= 0; }
+
+  /**
+   * @brief Keep the operation pending without re-arming it, e.g. until
+   * buffers are available again. Called from restart(), which then returns
+   * true. The operation is armed again by event_loop::unpark_multishot().
+   *
+   */
+  void park() { parked_ = true; }
+
+  /**
+   * @brief Release the resources carried by a completion nobody will consume,
+   * e.g. a provided buffer or an accepted file descriptor.
+   *
+   * @param res The result of the CQE.
+   * @param flags The flags of the CQE.
+   */
+  virtual void discard(int, uint32_t) {}
+
+public:
+  struct completion_awaitable {
+    multishot_operation *op_;
+    bool await_ready() noexcept {
+      return op_->head_ != op_->completions_.size() ||
+             !(op_->armed_ || op_->parked_);
+    }
+    void await_suspend(std::coroutine_handle<> h) noexcept { op_->h_ = h; }
+    std::optional<completion> await_resume() noexcept { return op_->pop(); }
+  };
+
+  /**
+   * @brief Whether the kernel may still post completions for the operation.
+   *
+   */
+  bool armed() const { return armed_; }
+
+  /**
+   * @brief Wait for the next completion.
+   *
+   * @return completion_awaitable Resolves to std::nullopt once the operation
+   * has terminated and all of its completions have been consumed.
+   */
+  completion_awaitable next() { return completion_awaitable{this}; }
+
+  virtual ~multishot_operation() = default;
+};
+
+} // namespace uringpp
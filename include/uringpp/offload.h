@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "uringpp/event_loop.h"
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief A pool of threads running blocking system calls that have no
+ * io_uring op, such as getdents64, so that they do not stall a loop.
+ *
+ */
+class offload_pool : public noncopyable {
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<std::function<void()>> jobs_;
+  std::vector<std::thread> threads_;
+  bool stopped_ = false;
+
+  void work() {
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock lock(mutex_);
+        ready_.wait(lock, [this]() { return stopped_ || !jobs_.empty(); });
+        if (jobs_.empty()) {
+          return;
+        }
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      job();
+    }
+  }
+
+public:
+  /**
+   * @brief Start a new offload pool.
+   *
+   * @param nr_threads The number of threads.
+   */
+  explicit offload_pool(unsigned nr_threads) {
+    for (unsigned i = 0; i < std::max(nr_threads, 1u); ++i) {
+      threads_.emplace_back([this]() { work(); });
+    }
+  }
+
+  /**
+   * @brief Run the queued jobs and join the threads.
+   *
+   */
+  ~offload_pool() {
+    {
+      std::lock_guard lock(mutex_);
+      stopped_ = true;
+    }
+    ready_.notify_all();
+    for (auto &thread : threads_) {
+      thread.join();
+    }
+  }
+
+  /**
+   * @brief Get the pool shared by the process, started on first use with
+   * four threads.
+   *
+   * @return offload_pool& The shared pool.
+   */
+  static offload_pool &shared() {
+    static offload_pool pool(4);
+    return pool;
+  }
+
+  /**
+   * @brief Queue a job. Safe to call from any thread.
+   *
+   * @param job The job, run on a thread of the pool.
+   */
+  void submit(std::function<void()> job) {
+    {
+      std::lock_guard lock(mutex_);
+      jobs_.push_back(std::move(job));
+    }
+    ready_.notify_one();
+  }
+
+  /**
+   * @brief Run a blocking call on the pool and resume the awaiting coroutine
+   * on the loop with its result, through event_loop::post.
+   *
+   * @param loop The loop to resume on.
+   * @param f The call, which must not touch the state of the loop.
+   * @return An awaitable resolving to the result of f. An exception thrown by
+   * f is rethrown.
+   */
+  template <class F> auto run(event_loop &loop, F f) {
+    using result_type = std::invoke_result_t<F &>;
+    struct awaitable {
+      offload_pool *pool_;
+      F f_;
+      event_loop::message m_;
+      std::conditional_t<std::is_void_v<result_type>, bool, result_type>
+          result_;
+      std::exception_ptr error_;
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        m_.h_ = h;
+        pool_->submit([this]() {
+          try {
+            if constexpr (std::is_void_v<result_type>) {
+              f_();
+            } else {
+              result_ = f_();
+            }
+          } catch (...) {
+            error_ = std::current_exception();
+          }
+          m_.target_->post(&m_);
+        });
+      }
+      result_type await_resume() {
+        if (error_) [[unlikely]] {
+          std::rethrow_exception(error_);
+        }
+        if constexpr (!std::is_void_v<result_type>) {
+          return std::move(result_);
+        }
+      }
+    };
+    return awaitable{this, std::move(f), {nullptr, nullptr, &loop}, {}, {}};
+  }
+};
+
+} // namespace uringpp
@@ -1,11 +1,19 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
+#include <fcntl.h>
 #include <memory>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 
 #include "uringpp/error.h"
 #include "uringpp/event_loop.h"
+#include "uringpp/task.h"
+
+#include "uringpp/detail/noncopyable.h"
+
 namespace uringpp {
 
 /**
@@ -15,6 +23,26 @@ namespace uringpp {
 class pipe {
   std::shared_ptr<event_loop> loop_;
   int fds_[2];
+  int size_;
+  bool fixed_ = false;
+
+  task<void> close_end(int &fd) {
+    if (fixed_) {
+      co_await loop_->close_direct(fd);
+      loop_->files().release(fd);
+    } else {
+      co_await loop_->close(fd);
+    }
+    fd = -1;
+  }
+
+  void close_end_detach(int fd) {
+    if (fixed_) {
+      loop_->close_direct_detach(fd);
+    } else {
+      loop_->close_detach(fd);
+    }
+  }
 
 public:
   /**
@@ -26,6 +54,48 @@ public:
     check_errno(::pipe(fds_), "failed to create pipe");
     assert(fds_[0] > 0);
     assert(fds_[1] > 0);
+    size_ = ::fcntl(fds_[0], F_GETPIPE_SZ);
+  }
+
+  /**
+   * @brief Construct a new pipe object whose ends are direct descriptors in the
+   * registered file table of the loop.
+   *
+   * @param loop The event loop.
+   * @param fixed Whether to install the ends into the file table. Always set if
+   * the loop requires fixed files.
+   * @param size The capacity to request with F_SETPIPE_SZ, or 0 for the
+   * default. The default is kept if the request exceeds the limit of
+   * /proc/sys/fs/pipe-max-size.
+   */
+  pipe(std::shared_ptr<event_loop> loop, bool fixed, int size = 0)
+      : pipe(loop) {
+    if (size > 0) {
+      if (auto rc = ::fcntl(fds_[0], F_SETPIPE_SZ, size); rc > 0) {
+        size_ = rc;
+      }
+    }
+    if (!fixed && !loop_->fixed_files_required()) {
+      return;
+    }
+    int fds[2] = {fds_[0], fds_[1]};
+    try {
+      fds_[0] = loop_->files().install(fds[0]);
+      try {
+        fds_[1] = loop_->files().install(fds[1]);
+      } catch (...) {
+        loop_->close_direct_detach(fds_[0]);
+        throw;
+      }
+    } catch (...) {
+      fds_[0] = fds_[1] = -1;
+      ::close(fds[0]);
+      ::close(fds[1]);
+      throw;
+    }
+    fixed_ = true;
+    ::close(fds[0]);
+    ::close(fds[1]);
   }
 
   /**
@@ -35,7 +105,40 @@ public:
    */
   pipe(pipe &&other) noexcept
       : loop_(std::move(other.loop_)), fds_{std::exchange(other.fds_[0], -1),
-                                            std::exchange(other.fds_[1], -1)} {}
+                                            std::exchange(other.fds_[1], -1)},
+        size_(other.size_), fixed_(other.fixed_) {}
+
+  /**
+   * @brief Get the capacity of the pipe.
+   *
+   * @return int The capacity in bytes.
+   */
+  int size() const { return size_; }
+
+  /**
+   * @brief Whether the ends of the pipe are direct descriptors.
+   *
+   * @return bool True if the ends are direct descriptors.
+   */
+  bool fixed() const { return fixed_; }
+
+  /**
+   * @brief Get the SQE flags for an op on an end of the pipe.
+   *
+   * @return uint8_t IOSQE_FIXED_FILE if the ends are direct descriptors.
+   */
+  uint8_t sqe_flags() const { return fixed_ ? IOSQE_FIXED_FILE : 0; }
+
+  /**
+   * @brief Get the flags for a splice or tee from the read end of the pipe.
+   *
+   * @param flags The splice flags.
+   * @return unsigned The flags with SPLICE_F_FD_IN_FIXED if the ends are direct
+   * descriptors.
+   */
+  unsigned splice_flags(unsigned flags) const {
+    return fixed_ ? flags | SPLICE_F_FD_IN_FIXED : flags;
+  }
 
   /**
    * @brief Get the read end of the pipe.
@@ -44,7 +147,7 @@ public:
    *
    */
   int readable_fd() const {
-    assert(fds_[0] > 0);
+    assert(fds_[0] >= 0);
     return fds_[0];
   }
 
@@ -54,7 +157,7 @@ public:
    * @return int The write end of the pipe.
    */
   int writable_fd() const {
-    assert(fds_[1] > 0);
+    assert(fds_[1] >= 0);
     return fds_[1];
   }
 
@@ -64,8 +167,8 @@ public:
    * @return task<void>
    */
   task<void> close_read() {
-    co_await loop_->close(readable_fd());
-    fds_[0] = -1;
+    assert(fds_[0] >= 0);
+    co_await close_end(fds_[0]);
   }
 
   /**
@@ -74,8 +177,8 @@ public:
    * @return task<void>
    */
   task<void> close_write() {
-    co_await loop_->close(writable_fd());
-    fds_[1] = -1;
+    assert(fds_[1] >= 0);
+    co_await close_end(fds_[1]);
   }
 
   /**
@@ -84,13 +187,11 @@ public:
    * @return task<void>
    */
   task<void> close() {
-    if (fds_[0] > 0) {
-      co_await loop_->close(fds_[0]);
-      fds_[0] = -1;
+    if (fds_[0] >= 0) {
+      co_await close_end(fds_[0]);
     }
-    if (fds_[1] > 0) {
-      co_await loop_->close(fds_[1]);
-      fds_[1] = -1;
+    if (fds_[1] >= 0) {
+      co_await close_end(fds_[1]);
     }
   }
 
@@ -100,11 +201,79 @@ public:
    *
    */
   ~pipe() {
-    if (fds_[0] > 0) {
-      loop_->close_detach(fds_[0]);
+    if (fds_[0] >= 0) {
+      close_end_detach(fds_[0]);
+    }
+    if (fds_[1] >= 0) {
+      close_end_detach(fds_[1]);
+    }
+  }
+};
+
+/**
+ * @brief A pool of idle pipes of the same capacity, saving the pipe creation
+ * and F_SETPIPE_SZ syscalls, and the file table updates of fixed pipes, per
+ * use.
+ *
+ */
+class pipe_pool : public noncopyable {
+  std::shared_ptr<event_loop> loop_;
+  std::vector<pipe> idle_;
+  int pipe_size_;
+  size_t max_idle_;
+  bool fixed_;
+
+public:
+  /**
+   * @brief Construct a new, empty pipe pool object
+   *
+   * @param loop The event loop.
+   * @param pipe_size The capacity of the pipes, or 0 for the default.
+   * @param max_idle The number of idle pipes kept. Pipes given back beyond it
+   * are closed.
+   * @param fixed Whether the ends of the pipes are direct descriptors.
+   */
+  pipe_pool(std::shared_ptr<event_loop> loop, int pipe_size = 0,
+            size_t max_idle = 64, bool fixed = false)
+      : loop_(std::move(loop)), pipe_size_(pipe_size), max_idle_(max_idle),
+        fixed_(fixed) {}
+
+  /**
+   * @brief Get the loop of the pipes.
+   *
+   * @return std::shared_ptr<event_loop> const& The event loop.
+   */
+  std::shared_ptr<event_loop> const &loop() const { return loop_; }
+
+  /**
+   * @brief Get the number of idle pipes.
+   *
+   * @return size_t The number of idle pipes.
+   */
+  size_t idle() const { return idle_.size(); }
+
+  /**
+   * @brief Take an idle pipe, or create one if none is idle.
+   *
+   * @return pipe The empty pipe.
+   */
+  pipe acquire() {
+    if (idle_.empty()) {
+      return pipe(loop_, fixed_, pipe_size_);
     }
-    if (fds_[1] > 0) {
-      loop_->close_detach(fds_[1]);
+    auto p = std::move(idle_.back());
+    idle_.pop_back();
+    return p;
+  }
+
+  /**
+   * @brief Give a pipe back to the pool. It must be empty.
+   *
+   * @param p The pipe.
+   */
+  void release(pipe p) {
+    if (idle_.size() < max_idle_) {
+      idle_.push_back(std::move(p));
     }
   }
 };
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <utility>
+
+#include "uringpp/error.h"
+#include "uringpp/file.h"
+#include "uringpp/pipe.h"
+#include "uringpp/socket.h"
+#include "uringpp/task.h"
+
+namespace uringpp {
+
+/**
+ * @brief Forward data from one socket to another through a pipe with splice,
+ * without copying it to userspace, until the input reaches end of file. The
+ * output is then shut down for writing.
+ *
+ * Every round is a single hard-linked chain, resuming the coroutine once:
+ * poll the input, splice it into the pipe, and splice the pipe to the output
+ * without blocking. Splice always runs in the kernel's async workers, so
+ * polling first keeps idle connections from holding a worker. Whatever the
+ * output does not take stays in the pipe and is flushed by polling the output
+ * before reading again.
+ *
+ * @param in The socket to read from.
+ * @param out The socket to write to.
+ * @param buffer The pipe to move the data through. It is empty again when the
+ * forwarding completes without error.
+ * @param chunk The maximum number of bytes per splice, or 0 for the capacity
+ * of the pipe.
+ * @return task<size_t> The number of bytes forwarded. Errors are thrown.
+ */
+inline task<size_t> splice_forward(socket &in, socket &out, pipe &buffer,
+                                   size_t chunk = 0) {
+  auto &loop = in.loop();
+  if (chunk == 0) {
+    chunk = buffer.size();
+  }
+  size_t total = 0;
+  size_t pending = 0;
+  for (;;) {
+    int rc;
+    if (pending == 0) {
+      auto round = loop->chain(3, true);
+      round.add(in.poll(POLLIN | POLLRDHUP))
+          .add(in.splice_to(buffer, chunk, SPLICE_F_MOVE))
+          .add(out.splice_from(buffer, chunk,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+      auto results = co_await round;
+      if (results[1] == 0) {
+        break;
+      }
+      if (results[1] == -EAGAIN) {
+        continue;
+      }
+      check_nerrno(results[1], "failed to splice from socket");
+      pending = results[1];
+      rc = results[2];
+    } else {
+      auto round = loop->chain(2, true);
+      round.add(out.poll(POLLOUT))
+          .add(out.splice_from(buffer, pending,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+      auto results = co_await round;
+      rc = results[1];
+    }
+    if (rc == -EAGAIN) {
+      continue;
+    }
+    check_nerrno(rc, "failed to splice to socket");
+    pending -= rc;
+    total += rc;
+  }
+  co_await out.shutdown(SHUT_WR);
+  co_return total;
+}
+
+/**
+ * @brief Send a range of a file to a socket through a pipe with splice, like
+ * sendfile(2), without copying it to userspace.
+ *
+ * Every round is a single hard-linked chain, resuming the coroutine once:
+ * splice the file into the pipe and the pipe to the socket without blocking.
+ * Whatever the socket does not take stays in the pipe and is flushed by
+ * polling the socket before reading the file again. The first round also
+ * advises the kernel to read the range ahead.
+ *
+ * @param in The file to read from.
+ * @param offset The offset of the range.
+ * @param count The length of the range.
+ * @param out The socket to write to.
+ * @param pipes The pool to take the pipe from. The pipe is given back unless
+ * the transfer failed.
+ * @param readahead Whether to start with POSIX_FADV_SEQUENTIAL and
+ * POSIX_FADV_WILLNEED on the range.
+ * @return task<size_t> The number of bytes sent, fewer than count if the file
+ * ends first. Errors are thrown.
+ */
+inline task<size_t> transfer(file &in, off_t offset, size_t count,
+                             socket &out, pipe_pool &pipes,
+                             bool readahead = true) {
+  auto &loop = out.loop();
+  auto buffer = pipes.acquire();
+  size_t chunk = buffer.size();
+  size_t total = 0;
+  size_t pending = 0;
+  while (total < count) {
+    int rc;
+    if (pending == 0) {
+      auto nbytes = std::min(chunk, count - total);
+      auto round = loop->chain(readahead ? 4 : 2, true);
+      if (readahead) {
+        /* A length of 0 advises up to the end of the file. */
+        off_t len = count <= UINT32_MAX ? count : 0;
+        round.add(in.fadvise(offset, len, POSIX_FADV_SEQUENTIAL))
+            .add(in.fadvise(offset, len, POSIX_FADV_WILLNEED));
+      }
+      round.add(in.splice_to(offset + total, nbytes, buffer, SPLICE_F_MOVE))
+          .add(out.splice_from(buffer, nbytes,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+      auto results = co_await round;
+      auto spliced = results[results.size() - 2];
+      if (spliced == 0) {
+        break;
+      }
+      check_nerrno(spliced, "failed to splice from file");
+      readahead = false;
+      pending = spliced;
+      rc = results.back();
+    } else {
+      auto round = loop->chain(2, true);
+      round.add(out.poll(POLLOUT))
+          .add(out.splice_from(buffer, pending,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+      auto results = co_await round;
+      rc = results[1];
+    }
+    if (rc == -EAGAIN) {
+      continue;
+    }
+    check_nerrno(rc, "failed to splice to socket");
+    pending -= rc;
+    total += rc;
+  }
+  pipes.release(std::move(buffer));
+  co_return total;
+}
+
+namespace detail {
+
+inline task<size_t> splice_forward_or_abort(socket &in, socket &out,
+                                            pipe &buffer, size_t chunk,
+                                            std::exception_ptr &error) {
+  size_t total = 0;
+  std::exception_ptr failure;
+  try {
+    total = co_await splice_forward(in, out, buffer, chunk);
+  } catch (...) {
+    failure = std::current_exception();
+  }
+  if (failure) {
+    if (!error) {
+      error = failure;
+    }
+    /* Wakes the other direction up, polling either socket. */
+    co_await in.shutdown(SHUT_RDWR);
+    co_await out.shutdown(SHUT_RDWR);
+  }
+  co_return total;
+}
+
+} // namespace detail
+
+/**
+ * @brief Forward data between two sockets in both directions with
+ * splice_forward, each direction through a pipe taken from a pool, until both
+ * reach end of file. A half-closed direction is shut down on its output while
+ * the other one keeps going. If a direction fails, both sockets are shut down
+ * to stop the other one.
+ *
+ * @param a The first socket.
+ * @param b The second socket.
+ * @param pipes The pool to take the pipes from. The pipes are given back
+ * unless a direction failed, which may leave data in its pipe.
+ * @param chunk The maximum number of bytes per splice, or 0 for the capacity
+ * of the pipes.
+ * @return task<std::pair<size_t, size_t>> The number of bytes forwarded from a
+ * to b and from b to a. Errors are thrown.
+ */
+inline task<std::pair<size_t, size_t>>
+copy_bidirectional(socket &a, socket &b, pipe_pool &pipes, size_t chunk = 0) {
+  auto a_to_b = pipes.acquire();
+  auto b_to_a = pipes.acquire();
+  std::exception_ptr error;
+  auto forward = detail::splice_forward_or_abort(a, b, a_to_b, chunk, error);
+  auto backward = detail::splice_forward_or_abort(b, a, b_to_a, chunk, error);
+  std::pair<size_t, size_t> totals;
+  totals.first = co_await forward;
+  totals.second = co_await backward;
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  pipes.release(std::move(a_to_b));
+  pipes.release(std::move(b_to_a));
+  co_return totals;
+}
+
+} // namespace uringpp
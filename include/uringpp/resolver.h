@@ -0,0 +1,200 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <vector>
+
+#include "uringpp/event_loop.h"
+#include "uringpp/ip_address.h"
+#include "uringpp/task.h"
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief How a resolver reaches its name servers, by default read from
+ * /etc/resolv.conf.
+ *
+ */
+struct resolver_config {
+  /** @brief The name servers, tried in order. */
+  std::vector<ip_address> nameservers;
+  /** @brief The domains appended to names with fewer than ndots dots. */
+  std::vector<std::string> search;
+  /** @brief The number of dots a name needs to be tried as is first. */
+  unsigned ndots = 1;
+  /** @brief How long to wait for an answer from a name server. */
+  std::chrono::milliseconds timeout{5000};
+  /** @brief The number of rounds over the name servers. */
+  unsigned attempts = 2;
+  /**
+   * @brief How long lookups of names without an address are cached when the
+   * answer carries no SOA record to take the negative TTL from. Timeouts and
+   * server failures are not cached.
+   */
+  std::chrono::seconds negative_ttl{30};
+  /** @brief The longest time an answer is cached, whatever its TTL. */
+  std::chrono::seconds max_ttl{3600};
+  /** @brief The maximum number of cached answers. */
+  size_t max_entries = 4096;
+
+  /**
+   * @brief Read the configuration of the system resolver. Only nameserver,
+   * search, domain and the ndots, timeout and attempts options are used.
+   * Without a name server, the local host is queried.
+   *
+   * @param path The path of the configuration file.
+   * @return resolver_config The configuration.
+   */
+  static resolver_config system(char const *path = "/etc/resolv.conf");
+};
+
+namespace detail {
+
+/**
+ * @brief The outcome of a DNS lookup of one record type.
+ *
+ */
+struct dns_answer {
+  enum status {
+    ok,
+    no_such_name,
+    no_data,
+    server_failure,
+    timed_out,
+  };
+  status status_ = timed_out;
+  std::vector<ip_address> addresses_;
+  /* How long the answer may be cached, in seconds. */
+  uint32_t ttl_ = 0;
+  /* The server truncated the answer (TC), which is then a server_failure
+   * holding no records. */
+  bool truncated_ = false;
+};
+
+/**
+ * @brief Encode a recursive query for a name. Returns the size of the query,
+ * or 0 if the name is not a valid domain name or does not fit.
+ *
+ */
+size_t encode_dns_query(uint16_t id, std::string_view name, uint16_t qtype,
+                        uint8_t *buf, size_t size);
+
+/**
+ * @brief Decode the response to a query. Returns false if the response does
+ * not answer the query, e.g. it has another ID or question. A truncated
+ * response answers it, but with no records.
+ *
+ */
+bool decode_dns_response(uint8_t const *query, size_t query_len,
+                         uint8_t const *response, size_t len, uint16_t qtype,
+                         dns_answer &answer);
+
+} // namespace detail
+
+/**
+ * @brief A stub resolver sending A and AAAA queries over UDP with io_uring ops,
+ * so that resolving a name never blocks the loop. Truncated answers are
+ * retried over TCP. Numeric addresses and the
+ * names of /etc/hosts are resolved without a query. Answers are cached for
+ * their TTL, and failed lookups for the negative TTL of their zone.
+ *
+ * A resolver is not thread-safe. resolver::local() gives each thread its own.
+ */
+class resolver : public noncopyable {
+  struct cache_entry {
+    detail::dns_answer answer_;
+    std::chrono::steady_clock::time_point expires_;
+  };
+
+  resolver_config config_;
+  std::unordered_multimap<std::string, ip_address> hosts_;
+  std::unordered_map<std::string, cache_entry> cache_;
+  std::minstd_rand ids_;
+
+  void load_hosts(char const *path);
+
+  void store(std::string const &key, detail::dns_answer const &answer);
+
+  std::vector<std::string> candidates(std::string const &name) const;
+
+  task<detail::dns_answer> exchange(std::shared_ptr<event_loop> loop,
+                                    ip_address const &nameserver,
+                                    std::string const &name, uint16_t qtype);
+
+  task<detail::dns_answer>
+  exchange_tcp(std::shared_ptr<event_loop> loop, ip_address nameserver,
+               uint8_t const *query, size_t query_len, uint16_t qtype,
+               std::chrono::steady_clock::time_point deadline);
+
+  task<detail::dns_answer> query(std::shared_ptr<event_loop> loop,
+                                 std::string const &name, uint16_t qtype);
+
+  task<detail::dns_answer> lookup(std::shared_ptr<event_loop> loop,
+                                  std::string const &name, uint16_t qtype);
+
+public:
+  /**
+   * @brief Construct a new resolver.
+   *
+   * @param config How to reach the name servers.
+   * @param hosts The hosts file to resolve names from first, or nullptr.
+   */
+  explicit resolver(resolver_config config = resolver_config::system(),
+                    char const *hosts = "/etc/hosts");
+
+  /**
+   * @brief Get the resolver of the calling thread, created on first use with
+   * the system configuration.
+   *
+   * @return resolver& The resolver.
+   */
+  static resolver &local();
+
+  /**
+   * @brief Resolve a host name or a numeric address.
+   *
+   * @param loop The loop to send queries on.
+   * @param host The host name, or an IPv4 or IPv6 address.
+   * @param port The port to set in the addresses.
+   * @param family AF_INET or AF_INET6 to only query one family, or AF_UNSPEC
+   * to query both concurrently.
+   * @return task<std::vector<ip_address>> The addresses, IPv6 first. Throws if
+   * the name has no address.
+   */
+  task<std::vector<ip_address>> resolve(std::shared_ptr<event_loop> loop,
+                                        std::string const &host,
+                                        uint16_t port,
+                                        int family = AF_UNSPEC);
+
+  /**
+   * @brief Resolve a host name or a numeric address.
+   *
+   * @param loop The loop to send queries on.
+   * @param host The host name, or an IPv4 or IPv6 address.
+   * @param service The port number or the name of a TCP service.
+   * @param family AF_INET, AF_INET6 or AF_UNSPEC.
+   * @return task<std::vector<ip_address>> The addresses, IPv6 first. Throws if
+   * the name has no address or the service is unknown.
+   */
+  task<std::vector<ip_address>> resolve(std::shared_ptr<event_loop> loop,
+                                        std::string const &host,
+                                        std::string const &service,
+                                        int family = AF_UNSPEC);
+
+  /**
+   * @brief Drop all cached answers.
+   *
+   */
+  void clear() { cache_.clear(); }
+};
+
+} // namespace uringpp
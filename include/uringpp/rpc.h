@@ -0,0 +1,389 @@
+#pragma once
+
+#include <algorithm>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <inttypes.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "uringpp/buffer_ring.h"
+#include "uringpp/buffered_stream.h"
+#include "uringpp/codec.h"
+#include "uringpp/error.h"
+#include "uringpp/socket.h"
+#include "uringpp/task.h"
+
+#include "uringpp/detail/noncopyable.h"
+#include "uringpp/detail/resume_awaitable.h"
+
+namespace uringpp {
+
+/*
+ * An RPC frame is a codec frame whose payload starts with a 64-bit
+ * correlation ID and a 32-bit code: the method of a request, or the status of
+ * a response, 0 meaning success. Responses carry the ID of their request and
+ * may be sent in any order.
+ */
+constexpr size_t kRpcHeaderSize = sizeof(uint64_t) + sizeof(uint32_t);
+constexpr size_t kDefaultMaxRpcFrameSize = 16 << 20;
+/* The status of a response to a request whose handler threw. */
+constexpr uint32_t kRpcError = 1;
+
+namespace detail {
+
+/**
+ * @brief Splits received chunks into RPC frames. Frames within a chunk are
+ * handed out in place, and only frames spanning chunks are copied.
+ *
+ */
+class rpc_frame_assembler {
+  std::vector<uint8_t> partial_;
+  size_t max_frame_size_;
+
+  size_t frame_size(uint8_t const *header) const {
+    size_t len = load<std::endian::big, uint32_t>(header);
+    if (len < kRpcHeaderSize || len > max_frame_size_) [[unlikely]] {
+      throw_with("invalid rpc frame of %zu bytes", len);
+    }
+    return kFrameHeaderSize + len;
+  }
+
+  template <class OnFrame>
+  void deliver(uint8_t const *frame, size_t size, OnFrame &on_frame) {
+    decoder d(frame + kFrameHeaderSize, size - kFrameHeaderSize);
+    auto id = d.get<uint64_t>();
+    auto code = d.get<uint32_t>();
+    on_frame(id, code, d.get_bytes(d.remaining()));
+  }
+
+public:
+  explicit rpc_frame_assembler(size_t max_frame_size)
+      : max_frame_size_(max_frame_size) {}
+
+  /**
+   * @brief Feed a chunk of the stream and call on_frame(id, code, payload)
+   * for every frame it completes. The payload is only valid during the call.
+   *
+   */
+  template <class OnFrame>
+  void feed(uint8_t const *data, size_t len, OnFrame &&on_frame) {
+    if (!partial_.empty()) {
+      if (partial_.size() < kFrameHeaderSize) {
+        auto n = std::min(len, kFrameHeaderSize - partial_.size());
+        partial_.insert(partial_.end(), data, data + n);
+        data += n;
+        len -= n;
+        if (partial_.size() < kFrameHeaderSize) {
+          return;
+        }
+      }
+      auto size = frame_size(partial_.data());
+      auto n = std::min(len, size - partial_.size());
+      partial_.insert(partial_.end(), data, data + n);
+      data += n;
+      len -= n;
+      if (partial_.size() < size) {
+        return;
+      }
+      deliver(partial_.data(), size, on_frame);
+      partial_.clear();
+    }
+    while (len >= kFrameHeaderSize) {
+      auto size = frame_size(data);
+      if (len < size) {
+        break;
+      }
+      deliver(data, size, on_frame);
+      data += size;
+      len -= size;
+    }
+    partial_.assign(data, data + len);
+  }
+};
+
+inline void write_rpc_frame(buffered_stream &stream, uint64_t id,
+                            uint32_t code, std::string_view payload) {
+  write_frame(stream, kRpcHeaderSize + payload.size(), [&](encoder &e) {
+    e.put(id).put(code).put_bytes(payload.data(), payload.size());
+  });
+}
+
+} // namespace detail
+
+/**
+ * @brief The server side of a framed RPC connection. Requests are read with a
+ * multishot recv into provided buffers and each one is handled by a detached
+ * task, so many requests of a connection can be in flight at once. Responses
+ * completed during a completion pass are coalesced into a single sendmsg.
+ *
+ */
+class rpc_server : public noncopyable {
+public:
+  /**
+   * @brief Handles a request. The payload is only valid until the handler
+   * first suspends. The returned string is the payload of the response; an
+   * exception is sent back as an error status with its message.
+   *
+   */
+  using handler = std::function<task<std::string>(uint32_t method,
+                                                  std::string_view payload)>;
+
+private:
+  buffered_stream stream_;
+  provided_buffer_ring &buffers_;
+  handler handler_;
+  detail::rpc_frame_assembler frames_;
+  size_t in_flight_ = 0;
+  std::coroutine_handle<> drained_;
+
+  task<void> handle(uint64_t id, uint32_t method, std::string_view payload);
+
+public:
+  /**
+   * @brief Construct a new rpc server object
+   *
+   * @param s The connected socket.
+   * @param buffers The buffer ring to receive into.
+   * @param h The request handler.
+   * @param max_frame_size The maximum size of a request frame. Larger frames
+   * fail the connection.
+   */
+  rpc_server(socket s, provided_buffer_ring &buffers, handler h,
+             size_t max_frame_size = kDefaultMaxRpcFrameSize);
+
+  /**
+   * @brief Get the number of requests being handled.
+   *
+   * @return size_t The number of requests.
+   */
+  size_t in_flight() const { return in_flight_; }
+
+  /**
+   * @brief Serve requests until the peer shuts the connection down, then wait
+   * for the requests in flight, flush their responses and close the socket.
+   *
+   * @return task<void> Completes once the connection is closed. Errors are
+   * thrown, after the requests in flight have completed.
+   */
+  task<void> serve();
+};
+
+/**
+ * @brief The client side of a framed RPC connection. Calls are pipelined:
+ * each one is sent with a new correlation ID without waiting for earlier
+ * responses, and the requests made during a completion pass are coalesced
+ * into a single sendmsg. run() must be running for calls to complete.
+ *
+ */
+class rpc_client : public noncopyable {
+  struct pending_call {
+    std::coroutine_handle<> h_;
+    uint32_t status_ = 0;
+    bool failed_ = false;
+    std::string payload_;
+  };
+
+  buffered_stream stream_;
+  provided_buffer_ring &buffers_;
+  detail::rpc_frame_assembler frames_;
+  uint64_t next_id_ = 1;
+  std::unordered_map<uint64_t, pending_call *> calls_;
+  std::exception_ptr error_;
+
+  void fail_calls(std::exception_ptr error);
+
+public:
+  /**
+   * @brief Construct a new rpc client object
+   *
+   * @param s The connected socket.
+   * @param buffers The buffer ring to receive into.
+   * @param max_frame_size The maximum size of a response frame. Larger frames
+   * fail the connection.
+   */
+  rpc_client(socket s, provided_buffer_ring &buffers,
+             size_t max_frame_size = kDefaultMaxRpcFrameSize);
+
+  /**
+   * @brief Get the number of calls waiting for a response.
+   *
+   * @return size_t The number of calls.
+   */
+  size_t in_flight() const { return calls_.size(); }
+
+  /**
+   * @brief Receive responses and complete the calls they belong to until the
+   * server closes the connection. Calls still waiting then fail.
+   *
+   * @return task<void> Completes once the connection is closed. Errors are
+   * thrown.
+   */
+  task<void> run();
+
+  /**
+   * @brief Call a method.
+   *
+   * @param method The method.
+   * @param payload The payload of the request, copied before the call
+   * suspends.
+   * @return task<std::string> The payload of the response. An error status is
+   * thrown with the payload of the response as the message, as is a failed
+   * connection.
+   */
+  task<std::string> call(uint32_t method, std::string_view payload);
+
+  /**
+   * @brief Flush the requests and shut the connection down for writing. The
+   * server then closes the connection once it has responded, which ends
+   * run().
+   *
+   * @return task<void>
+   */
+  task<void> shutdown();
+};
+
+inline rpc_server::rpc_server(socket s, provided_buffer_ring &buffers,
+                              handler h, size_t max_frame_size)
+    : stream_(std::move(s)), buffers_(buffers), handler_(std::move(h)),
+      frames_(max_frame_size) {}
+
+inline task<void> rpc_server::handle(uint64_t id, uint32_t method,
+                                     std::string_view payload) {
+  ++in_flight_;
+  uint32_t status = 0;
+  std::string response;
+  try {
+    response = co_await handler_(method, payload);
+  } catch (std::exception const &e) {
+    status = kRpcError;
+    response = e.what();
+  } catch (...) {
+    status = kRpcError;
+    response = "unknown error";
+  }
+  try {
+    detail::write_rpc_frame(stream_, id, status, response);
+  } catch (...) {
+    /* The connection failed, which serve() finds out by itself. */
+  }
+  if (--in_flight_ == 0 && drained_) {
+    std::exchange(drained_, nullptr).resume();
+  }
+}
+
+inline task<void> rpc_server::serve() {
+  std::exception_ptr error;
+  try {
+    auto chunks = stream_.lower().recv_multishot(buffers_);
+    for (;;) {
+      auto chunk = co_await chunks.next();
+      if (!chunk) {
+        break;
+      }
+      frames_.feed(chunk.data(), chunk.size(),
+                   [this](uint64_t id, uint32_t method,
+                          std::string_view payload) {
+                     handle(id, method, payload);
+                   });
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+  if (in_flight_ > 0) {
+    co_await detail::resume_awaitable{drained_};
+  }
+  if (!error) {
+    try {
+      co_await stream_.close();
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+inline rpc_client::rpc_client(socket s, provided_buffer_ring &buffers,
+                              size_t max_frame_size)
+    : stream_(std::move(s)), buffers_(buffers), frames_(max_frame_size) {}
+
+inline void rpc_client::fail_calls(std::exception_ptr error) {
+  error_ = error;
+  auto calls = std::move(calls_);
+  calls_.clear();
+  for (auto &[id, call] : calls) {
+    call->failed_ = true;
+    call->h_.resume();
+  }
+}
+
+inline task<void> rpc_client::run() {
+  std::exception_ptr error;
+  try {
+    auto chunks = stream_.lower().recv_multishot(buffers_);
+    for (;;) {
+      auto chunk = co_await chunks.next();
+      if (!chunk) {
+        break;
+      }
+      frames_.feed(chunk.data(), chunk.size(),
+                   [this](uint64_t id, uint32_t status,
+                          std::string_view payload) {
+                     auto it = calls_.find(id);
+                     if (it == calls_.end()) [[unlikely]] {
+                       throw_with("unexpected rpc response %" PRIu64, id);
+                     }
+                     auto call = it->second;
+                     calls_.erase(it);
+                     call->status_ = status;
+                     call->payload_.assign(payload);
+                     call->h_.resume();
+                   });
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+  fail_calls(error ? error
+                   : std::make_exception_ptr(
+                         std::runtime_error("rpc connection closed")));
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+inline task<std::string> rpc_client::call(uint32_t method,
+                                          std::string_view payload) {
+  if (error_) [[unlikely]] {
+    std::rethrow_exception(error_);
+  }
+  auto id = next_id_++;
+  detail::write_rpc_frame(stream_, id, method, payload);
+  pending_call call;
+  calls_.emplace(id, &call);
+  co_await detail::resume_awaitable{call.h_};
+  if (call.failed_) [[unlikely]] {
+    std::rethrow_exception(error_);
+  }
+  if (call.status_ != 0) [[unlikely]] {
+    throw_with("rpc call failed with status %u: %s", call.status_,
+               call.payload_.c_str());
+  }
+  co_return std::move(call.payload_);
+}
+
+inline task<void> rpc_client::shutdown() {
+  co_await stream_.flush();
+  co_await stream_.lower().shutdown(SHUT_WR);
+}
+
+} // namespace uringpp
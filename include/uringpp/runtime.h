@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "uringpp/event_loop.h"
+#include "uringpp/task.h"
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief A thread-per-core runtime. Each thread owns one event loop, pinned to
+ * its own core. All rings share the kernel async worker pool of the first ring
+ * (IORING_SETUP_ATTACH_WQ), and tasks are handed between loops through the
+ * rings themselves, without locks.
+ *
+ */
+class runtime : public noncopyable {
+  std::vector<std::shared_ptr<event_loop>> loops_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> stopped_;
+
+  void start_loop(size_t index, loop_options options, bool pin);
+
+  /* Like event_loop::schedule(), but marks the frame detached before it can
+   * run on the target loop, so that the spawning thread never races with the
+   * loop over the frame. */
+  struct handoff {
+    event_loop::message m_;
+    bool await_ready() noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<task<void>::promise_type> h) {
+      h.promise().detached_ = true;
+      if (event_loop::current() == m_.target_) {
+        return false;
+      }
+      m_.h_ = h;
+      event_loop::send_to_target(&m_);
+      return true;
+    }
+    void await_resume() noexcept {}
+  };
+
+public:
+  /**
+   * @brief Start the runtime.
+   *
+   * @param nr_loops The number of loops, or 0 for one per available core.
+   * @param options The options of each loop. The wq_fd option is overridden.
+   * Each loop is only driven by its own thread, so single_issuer and
+   * defer_taskrun are safe to request.
+   * @param pin Whether to pin the thread of loop i to core i.
+   */
+  runtime(unsigned nr_loops = 0, loop_options const &options = {},
+          bool pin = true);
+
+  /**
+   * @brief Get the number of loops.
+   *
+   * @return size_t The number of loops.
+   */
+  size_t size() const { return loops_.size(); }
+
+  /**
+   * @brief Get a loop of the runtime.
+   *
+   * @param index The index of the loop.
+   * @return std::shared_ptr<event_loop> const& The loop.
+   */
+  std::shared_ptr<event_loop> const &loop(size_t index) const {
+    return loops_[index];
+  }
+
+  /**
+   * @brief Run a task on the given loop. Safe to call from any thread.
+   *
+   * @param index The index of the loop.
+   * @param f A callable taking std::shared_ptr<event_loop> and returning
+   * task<void>. It is invoked on the loop's thread.
+   */
+  template <class F> void spawn(size_t index, F f) {
+    auto spawned = [](std::shared_ptr<event_loop> loop, F f) -> task<void> {
+      co_await handoff{{nullptr, nullptr, loop.get()}};
+      co_await f(loop);
+    }(loops_[index], std::move(f));
+    /* The frame detached itself before leaving this thread, and may be gone
+     * already: drop the handle without touching it. */
+    spawned.detached_ = true;
+  }
+
+  /**
+   * @brief Run a copy of a task on every loop, e.g. to serve a SO_REUSEPORT
+   * listener on each core.
+   *
+   * @param f A callable taking std::shared_ptr<event_loop> and returning
+   * task<void>.
+   */
+  template <class F> void spawn_all(F f) {
+    for (size_t i = 0; i < loops_.size(); ++i) {
+      spawn(i, f);
+    }
+  }
+
+  /**
+   * @brief Ask all loops to stop. Safe to call from any thread, including the
+   * loops themselves.
+   *
+   */
+  void stop();
+
+  /**
+   * @brief Wait for all loop threads to exit after stop().
+   *
+   */
+  void join();
+
+  /**
+   * @brief Stop the runtime and wait for all threads.
+   *
+   */
+  ~runtime();
+};
+
+} // namespace uringpp
@@ -1,52 +1,238 @@
 #pragma once
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstring>
 #include <memory>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <optional>
 #include <stdexcept>
+#include <string>
 #include <sys/socket.h>
+#include <type_traits>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 
 #include "uringpp/awaitable.h"
+#include "uringpp/buffer_pool.h"
+#include "uringpp/buffer_ring.h"
 #include "uringpp/error.h"
 #include "uringpp/event_loop.h"
+#include "uringpp/ip_address.h"
+#include "uringpp/multishot.h"
 #include "uringpp/pipe.h"
+#include "uringpp/resolver.h"
 #include "uringpp/task.h"
+#include "uringpp/timer_wheel.h"
 
 #include "uringpp/detail/debug.h"
 #include "uringpp/detail/noncopyable.h"
+#include "uringpp/detail/resume_awaitable.h"
 
 namespace uringpp {
 
+/**
+ * @brief A stream of data received by a single multishot recv. Each chunk is
+ * placed by the kernel in a buffer picked from a provided buffer ring, so no
+ * memory is held while the connection is idle. On kernels without multishot
+ * receives a single-shot recv is re-armed after every chunk instead.
+ *
+ */
+class recv_stream : public noncopyable {
+  class operation : public multishot_operation,
+                    public provided_buffer_ring::waiter {
+    event_loop *loop_;
+    int fd_;
+    provided_buffer_ring *buffers_;
+    int flags_;
+    uint8_t sqe_flags_;
+    uint64_t armed_recycled_ = 0;
+
+  protected:
+    void prep(struct io_uring_sqe *sqe) override {
+      /* A single-shot recv is re-armed by the loop after each chunk. */
+      if (loop_->has_multishot_recv()) {
+        ::io_uring_prep_recv_multishot(sqe, fd_, nullptr, 0, flags_);
+      } else {
+        ::io_uring_prep_recv(sqe, fd_, nullptr, 0, flags_);
+      }
+      sqe->flags |= IOSQE_BUFFER_SELECT | sqe_flags_;
+      sqe->buf_group = buffers_->group_id();
+      armed_recycled_ = buffers_->recycled();
+    }
+
+    bool restart(int res) override {
+      if (res == -ENOBUFS) {
+        /* At capacity, re-arming would fail right away until a consumer
+         * recycles a buffer. */
+        if (buffers_->starved(armed_recycled_)) {
+          park();
+          buffers_->wait(this);
+        }
+        return true;
+      }
+      return res > 0;
+    }
+
+    void discard(int, uint32_t flags) override {
+      if (flags & IORING_CQE_F_BUFFER) {
+        buffers_->recycle(flags >> IORING_CQE_BUFFER_SHIFT);
+      }
+    }
+
+    void on_recycle() override { loop_->unpark_multishot(this); }
+
+  public:
+    operation(event_loop *loop, int fd, provided_buffer_ring *buffers,
+              int flags, uint8_t sqe_flags)
+        : loop_(loop), fd_(fd), buffers_(buffers), flags_(flags),
+          sqe_flags_(sqe_flags) {}
+
+    ~operation() { buffers_->cancel_wait(this); }
+  };
+
+  std::shared_ptr<event_loop> loop_;
+  provided_buffer_ring *buffers_;
+  operation *op_;
+
+public:
+  /**
+   * @brief Start receiving from a socket.
+   *
+   * @param loop The event loop.
+   * @param fd The file descriptor of the socket.
+   * @param buffers The buffer ring to receive into.
+   * @param flags The flags to use.
+   * @param sqe_flags The SQE flags to use, e.g. IOSQE_FIXED_FILE.
+   */
+  recv_stream(std::shared_ptr<event_loop> loop, int fd,
+              provided_buffer_ring &buffers, int flags = 0,
+              uint8_t sqe_flags = 0)
+      : loop_(loop), buffers_(&buffers),
+        op_(new operation(loop.get(), fd, &buffers, flags, sqe_flags)) {
+    loop_->arm_multishot(op_);
+  }
+
+  /**
+   * @brief Move construct a new recv stream object
+   *
+   * @param other
+   */
+  recv_stream(recv_stream &&other) noexcept
+      : loop_(std::move(other.loop_)), buffers_(other.buffers_),
+        op_(std::exchange(other.op_, nullptr)) {}
+
+  /**
+   * @brief Wait for the next chunk of data.
+   *
+   * @return An awaitable resolving to the buffer holding the data. An empty
+   * buffer means the peer has closed the connection. Errors are thrown.
+   */
+  auto next() {
+    struct awaitable : multishot_operation::completion_awaitable {
+      provided_buffer_ring *buffers_;
+      provided_buffer await_resume() {
+        auto c = completion_awaitable::await_resume();
+        if (!c) {
+          return {};
+        }
+        check_nerrno(c->res, "failed to receive");
+        if (!(c->flags & IORING_CQE_F_BUFFER)) {
+          return {};
+        }
+        return provided_buffer(buffers_,
+                               c->flags >> IORING_CQE_BUFFER_SHIFT, c->res);
+      }
+    };
+    return awaitable{op_->next(), buffers_};
+  }
+
+  /**
+   * @brief Destroy the recv stream object. A pending multishot recv is
+   * cancelled.
+   *
+   */
+  ~recv_stream() {
+    if (op_ != nullptr) {
+      loop_->release_multishot(op_);
+    }
+  }
+};
+
 class file;
 class socket : public noncopyable {
+  friend class file;
   std::shared_ptr<event_loop> loop_;
   int fd_;
+  bool fixed_ = false;
   friend class listener;
 
+  uint8_t sqe_flags() const { return fixed_ ? IOSQE_FIXED_FILE : 0; }
+  unsigned splice_flags(unsigned flags) const {
+    return fixed_ ? flags | SPLICE_F_FD_IN_FIXED : flags;
+  }
+
+  /* Ops on a plain descriptor fail with EBADF on loops requiring fixed
+   * files. */
+  void install_if_required() {
+    if (!loop_->fixed_files_required()) {
+      return;
+    }
+    int fd = fd_;
+    try {
+      fd_ = loop_->files().install(fd);
+    } catch (...) {
+      ::close(fd);
+      throw;
+    }
+    ::close(fd);
+    fixed_ = true;
+  }
+
 public:
   /**
-   * @brief Get the file descriptor of the socket.
+   * @brief Get the file descriptor of the socket. For a direct descriptor this
+   * is its index in the registered file table.
    *
    * @return int The file descriptor of the socket.
    */
   int fd() const { return fd_; }
 
+  /**
+   * @brief Get the event loop of the socket.
+   *
+   * @return std::shared_ptr<event_loop> const& The event loop.
+   */
+  std::shared_ptr<event_loop> const &loop() const { return loop_; }
+
+  /**
+   * @brief Whether the socket is a direct descriptor, i.e. it only lives in
+   * the registered file table of the loop.
+   *
+   * @return bool True if the socket is a direct descriptor.
+   */
+  bool fixed() const { return fixed_; }
+
   /**
    * @brief Move construct a new socket object
    *
    * @param other
    */
   socket(socket &&other) noexcept
-      : loop_(std::move(other.loop_)), fd_(std::exchange(other.fd_, -1)) {
+      : loop_(std::move(other.loop_)), fd_(std::exchange(other.fd_, -1)),
+        fixed_(other.fixed_) {
     assert(fd_ != -1);
   }
 
   /**
-   * @brief Construct a new socket object
+   * @brief Construct a new socket object. If the loop requires fixed files,
+   * the socket is installed into its file table.
    *
    * @param loop The event loop.
    * @param domain The domain of the socket.
@@ -56,62 +242,112 @@ public:
   socket(std::shared_ptr<event_loop> loop, int domain, int type, int protocol)
       : loop_(loop), fd_(::socket(domain, type, protocol)) {
     check_errno(fd_, "failed to create socket");
+    install_if_required();
   }
 
   /**
-   * @brief Construct a new socket object from a file descriptor.
+   * @brief Construct a new socket object from a file descriptor, which it
+   * takes over. If the loop requires fixed files, the descriptor is installed
+   * into its file table and closed, so this must run on the thread of the
+   * loop.
    *
    * @param loop The event loop.
    * @param fd The file descriptor.
    */
   socket(std::shared_ptr<event_loop> loop, int fd) : loop_(loop), fd_(fd) {
     assert(fd_ > 0);
+    install_if_required();
+  }
+
+  /**
+   * @brief Construct a new socket object from a file descriptor or a direct
+   * descriptor. Operations on a direct descriptor are submitted with
+   * IOSQE_FIXED_FILE.
+   *
+   * @param loop The event loop.
+   * @param fd The file descriptor, or the index in the registered file table.
+   * @param fixed Whether fd is a direct descriptor.
+   */
+  socket(std::shared_ptr<event_loop> loop, int fd, bool fixed)
+      : loop_(loop), fd_(fd), fixed_(fixed) {
+    assert(fd_ >= 0);
   }
 
   /**
-   * @brief Connect to a remote host.
+   * @brief Create a socket straight into a free slot of the registered file
+   * table of the loop.
+   *
+   * @param loop The event loop.
+   * @param domain The domain of the socket.
+   * @param type The type of the socket.
+   * @param protocol The protocol of the socket.
+   * @return task<socket> The socket object holding a direct descriptor.
+   */
+  static task<socket> create_direct(std::shared_ptr<event_loop> loop,
+                                    int domain, int type, int protocol) {
+    auto slot = loop->files().acquire();
+    int rc = co_await loop->socket_direct(domain, type, protocol, slot);
+    if (rc < 0) [[unlikely]] {
+      loop->files().release(slot);
+      check_nerrno(rc, "failed to create socket");
+    }
+    co_return socket(loop, slot, true);
+  }
+
+  /**
+   * @brief Connect to a remote host. The host name is resolved with
+   * resolver::local(), without blocking the loop, and its addresses are
+   * raced as by connect(loop, addresses, direct).
    *
    * @param loop The event loop.
    * @param hostname The hostname of the remote host.
    * @param port The port of the remote host.
+   * @param direct Whether to create the socket as a direct descriptor, see
+   * create_direct. Always set if the loop requires fixed files.
    * @return task<socket> The socket object.
    */
   static task<socket> connect(std::shared_ptr<event_loop> loop,
                               std::string const &hostname,
-                              std::string const &port) {
-    struct addrinfo hints, *servinfo, *p;
-    ::bzero(&hints, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    if (auto rc =
-            ::getaddrinfo(hostname.c_str(), port.c_str(), &hints, &servinfo);
-        rc != 0) {
-      throw_with("failed to getaddrinfo: %s", ::gai_strerror(rc));
-    }
-    for (p = servinfo; p != nullptr; p = p->ai_next) {
-      int fd = ::socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-      if (fd <= 0) {
-        continue;
-      }
-      auto new_socket = socket(loop, fd);
-      int rc =
-          co_await loop->connect(new_socket.fd(), p->ai_addr, p->ai_addrlen);
-      if (rc == 0) {
-        ::freeaddrinfo(servinfo);
-        co_return new_socket;
-      }
-    }
-    ::freeaddrinfo(servinfo);
-    throw std::runtime_error("failed to connect");
+                              std::string const &port, bool direct = false) {
+    auto addresses = co_await resolver::local().resolve(loop, hostname, port);
+    auto s = co_await connect(loop, std::move(addresses), direct);
+    co_return s;
   }
 
+  /**
+   * @brief Connect to one of several addresses of a host, racing them as in
+   * Happy Eyeballs (RFC 8305). The address families are interleaved, and the
+   * next address is tried once an attempt fails or has not connected within
+   * the attempt delay, without giving up on the previous ones. The first
+   * connection wins and the other attempts are cancelled.
+   *
+   * @param loop The event loop.
+   * @param addresses The addresses, in order of preference.
+   * @param direct Whether to create the socket as a direct descriptor, see
+   * create_direct. Always set if the loop requires fixed files.
+   * @param attempt_delay How long to wait for an attempt before starting the
+   * next one.
+   * @return task<socket> The socket object. Throws with the error of the
+   * last attempt if none connects.
+   */
+  static task<socket> connect(std::shared_ptr<event_loop> loop,
+                              std::vector<ip_address> addresses,
+                              bool direct = false,
+                              std::chrono::milliseconds attempt_delay =
+                                  std::chrono::milliseconds(250));
+
   /**
    * @brief Destroy the socket object. If the socket is still open, it will be
-   * closed.
+   * closed. The slot of a direct descriptor is freed once it is closed.
    *
    */
   ~socket() {
-    if (fd_ > 0) {
+    if (fd_ < 0) {
+      return;
+    }
+    if (fixed_) {
+      loop_->close_direct_detach(fd_);
+    } else if (fd_ > 0) {
       loop_->close_detach(fd_);
     }
   }
@@ -122,7 +358,10 @@ public:
    * @return task<void>
    */
   task<void> close() {
-    if (fd_ > 0) {
+    if (fixed_ && fd_ >= 0) {
+      co_await loop_->close_direct(fd_);
+      loop_->files().release(std::exchange(fd_, -1));
+    } else if (fd_ > 0) {
       co_await loop_->close(fd_);
       fd_ = -1;
     }
@@ -136,7 +375,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable read(void *buf, size_t count) {
-    return loop_->read(fd_, buf, count, 0);
+    return loop_->read(fd_, buf, count, 0, sqe_flags());
   }
 
   /**
@@ -147,7 +386,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable write(void const *buf, size_t count) {
-    return loop_->write(fd_, buf, count, 0);
+    return loop_->write(fd_, buf, count, 0, sqe_flags());
   }
 
   /**
@@ -158,7 +397,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable readv(struct iovec const *iov, int iovcnt) {
-    return loop_->readv(fd_, iov, iovcnt);
+    return loop_->readv(fd_, iov, iovcnt, 0, sqe_flags());
   }
 
   /**
@@ -169,7 +408,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable writev(struct iovec const *iov, int iovcnt) {
-    return loop_->writev(fd_, iov, iovcnt, 0);
+    return loop_->writev(fd_, iov, iovcnt, 0, sqe_flags());
   }
 
   /**
@@ -181,7 +420,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable read_fixed(void *buf, size_t count, int buf_index) {
-    return loop_->read_fixed(fd_, buf, count, 0, buf_index);
+    return loop_->read_fixed(fd_, buf, count, 0, buf_index, sqe_flags());
   }
 
   /**
@@ -193,7 +432,31 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable write_fixed(void const *buf, size_t count, int buf_index) {
-    return loop_->write_fixed(fd_, buf, count, 0, buf_index);
+    return loop_->write_fixed(fd_, buf, count, 0, buf_index,
+                              sqe_flags());
+  }
+
+  /**
+   * @brief Read data from the socket into a leased fixed buffer.
+   *
+   * @param buf The leased buffer to read into.
+   * @return sqe_awaitable
+   */
+  sqe_awaitable read_fixed(fixed_buffer &buf) {
+    return loop_->read_fixed(fd_, buf.data(), buf.size(), 0, buf.index(),
+                             sqe_flags());
+  }
+
+  /**
+   * @brief Write data from a leased fixed buffer to the socket.
+   *
+   * @param buf The leased buffer to write from.
+   * @param count The number of bytes to write.
+   * @return sqe_awaitable
+   */
+  sqe_awaitable write_fixed(fixed_buffer const &buf, size_t count) {
+    return loop_->write_fixed(fd_, buf.data(), count, 0, buf.index(),
+                              sqe_flags());
   }
 
   /**
@@ -204,7 +467,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable sendmsg(struct msghdr const *msg, int flags = 0) {
-    return loop_->sendmsg(fd_, msg, flags);
+    return loop_->sendmsg(fd_, msg, flags, sqe_flags());
   }
 
   /**
@@ -215,7 +478,7 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable recvmsg(struct msghdr *msg, int flags = 0) {
-    return loop_->recvmsg(fd_, msg, flags);
+    return loop_->recvmsg(fd_, msg, flags, sqe_flags());
   }
 
   /**
@@ -227,7 +490,66 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable send(void const *buf, size_t len, int flags = 0) {
-    return loop_->send(fd_, buf, len, flags);
+    return loop_->send(fd_, buf, len, flags, sqe_flags());
+  }
+
+  /**
+   * @brief Send data to the socket without copying it into the kernel, unless
+   * it is below the zero-copy threshold of the loop.
+   *
+   * @param buf The buffer to send.
+   * @param len The number of bytes to send.
+   * @param flags The flags to use.
+   * @return An awaitable resolving to the number of bytes sent once the buffer
+   * may be reused.
+   */
+  auto send_zc(void const *buf, size_t len, int flags = 0) {
+    return loop_->send_zc(fd_, buf, len, flags, sqe_flags());
+  }
+
+  /**
+   * @brief Send data owned by a buffer without copying it into the kernel,
+   * unless it is below the zero-copy threshold of the loop. The buffer is
+   * destroyed once the kernel no longer references it.
+   *
+   * @param buffer The buffer, e.g. a fixed_buffer lease or a std::vector.
+   * @param len The number of bytes to send from the start of the buffer.
+   * @param flags The flags to use.
+   * @return An awaitable resolving to the number of bytes sent.
+   */
+  template <class Buffer>
+    requires(!std::is_pointer_v<Buffer>)
+  auto send_zc(Buffer buffer, size_t len, int flags = 0) {
+    return loop_->send_zc(fd_, std::move(buffer), len, flags, sqe_flags());
+  }
+
+  /**
+   * @brief Send messages to the socket without copying them into the kernel,
+   * unless they are below the zero-copy threshold of the loop.
+   *
+   * @param msg The messages to send.
+   * @param flags The flags to use.
+   * @return An awaitable resolving to the number of bytes sent once the buffers
+   * may be reused.
+   */
+  auto sendmsg_zc(struct msghdr const *msg, int flags = 0) {
+    return loop_->sendmsg_zc(fd_, msg, flags, sqe_flags());
+  }
+
+  /**
+   * @brief Send messages whose data is owned by an object without copying them
+   * into the kernel, unless they are below the zero-copy threshold of the loop.
+   * The owner is destroyed once the kernel no longer references the data.
+   *
+   * @param owner The owner of the data.
+   * @param msg The messages to send. Must stay valid until submission.
+   * @param flags The flags to use.
+   * @return An awaitable resolving to the number of bytes sent.
+   */
+  template <class Owner>
+    requires(!std::is_pointer_v<Owner>)
+  auto sendmsg_zc(Owner owner, struct msghdr const *msg, int flags = 0) {
+    return loop_->sendmsg_zc(fd_, std::move(owner), msg, flags, sqe_flags());
   }
 
   /**
@@ -239,7 +561,29 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable recv(void *buf, size_t len, int flags = 0) {
-    return loop_->recv(fd_, buf, len, flags);
+    return loop_->recv(fd_, buf, len, flags, sqe_flags());
+  }
+
+  /**
+   * @brief Receive data with a single multishot recv into buffers picked by
+   * the kernel from a provided buffer ring.
+   *
+   * @param buffers The buffer ring to receive into.
+   * @param flags The flags to use.
+   * @return recv_stream The stream of received data.
+   */
+  recv_stream recv_multishot(provided_buffer_ring &buffers, int flags = 0) {
+    return recv_stream(loop_, fd_, buffers, flags, sqe_flags());
+  }
+
+  /**
+   * @brief Wait for the socket to become ready.
+   *
+   * @param poll_mask The events to wait for, e.g. POLLIN.
+   * @return sqe_awaitable Resolves to the events which are ready.
+   */
+  sqe_awaitable poll(short poll_mask) {
+    return loop_->poll_add(fd_, poll_mask, sqe_flags());
   }
 
   /**
@@ -248,7 +592,9 @@ public:
    * @param how Which sides of the socket to shutdown.
    * @return sqe_awaitable
    */
-  sqe_awaitable shutdown(int how) { return loop_->shutdown(fd_, how); }
+  sqe_awaitable shutdown(int how) {
+    return loop_->shutdown(fd_, how, sqe_flags());
+  }
 
   /**
    * @brief Tee the socket to a file.
@@ -269,20 +615,21 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable tee(socket const &out, size_t count, unsigned int flags) {
-    return loop_->tee(fd_, out.fd(), count, flags);
+    return loop_->tee(fd_, out.fd(), count, splice_flags(flags),
+                      out.sqe_flags());
   }
 
   /**
    * @brief Splice the socket to a pipe.
    *
    * @param out The pipe to splice to.
-   * @param off_out The offset to splice to.
    * @param nbytes The number of bytes to splice.
    * @param flags The flags to use.
    * @return sqe_awaitable
    */
   sqe_awaitable splice_to(pipe const &out, size_t nbytes, unsigned flags) {
-    return loop_->splice(fd_, 0, out.writable_fd(), 0, nbytes, flags);
+    return loop_->splice(fd_, -1, out.writable_fd(), -1, nbytes,
+                         splice_flags(flags), out.sqe_flags());
   }
 
   /**
@@ -294,8 +641,155 @@ public:
    * @return sqe_awaitable
    */
   sqe_awaitable splice_from(pipe const &in, size_t nbytes, unsigned flags) {
-    return loop_->splice(in.readable_fd(), 0, fd_, 0, nbytes, flags);
+    return loop_->splice(in.readable_fd(), -1, fd_, -1, nbytes,
+                         in.splice_flags(flags), sqe_flags());
   }
 };
 
+namespace detail {
+
+/**
+ * @brief The state shared by the attempts of socket::connect, living in its
+ * frame.
+ *
+ */
+struct connect_race : public noncopyable {
+  struct delay : public timer_entry {
+    connect_race *race_;
+    explicit delay(connect_race *race) : race_(race) {}
+    void fire() override { race_->wake(); }
+  };
+
+  std::optional<socket> winner_;
+  /* The descriptor each attempt is connecting, or -1. */
+  std::vector<int> fds_;
+  size_t in_flight_ = 0;
+  bool failed_ = false;
+  int error_ = -ECONNREFUSED;
+  std::coroutine_handle<> waiter_;
+  delay delay_{this};
+
+  void wake() {
+    if (waiter_) {
+      std::exchange(waiter_, nullptr).resume();
+    }
+  }
+};
+
+/* Reorder addresses so that the families alternate, starting with the
+ * family of the first one (RFC 8305, section 4). */
+static inline void interleave_families(std::vector<ip_address> &addresses) {
+  if (addresses.empty()) {
+    return;
+  }
+  std::vector<ip_address> preferred, other;
+  auto family = addresses.front().ss_.ss_family;
+  for (auto const &address : addresses) {
+    (address.ss_.ss_family == family ? preferred : other).push_back(address);
+  }
+  addresses.clear();
+  for (size_t i = 0; i < std::max(preferred.size(), other.size()); ++i) {
+    if (i < preferred.size()) {
+      addresses.push_back(preferred[i]);
+    }
+    if (i < other.size()) {
+      addresses.push_back(other[i]);
+    }
+  }
+}
+
+inline task<void> connect_attempt(std::shared_ptr<event_loop> loop,
+                                  ip_address address, bool direct,
+                                  connect_race &race, size_t index) {
+  int rc;
+  {
+    int fd;
+    if (direct) {
+      fd = loop->files().allocate();
+      rc = fd < 0 ? -ENFILE : 0;
+      if (fd >= 0) {
+        rc = co_await loop->socket_direct(address.ss_.ss_family, SOCK_STREAM,
+                                          0, fd);
+        if (rc < 0) {
+          loop->files().release(fd);
+        }
+      }
+    } else {
+      fd = ::socket(address.ss_.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      rc = fd < 0 ? -errno : 0;
+    }
+    if (rc >= 0) {
+      socket s(loop, fd, direct);
+      /* Another attempt may have won while the socket was created. */
+      if (!race.winner_) {
+        race.fds_[index] = fd;
+        rc = co_await loop->connect(
+            fd, reinterpret_cast<sockaddr *>(&address.ss_), address.len_,
+            direct ? IOSQE_FIXED_FILE : 0);
+        race.fds_[index] = -1;
+        if (rc == 0 && !race.winner_) {
+          race.winner_.emplace(std::move(s));
+        }
+      }
+    }
+  }
+  --race.in_flight_;
+  if (rc < 0) {
+    race.failed_ = true;
+    race.error_ = rc;
+  }
+  race.wake();
+}
+
+} // namespace detail
+
+inline task<socket> socket::connect(std::shared_ptr<event_loop> loop,
+                                    std::vector<ip_address> addresses,
+                                    bool direct,
+                                    std::chrono::milliseconds attempt_delay) {
+  if (addresses.empty()) [[unlikely]] {
+    throw_with("failed to connect: no address");
+  }
+  direct = direct || loop->fixed_files_required();
+  detail::interleave_families(addresses);
+  detail::connect_race race;
+  race.fds_.assign(addresses.size(), -1);
+  std::vector<task<void>> attempts;
+  attempts.reserve(addresses.size());
+  for (size_t i = 0; i < addresses.size() && !race.winner_; ++i) {
+    ++race.in_flight_;
+    race.failed_ = false;
+    attempts.push_back(
+        detail::connect_attempt(loop, addresses[i], direct, race, i));
+    bool last = i + 1 == addresses.size();
+    if (!last) {
+      loop->add_timer(&race.delay_,
+                      std::chrono::steady_clock::now() + attempt_delay);
+    }
+    while (!race.winner_ && race.in_flight_ > 0 && !race.failed_ &&
+           (last || race.delay_.pending())) {
+      co_await detail::resume_awaitable{race.waiter_};
+    }
+    loop->cancel_timer(&race.delay_);
+  }
+  while (!race.winner_ && race.in_flight_ > 0) {
+    co_await detail::resume_awaitable{race.waiter_};
+  }
+  for (size_t i = 0; i < race.fds_.size(); ++i) {
+    int fd = race.fds_[i];
+    if (fd >= 0) {
+      int rc = co_await loop->cancel_fd(fd, direct);
+      (void)rc;
+    }
+  }
+  while (race.in_flight_ > 0) {
+    co_await detail::resume_awaitable{race.waiter_};
+  }
+  if (!race.winner_) {
+    throw_with("failed to connect: %s", ::strerror(-race.error_));
+  }
+  auto s = std::move(*race.winner_);
+  co_return s;
+}
+
 } // namespace uringpp
\ No newline at end of file
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <liburing.h>
+#include <vector>
+
+#include "uringpp/awaitable.h"
+#include "uringpp/error.h"
+#include "uringpp/detail/noncopyable.h"
+#include "uringpp/detail/user_data.h"
+
+namespace uringpp {
+
+/**
+ * @brief A chain of operations linked with IOSQE_IO_LINK, or
+ * IOSQE_IO_HARDLINK, executed by the kernel one after another. With soft
+ * links the requests following a failed one complete with -ECANCELED.
+ *
+ * The kernel completes the requests of a chain in order, so awaiting the
+ * chain suspends once and resumes on the completion of its last request with
+ * the results of all of them. Chains are created by event_loop::chain(),
+ * which reserves SQ entries so that the chain is never split by a submission.
+ */
+class sqe_chain : public noncopyable {
+  std::vector<sqe_awaitable> ops_;
+  size_t capacity_;
+  uint8_t link_flag_;
+
+public:
+  /**
+   * @brief Construct a new, empty chain.
+   *
+   * @param capacity The number of operations to be added.
+   * @param hard Whether to link with IOSQE_IO_HARDLINK, which does not break
+   * the chain on errors.
+   */
+  explicit sqe_chain(size_t capacity, bool hard = false)
+      : capacity_(capacity),
+        link_flag_(hard ? IOSQE_IO_HARDLINK : IOSQE_IO_LINK) {
+    ops_.reserve(capacity);
+  }
+
+  /**
+   * @brief Append an operation. It must be the last one prepared on the loop
+   * and is awaited through the chain. Operations the loop runs as a blocking
+   * call off the loop cannot be linked and are rejected, as are operations
+   * beyond the capacity of the chain, which might not fit in the SQ.
+   *
+   * @param op The operation.
+   * @return sqe_chain& The chain.
+   */
+  sqe_chain &add(sqe_awaitable op) {
+    if (op.sqe_ == nullptr) [[unlikely]] {
+      delete op.call_;
+      throw_with("cannot link an op the kernel does not support");
+    }
+    if (ops_.size() == capacity_) [[unlikely]] {
+      /* The SQE is already queued: turn it into a nop nobody waits for. */
+      ::io_uring_prep_nop(op.sqe_);
+      ::io_uring_sqe_set_data64(op.sqe_, detail::kDetachedUserData);
+      throw_with("chain of %zu ops is full", capacity_);
+    }
+    if (!ops_.empty()) {
+      ops_.back().sqe_->flags |= link_flag_;
+    }
+    ops_.push_back(op);
+    return *this;
+  }
+
+  /**
+   * @brief Get the number of operations.
+   *
+   * @return size_t The number of operations.
+   */
+  size_t size() const { return ops_.size(); }
+
+  bool await_ready() noexcept { return ops_.empty(); }
+
+  bool await_suspend(std::coroutine_handle<> h) {
+    /* The ops are not awaited one by one, so stand in for their
+     * await_suspend. */
+#ifdef URINGPP_METRICS
+    auto now = detail::monotonic_ns();
+#endif
+    for (auto &op : ops_) {
+      op.h_ = std::noop_coroutine();
+#ifdef URINGPP_METRICS
+      op.opcode_ = op.sqe_->opcode;
+      op.start_ns_ = now;
+#endif
+      ::io_uring_sqe_set_data(op.sqe_, &op);
+    }
+    ops_.back().h_ = h;
+    return true;
+  }
+
+  /**
+   * @brief Get the results of the operations, in the order they were added.
+   *
+   * @return std::vector<int> The result of each operation.
+   */
+  std::vector<int> await_resume() {
+    std::vector<int> results;
+    results.reserve(ops_.size());
+    for (auto const &op : ops_) {
+      results.push_back(op.rc_);
+    }
+    return results;
+  }
+};
+
+} // namespace uringpp
@@ -0,0 +1,581 @@
+#pragma once
+
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "uringpp/error.h"
+#include "uringpp/event_loop.h"
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+namespace detail {
+
+/**
+ * @brief Synchronization between coroutines of a single loop. Nothing is
+ * locked and waiters are resumed inline by the coroutine waking them.
+ *
+ */
+struct local_sync {
+  struct lock_type {
+    void lock() noexcept {}
+    void unlock() noexcept {}
+  };
+
+  struct waiter {
+    waiter *next_;
+    std::coroutine_handle<> h_;
+
+    void prepare(std::coroutine_handle<> h) { h_ = h; }
+
+    void wake() { h_.resume(); }
+  };
+};
+
+/**
+ * @brief Synchronization between coroutines of any loops. The state is
+ * guarded by a mutex and waiters are sent back to the loop they suspended
+ * on, through the rings if possible, unless woken from that loop. Waiting
+ * throws unless the calling thread is running a loop.
+ *
+ */
+struct cross_loop_sync {
+  using lock_type = std::mutex;
+
+  struct waiter {
+    waiter *next_;
+    event_loop::message m_;
+
+    void prepare(std::coroutine_handle<> h) {
+      m_ = {nullptr, h, event_loop::current()};
+      if (m_.target_ == nullptr) [[unlikely]] {
+        throw_with("cross-loop waiters must run on a loop");
+      }
+    }
+
+    void wake() {
+      if (event_loop::current() == m_.target_) {
+        m_.h_.resume();
+      } else {
+        event_loop::send_to_target(&m_);
+      }
+    }
+  };
+};
+
+/**
+ * @brief An intrusive FIFO of waiters living in the frames of the suspended
+ * coroutines, so that waiting needs no allocation.
+ *
+ */
+template <class Waiter> class waiter_list {
+  Waiter *head_ = nullptr;
+  Waiter *tail_ = nullptr;
+
+public:
+  bool empty() const { return head_ == nullptr; }
+
+  void push_back(Waiter *w) {
+    w->next_ = nullptr;
+    if (tail_ != nullptr) {
+      tail_->next_ = w;
+    } else {
+      head_ = w;
+    }
+    tail_ = w;
+  }
+
+  Waiter *pop_front() {
+    auto w = head_;
+    head_ = static_cast<Waiter *>(w->next_);
+    if (head_ == nullptr) {
+      tail_ = nullptr;
+    }
+    return w;
+  }
+
+  /* Wake all waiters, e.g. once moved out of the lock. */
+  void wake_all() {
+    while (!empty()) {
+      pop_front()->wake();
+    }
+  }
+};
+
+} // namespace detail
+
+/**
+ * @brief A mutex for coroutines. Waiters are queued in FIFO order and the
+ * mutex is handed over to the next one on unlock, so a coroutine locking in
+ * a loop cannot starve the others.
+ *
+ * @tparam Sync detail::local_sync for coroutines of one loop, see
+ * async_mutex, or detail::cross_loop_sync for any loops, see
+ * cross_loop_mutex.
+ */
+template <class Sync> class basic_async_mutex : public noncopyable {
+  using waiter = typename Sync::waiter;
+  typename Sync::lock_type lock_;
+  bool locked_ = false;
+  detail::waiter_list<waiter> waiters_;
+
+public:
+  /**
+   * @brief Holds the mutex and unlocks it when destroyed.
+   *
+   */
+  class guard : public noncopyable {
+    basic_async_mutex *mutex_;
+
+  public:
+    explicit guard(basic_async_mutex *mutex) : mutex_(mutex) {}
+
+    guard(guard &&other) noexcept
+        : mutex_(std::exchange(other.mutex_, nullptr)) {}
+
+    /**
+     * @brief Unlock the mutex before destruction.
+     *
+     */
+    void unlock() {
+      if (mutex_ != nullptr) {
+        std::exchange(mutex_, nullptr)->unlock();
+      }
+    }
+
+    ~guard() { unlock(); }
+  };
+
+  /**
+   * @brief Wait for the mutex.
+   *
+   * @return An awaitable resolving to the guard. It does not suspend if the
+   * mutex is free.
+   */
+  auto lock() {
+    struct awaitable {
+      basic_async_mutex *mutex_;
+      waiter waiter_;
+      bool await_ready() noexcept { return false; }
+      bool await_suspend(std::coroutine_handle<> h) {
+        std::lock_guard lock(mutex_->lock_);
+        if (!mutex_->locked_) {
+          mutex_->locked_ = true;
+          return false;
+        }
+        waiter_.prepare(h);
+        mutex_->waiters_.push_back(&waiter_);
+        return true;
+      }
+      guard await_resume() noexcept { return guard(mutex_); }
+    };
+    return awaitable{this, {}};
+  }
+
+  /**
+   * @brief Lock the mutex if it is free.
+   *
+   * @return std::optional<guard> The guard, or std::nullopt if the mutex is
+   * held.
+   */
+  std::optional<guard> try_lock() {
+    std::lock_guard lock(lock_);
+    if (locked_) {
+      return std::nullopt;
+    }
+    locked_ = true;
+    return std::optional<guard>(std::in_place, this);
+  }
+
+  /**
+   * @brief Unlock the mutex, handing it over to the next waiter. Prefer
+   * letting a guard go out of scope.
+   *
+   */
+  void unlock() {
+    waiter *next = nullptr;
+    {
+      std::lock_guard lock(lock_);
+      assert(locked_);
+      if (waiters_.empty()) {
+        locked_ = false;
+      } else {
+        next = waiters_.pop_front();
+      }
+    }
+    if (next != nullptr) {
+      next->wake();
+    }
+  }
+};
+
+/**
+ * @brief A counting semaphore for coroutines. Waiters are served in FIFO
+ * order. io_queue is the variant handing out RAII permits, e.g. to cap the
+ * requests in flight to a device.
+ *
+ * @tparam Sync detail::local_sync for coroutines of one loop, see
+ * async_semaphore, or detail::cross_loop_sync for any loops, see
+ * cross_loop_semaphore.
+ */
+template <class Sync> class basic_async_semaphore : public noncopyable {
+  using waiter = typename Sync::waiter;
+  typename Sync::lock_type lock_;
+  size_t count_;
+  detail::waiter_list<waiter> waiters_;
+
+public:
+  /**
+   * @brief Construct a new semaphore object
+   *
+   * @param count The initial count.
+   */
+  explicit basic_async_semaphore(size_t count) : count_(count) {}
+
+  /**
+   * @brief Wait until the count is positive and decrement it.
+   *
+   * @return An awaitable which does not suspend if the count is positive and
+   * nobody is waiting.
+   */
+  auto acquire() {
+    struct awaitable {
+      basic_async_semaphore *sem_;
+      waiter waiter_;
+      bool await_ready() noexcept { return false; }
+      bool await_suspend(std::coroutine_handle<> h) {
+        std::lock_guard lock(sem_->lock_);
+        if (sem_->count_ > 0 && sem_->waiters_.empty()) {
+          --sem_->count_;
+          return false;
+        }
+        waiter_.prepare(h);
+        sem_->waiters_.push_back(&waiter_);
+        return true;
+      }
+      void await_resume() noexcept {}
+    };
+    return awaitable{this, {}};
+  }
+
+  /**
+   * @brief Decrement the count if it is positive and nobody is waiting.
+   *
+   * @return true if the count was decremented.
+   */
+  bool try_acquire() {
+    std::lock_guard lock(lock_);
+    if (count_ > 0 && waiters_.empty()) {
+      --count_;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Increment the count, waking as many waiters.
+   *
+   * @param n The increment.
+   */
+  void release(size_t n = 1) {
+    detail::waiter_list<waiter> woken;
+    {
+      std::lock_guard lock(lock_);
+      count_ += n;
+      while (count_ > 0 && !waiters_.empty()) {
+        --count_;
+        woken.push_back(waiters_.pop_front());
+      }
+    }
+    woken.wake_all();
+  }
+
+  /**
+   * @brief Get the count.
+   *
+   * @return size_t The count, which may be stale for cross-loop semaphores.
+   */
+  size_t available() {
+    std::lock_guard lock(lock_);
+    return count_;
+  }
+};
+
+/**
+ * @brief An event coroutines wait for until it is set. It stays set, and
+ * waiting does not suspend, until reset.
+ *
+ * @tparam Sync detail::local_sync for coroutines of one loop, see
+ * async_event, or detail::cross_loop_sync for any loops, see
+ * cross_loop_event.
+ */
+template <class Sync> class basic_async_event : public noncopyable {
+  using waiter = typename Sync::waiter;
+  typename Sync::lock_type lock_;
+  bool set_ = false;
+  detail::waiter_list<waiter> waiters_;
+
+public:
+  /**
+   * @brief Wait for the event to be set.
+   *
+   * @return An awaitable which does not suspend if the event is set.
+   */
+  auto wait() {
+    struct awaitable {
+      basic_async_event *event_;
+      waiter waiter_;
+      bool await_ready() noexcept { return false; }
+      bool await_suspend(std::coroutine_handle<> h) {
+        std::lock_guard lock(event_->lock_);
+        if (event_->set_) {
+          return false;
+        }
+        waiter_.prepare(h);
+        event_->waiters_.push_back(&waiter_);
+        return true;
+      }
+      void await_resume() noexcept {}
+    };
+    return awaitable{this, {}};
+  }
+
+  /**
+   * @brief Set the event, waking all waiters.
+   *
+   */
+  void set() {
+    detail::waiter_list<waiter> woken;
+    {
+      std::lock_guard lock(lock_);
+      set_ = true;
+      std::swap(woken, waiters_);
+    }
+    woken.wake_all();
+  }
+
+  /**
+   * @brief Reset the event, so that coroutines wait again.
+   *
+   */
+  void reset() {
+    std::lock_guard lock(lock_);
+    set_ = false;
+  }
+
+  /**
+   * @brief Whether the event is set.
+   *
+   */
+  bool is_set() {
+    std::lock_guard lock(lock_);
+    return set_;
+  }
+};
+
+/**
+ * @brief A bounded channel between coroutines. Senders wait while the
+ * channel is full and receivers while it is empty; values are handed over
+ * directly to a waiting receiver. The buffer is allocated once, so sending
+ * and receiving allocate nothing.
+ *
+ * @tparam T The type of the values.
+ * @tparam Sync detail::local_sync for coroutines of one loop, see channel,
+ * or detail::cross_loop_sync for any loops, see cross_loop_channel.
+ */
+template <class T, class Sync> class basic_channel : public noncopyable {
+  struct sender : Sync::waiter {
+    std::optional<T> value_;
+    bool sent_ = false;
+  };
+
+  struct receiver : Sync::waiter {
+    std::optional<T> value_;
+  };
+
+  typename Sync::lock_type lock_;
+  std::vector<std::optional<T>> buffer_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+  bool closed_ = false;
+  detail::waiter_list<sender> senders_;
+  detail::waiter_list<receiver> receivers_;
+
+  void push(T value) {
+    buffer_[(head_ + size_) % buffer_.size()].emplace(std::move(value));
+    ++size_;
+  }
+
+  T pop() {
+    auto &slot = buffer_[head_];
+    T value = std::move(*slot);
+    slot.reset();
+    head_ = (head_ + 1) % buffer_.size();
+    --size_;
+    return value;
+  }
+
+public:
+  /**
+   * @brief Construct a new channel object
+   *
+   * @param capacity The number of values buffered before senders wait. With
+   * 0, every send waits for a receiver.
+   */
+  explicit basic_channel(size_t capacity) : buffer_(capacity) {}
+
+  /**
+   * @brief Send a value.
+   *
+   * @param value The value.
+   * @return An awaitable resolving to false if the channel is closed, in
+   * which case the value is dropped. It does not suspend while the channel
+   * has room.
+   */
+  auto send(T value) {
+    struct awaitable {
+      basic_channel *channel_;
+      sender sender_;
+      bool await_ready() noexcept { return false; }
+      bool await_suspend(std::coroutine_handle<> h) {
+        auto *c = channel_;
+        receiver *r = nullptr;
+        {
+          std::lock_guard lock(c->lock_);
+          if (c->closed_) {
+            return false;
+          }
+          if (!c->receivers_.empty()) {
+            r = c->receivers_.pop_front();
+            r->value_ = std::move(sender_.value_);
+          } else if (c->size_ < c->buffer_.size()) {
+            c->push(std::move(*sender_.value_));
+          } else {
+            sender_.prepare(h);
+            c->senders_.push_back(&sender_);
+            return true;
+          }
+          sender_.sent_ = true;
+        }
+        if (r != nullptr) {
+          r->wake();
+        }
+        return false;
+      }
+      bool await_resume() noexcept { return sender_.sent_; }
+    };
+    awaitable a{this, {}};
+    a.sender_.value_.emplace(std::move(value));
+    return a;
+  }
+
+  /**
+   * @brief Receive a value.
+   *
+   * @return An awaitable resolving to the value, or std::nullopt once the
+   * channel is closed and drained. It does not suspend while the channel
+   * holds values.
+   */
+  auto recv() {
+    struct awaitable {
+      basic_channel *channel_;
+      receiver receiver_;
+      bool await_ready() noexcept { return false; }
+      bool await_suspend(std::coroutine_handle<> h) {
+        auto *c = channel_;
+        sender *s = nullptr;
+        {
+          std::lock_guard lock(c->lock_);
+          if (c->size_ > 0) {
+            receiver_.value_.emplace(c->pop());
+            if (!c->senders_.empty()) {
+              s = c->senders_.pop_front();
+              c->push(std::move(*s->value_));
+            }
+          } else if (!c->senders_.empty()) {
+            s = c->senders_.pop_front();
+            receiver_.value_ = std::move(s->value_);
+          } else if (!c->closed_) {
+            receiver_.prepare(h);
+            c->receivers_.push_back(&receiver_);
+            return true;
+          }
+          if (s != nullptr) {
+            s->sent_ = true;
+          }
+        }
+        if (s != nullptr) {
+          s->wake();
+        }
+        return false;
+      }
+      std::optional<T> await_resume() noexcept {
+        return std::move(receiver_.value_);
+      }
+    };
+    return awaitable{this, {}};
+  }
+
+  /**
+   * @brief Close the channel. Waiting receivers get std::nullopt and waiting
+   * senders false; buffered values can still be received.
+   *
+   */
+  void close() {
+    detail::waiter_list<sender> senders;
+    detail::waiter_list<receiver> receivers;
+    {
+      std::lock_guard lock(lock_);
+      closed_ = true;
+      std::swap(senders, senders_);
+      std::swap(receivers, receivers_);
+    }
+    senders.wake_all();
+    receivers.wake_all();
+  }
+
+  /**
+   * @brief Get the number of buffered values.
+   *
+   * @return size_t The number of values, which may be stale for cross-loop
+   * channels.
+   */
+  size_t size() {
+    std::lock_guard lock(lock_);
+    return size_;
+  }
+
+  /**
+   * @brief Get the number of values buffered before senders wait.
+   *
+   * @return size_t The capacity.
+   */
+  size_t capacity() const { return buffer_.size(); }
+};
+
+/** @brief A mutex for coroutines of one loop; it is not synchronized. */
+using async_mutex = basic_async_mutex<detail::local_sync>;
+/** @brief A semaphore for coroutines of one loop; it is not synchronized. */
+using async_semaphore = basic_async_semaphore<detail::local_sync>;
+/** @brief An event for coroutines of one loop; it is not synchronized. */
+using async_event = basic_async_event<detail::local_sync>;
+/** @brief A channel for coroutines of one loop; it is not synchronized. */
+template <class T> using channel = basic_channel<T, detail::local_sync>;
+
+/** @brief A mutex shared by coroutines of several loops. */
+using cross_loop_mutex = basic_async_mutex<detail::cross_loop_sync>;
+/** @brief A semaphore shared by coroutines of several loops. */
+using cross_loop_semaphore = basic_async_semaphore<detail::cross_loop_sync>;
+/** @brief An event shared by coroutines of several loops. */
+using cross_loop_event = basic_async_event<detail::cross_loop_sync>;
+/** @brief A channel shared by coroutines of several loops. */
+template <class T>
+using cross_loop_channel = basic_channel<T, detail::cross_loop_sync>;
+
+} // namespace uringpp
@@ -3,51 +3,98 @@
 #include <cassert>
 #include <coroutine>
 #include <exception>
-#include <functional>
-#include <future>
 #include <utility>
+#include <variant>
+
+#include "uringpp/frame_allocator.h"
 
 #include "uringpp/detail/debug.h"
 
 namespace uringpp {
 
+namespace detail {
+
+/* A detached task has no awaiter to rethrow to, so its exception is logged
+ * rather than dropped. */
+inline void log_detached_exception(std::exception_ptr e) noexcept {
+  try {
+    std::rethrow_exception(e);
+  } catch (std::exception const &ex) {
+    URINGPP_LOG_ERROR("detached task threw: %s", ex.what());
+  } catch (...) {
+    URINGPP_LOG_ERROR("detached task threw a non-standard exception");
+  }
+}
+
+} // namespace detail
+
+/**
+ * @brief Stores the result of a task inline in its promise. Tasks never cross
+ * threads, so no synchronization is needed.
+ *
+ */
 template <class T> class value_returner {
 public:
-  std::promise<T> promise_;
-  void return_value(T &&value) { promise_.set_value(std::forward<T>(value)); }
+  std::variant<std::monostate, T, std::exception_ptr> result_;
+  template <class U> void return_value(U &&value) {
+    result_.template emplace<1>(std::forward<U>(value));
+  }
+  void set_exception(std::exception_ptr e) {
+    result_.template emplace<2>(std::move(e));
+  }
+  std::exception_ptr exception() const {
+    auto e = std::get_if<2>(&result_);
+    return e != nullptr ? *e : nullptr;
+  }
+  T get_result() {
+    if (auto e = std::get_if<2>(&result_)) [[unlikely]] {
+      std::rethrow_exception(*e);
+    }
+    assert(result_.index() == 1);
+    return std::move(*std::get_if<1>(&result_));
+  }
 };
 
 template <> class value_returner<void> {
 public:
-  std::promise<void> promise_;
-  void return_void() { promise_.set_value(); }
+  std::exception_ptr exception_;
+  void return_void() {}
+  void set_exception(std::exception_ptr e) { exception_ = std::move(e); }
+  std::exception_ptr exception() const { return exception_; }
+  void get_result() {
+    if (exception_) [[unlikely]] {
+      std::rethrow_exception(exception_);
+    }
+  }
 };
 
 template <class T, class CoroutineHandle>
-struct promise_base : public value_returner<T> {
+struct promise_base : public value_returner<T>, public pooled_frame {
   std::suspend_never initial_suspend() { return {}; }
   auto final_suspend() noexcept {
     struct awaiter {
-      std::coroutine_handle<> release_detached_;
       bool await_ready() noexcept { return false; }
       std::coroutine_handle<>
       await_suspend(CoroutineHandle suspended) noexcept {
-        if (suspended.promise().continuation_) {
-          return suspended.promise().continuation_;
-        } else {
-          if (release_detached_) {
-            release_detached_.destroy();
+        auto &promise = suspended.promise();
+        if (promise.continuation_) {
+          return promise.continuation_;
+        }
+        if (promise.detached_) {
+          if (auto e = promise.exception()) [[unlikely]] {
+            detail::log_detached_exception(std::move(e));
           }
-          return std::noop_coroutine();
+          suspended.destroy();
         }
+        return std::noop_coroutine();
       }
       void await_resume() noexcept {}
     };
-    return awaiter{release_detached_};
+    return awaiter{};
   }
 
   std::coroutine_handle<> continuation_;
-  std::coroutine_handle<> release_detached_;
+  bool detached_ = false;
 };
 
 template <class T> struct task {
@@ -57,35 +104,33 @@ template <class T> struct task {
       return std::coroutine_handle<promise_type>::from_promise(*this);
     }
     void unhandled_exception() {
-      this->promise_.set_exception(std::current_exception());
-    }
-    promise_type() : future_(this->promise_.get_future()) {}
-    std::future<T> &get_future() { return future_; }
-    void set_detached_task(std::coroutine_handle<promise_type> h) {
-      this->release_detached_ = h;
+      this->set_exception(std::current_exception());
     }
-    std::future<T> future_;
   };
 
   struct task_awaiter {
     std::coroutine_handle<promise_type> h_;
     task_awaiter(std::coroutine_handle<promise_type> h) : h_(h) {}
     bool await_ready() { return h_.done(); }
-    auto await_suspend(std::coroutine_handle<> suspended) {
+    void await_suspend(std::coroutine_handle<> suspended) {
       h_.promise().continuation_ = suspended;
     }
-    auto await_resume() { return h_.promise().future_.get(); }
+    T await_resume() { return h_.promise().get_result(); }
   };
 
   using coroutine_handle_type = std::coroutine_handle<promise_type>;
 
   auto operator co_await() const { return task_awaiter(h_); }
 
+  /**
+   * @brief Destroy the task object. A task which has not finished yet keeps
+   * running and frees itself when done, as if it had been detached.
+   *
+   */
   ~task() {
     if (!detached_) {
       if (!h_.done()) {
-        h_.promise().set_detached_task(h_);
-        get_future().get();
+        h_.promise().detached_ = true;
       } else {
         h_.destroy();
       }
@@ -98,12 +143,18 @@ template <class T> struct task {
   coroutine_handle_type h_;
   bool detached_;
   operator coroutine_handle_type() const { return h_; }
-  std::future<T> &get_future() const { return h_.promise().get_future(); }
   void detach() {
     assert(!detached_);
-    h_.promise().set_detached_task(h_);
+    if (h_.done()) {
+      if (auto e = h_.promise().exception()) [[unlikely]] {
+        detail::log_detached_exception(std::move(e));
+      }
+      h_.destroy();
+    } else {
+      h_.promise().detached_ = true;
+    }
     detached_ = true;
   }
 };
 
-} // namespace uringpp
\ No newline at end of file
+} // namespace uringpp
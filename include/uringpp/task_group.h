@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <utility>
+
+#include "uringpp/task.h"
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief A nursery owning child tasks, so that a scope can fan out work and
+ * not return before all of it is done. Children are joined with join(), or
+ * by task_group::run() once its body returns or throws. The first exception
+ * thrown by a child is rethrown by the join, after all children are done.
+ *
+ * A group belongs to a single loop; it is not synchronized.
+ */
+class task_group : public noncopyable {
+  size_t pending_ = 0;
+  std::exception_ptr error_;
+  std::coroutine_handle<> joiner_;
+
+  template <class T> static task<void> child(task<T> t, task_group *group) {
+    try {
+      co_await t;
+    } catch (...) {
+      if (!group->error_) {
+        group->error_ = std::current_exception();
+      }
+    }
+    if (--group->pending_ == 0 && group->joiner_) {
+      std::exchange(group->joiner_, nullptr).resume();
+    }
+  }
+
+public:
+  task_group() = default;
+
+  /**
+   * @brief Add a running task to the group. Its result is dropped.
+   *
+   * @param t The task.
+   */
+  template <class T> void spawn(task<T> t) {
+    ++pending_;
+    child(std::move(t), this).detach();
+  }
+
+  /**
+   * @brief Get the number of children still running.
+   *
+   * @return size_t The number of children.
+   */
+  size_t size() const { return pending_; }
+
+  /**
+   * @brief Wait for all children, including those spawned while waiting.
+   * Only one coroutine may join at a time.
+   *
+   * @return An awaitable which rethrows the first exception of a child. It
+   * does not suspend if no child is running.
+   */
+  auto join() {
+    struct awaitable {
+      task_group *group_;
+      bool await_ready() noexcept { return group_->pending_ == 0; }
+      void await_suspend(std::coroutine_handle<> h) noexcept {
+        assert(!group_->joiner_);
+        group_->joiner_ = h;
+      }
+      void await_resume() {
+        if (auto e = std::exchange(group_->error_, nullptr)) {
+          std::rethrow_exception(e);
+        }
+      }
+    };
+    return awaitable{this};
+  }
+
+  /**
+   * @brief Run a body with a new group and join its children when the body
+   * is done, even if it throws. An exception of the body wins over those of
+   * the children.
+   *
+   * @param body A callable taking the group by reference and returning a
+   * task.
+   * @return task<void>
+   */
+  template <class F> static task<void> run(F body) {
+    task_group group;
+    std::exception_ptr error;
+    try {
+      co_await body(group);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    try {
+      co_await group.join();
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  /**
+   * @brief Destroy the task group object. Its children must have been
+   * joined, as they may refer to the scope of the group.
+   *
+   */
+  ~task_group() { assert(pending_ == 0); }
+};
+
+} // namespace uringpp
@@ -3,38 +3,163 @@
 #include <memory>
 #include <stdexcept>
 #include <sys/socket.h>
+#include <unistd.h>
 #include <utility>
 
 #include "uringpp/event_loop.h"
 #include "uringpp/ip_address.h"
+#include "uringpp/multishot.h"
 #include "uringpp/socket.h"
 
 namespace uringpp {
 
-static inline std::string get_in_addr_string(struct addrinfo *ai) {
-  char s[INET6_ADDRSTRLEN];
-  inet_ntop(ai->ai_family, get_in_addr(ai->ai_addr), s, sizeof(s));
-  return s;
-}
+/**
+ * @brief A stream of connections accepted by a single multishot accept. The
+ * SQE stays armed across connections, so accepting does not cost a submission
+ * or a coroutine frame per connection. On kernels without multishot accepts
+ * a single-shot accept is re-armed after every connection instead.
+ *
+ */
+class accept_stream : public noncopyable {
+  class operation : public multishot_operation {
+    event_loop *loop_;
+    int fd_;
+    bool direct_;
+    uint8_t sqe_flags_;
+
+  protected:
+    void prep(struct io_uring_sqe *sqe) override {
+      /* Without multishot support a single-shot accept is re-armed by the
+       * loop after each connection, as restart() holds for it. */
+      if (!loop_->has_multishot_accept()) {
+        if (direct_) {
+          ::io_uring_prep_accept_direct(sqe, fd_, nullptr, nullptr, 0,
+                                        IORING_FILE_INDEX_ALLOC);
+        } else {
+          ::io_uring_prep_accept(sqe, fd_, nullptr, nullptr, 0);
+        }
+      } else if (direct_) {
+        ::io_uring_prep_multishot_accept_direct(sqe, fd_, nullptr, nullptr, 0);
+      } else {
+        ::io_uring_prep_multishot_accept(sqe, fd_, nullptr, nullptr, 0);
+      }
+      sqe->flags |= sqe_flags_;
+    }
+
+    void discard(int res, uint32_t) override {
+      if (res < 0) {
+        return;
+      }
+      if (direct_) {
+        loop_->close_direct_detach(res);
+      } else {
+        ::close(res);
+      }
+    }
+
+  public:
+    operation(event_loop *loop, int fd, bool direct, uint8_t sqe_flags)
+        : loop_(loop), fd_(fd), direct_(direct), sqe_flags_(sqe_flags) {}
+  };
+
+  std::shared_ptr<event_loop> loop_;
+  operation *op_;
+  bool direct_;
+
+public:
+  /**
+   * @brief Start accepting connections on a listening socket.
+   *
+   * @param loop The event loop.
+   * @param fd The file descriptor of the listening socket.
+   * @param direct Whether to install accepted sockets as direct descriptors
+   * into the registered file table instead of the process fd table. The loop
+   * must have a sparse file table registered. Always set if the loop requires
+   * fixed files.
+   * @param sqe_flags The SQE flags to use, e.g. IOSQE_FIXED_FILE if fd is a
+   * direct descriptor.
+   */
+  accept_stream(std::shared_ptr<event_loop> loop, int fd, bool direct,
+                uint8_t sqe_flags = 0)
+      : loop_(loop), direct_(direct || loop->fixed_files_required()) {
+    op_ = new operation(loop_.get(), fd, direct_, sqe_flags);
+    loop_->arm_multishot(op_);
+  }
+
+  /**
+   * @brief Move construct a new accept stream object
+   *
+   * @param other
+   */
+  accept_stream(accept_stream &&other) noexcept
+      : loop_(std::move(other.loop_)), op_(std::exchange(other.op_, nullptr)),
+        direct_(other.direct_) {}
+
+  /**
+   * @brief Wait for the next accepted connection.
+   *
+   * @return An awaitable resolving to the accepted socket. Errors are thrown.
+   */
+  auto next() {
+    struct awaitable : multishot_operation::completion_awaitable {
+      std::shared_ptr<event_loop> loop_;
+      bool direct_;
+      socket await_resume() {
+        auto c = completion_awaitable::await_resume();
+        if (!c) {
+          throw std::runtime_error("accept stream terminated");
+        }
+        check_nerrno(c->res, "failed to accept connection");
+        return socket(loop_, c->res, direct_);
+      }
+    };
+    return awaitable{op_->next(), loop_, direct_};
+  }
+
+  /**
+   * @brief Destroy the accept stream object. The pending multishot accept is
+   * cancelled and connections accepted but not yet consumed are closed.
+   *
+   */
+  ~accept_stream() {
+    if (op_ != nullptr) {
+      loop_->release_multishot(op_);
+    }
+  }
+};
 
 /**
- * @brief Listen for incoming TCP connections on a socket.
+ * @brief Listen for incoming TCP connections on a socket. If the loop requires
+ * fixed files, the socket is a direct descriptor and so are the accepted
+ * sockets.
  *
  */
 class tcp_listener : public noncopyable {
   std::shared_ptr<event_loop> loop_;
   int fd_;
-  tcp_listener(std::shared_ptr<event_loop> loop, int fd)
-      : loop_(loop), fd_(fd) {}
+  bool fixed_;
+  tcp_listener(std::shared_ptr<event_loop> loop, int fd, bool fixed)
+      : loop_(loop), fd_(fd), fixed_(fixed) {}
+
+  uint8_t sqe_flags() const { return fixed_ ? IOSQE_FIXED_FILE : 0; }
 
 public:
   /**
-   * @brief Get the file descriptor of the listener.
+   * @brief Get the file descriptor of the listener. For a direct descriptor
+   * this is its index in the registered file table.
    *
    * @return int The file descriptor of the listener.
    */
   int fd() const { return fd_; }
 
+  /**
+   * @brief Whether the listener is a direct descriptor, i.e. it only lives in
+   * the registered file table of the loop.
+   *
+   * @return bool True if the listener is a direct descriptor.
+   */
+  bool fixed() const { return fixed_; }
+
   /**
    * @brief Listen for incoming TCP connections on the given address. It will
    * create a socket and bind it to the given address.
@@ -42,11 +167,16 @@ public:
    * @param loop The event loop to use.
    * @param hostname The hostname to listen on.
    * @param port The port to listen on.
+   * @param backlog The maximum length of the pending connections queue.
+   * @param reuse_port Whether to set SO_REUSEPORT, so that several listeners,
+   * e.g. one per loop of a runtime, can bind the same address and have the
+   * kernel balance connections between them.
    * @return listener The listener object
    */
   static tcp_listener listen(std::shared_ptr<event_loop> loop,
                              std::string const &hostname,
-                             std::string const &port, int backlog = 128) {
+                             std::string const &port, int backlog = 128,
+                             bool reuse_port = false) {
     struct addrinfo hints, *servinfo, *p;
     ::bzero(&hints, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
@@ -67,13 +197,30 @@ public:
           check_rc(
               ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)),
               "failed to set reuse address");
+          if (reuse_port) {
+            check_errno(::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes,
+                                     sizeof(yes)),
+                        "failed to set reuse port");
+          }
         }
         auto const &ip = get_in_addr_string(p);
         check_errno(::bind(fd, p->ai_addr, p->ai_addrlen), "failed to bind");
         check_errno(::listen(fd, backlog), "failed to listen");
+        bool fixed = loop->fixed_files_required();
+        if (fixed) {
+          int slot;
+          try {
+            slot = loop->files().install(fd);
+          } catch (...) {
+            ::close(fd);
+            throw;
+          }
+          ::close(fd);
+          fd = slot;
+        }
         URINGPP_LOG_DEBUG("binding %s:%s", ip.c_str(), port.c_str());
         ::freeaddrinfo(servinfo);
-        return tcp_listener(loop, fd);
+        return tcp_listener(loop, fd, fixed);
       } catch (std::runtime_error &e) {
         URINGPP_LOG_ERROR("%s", e.what());
         continue;
@@ -89,24 +236,33 @@ public:
    * @param other
    */
   tcp_listener(tcp_listener &&other) noexcept
-      : loop_(std::move(other.loop_)), fd_(std::exchange(other.fd_, -1)) {}
+      : loop_(std::move(other.loop_)), fd_(std::exchange(other.fd_, -1)),
+        fixed_(other.fixed_) {}
 
   /**
-   * @brief Accept an incoming connection.
+   * @brief Accept an incoming connection. If the loop requires fixed files, it
+   * is accepted as by accept_direct().
    *
    * @return task<std::pair<ip_address, socket>> A pair of the remote address
    * and the accepted socket
    */
   task<std::pair<ip_address, socket>> accept() {
+    if (loop_->fixed_files_required()) {
+      auto accepted = co_await accept_direct();
+      co_return accepted;
+    }
     ip_address addr;
     auto fd = co_await loop_->accept(
-        fd_, reinterpret_cast<struct sockaddr *>(&addr.ss_), &addr.len_);
+        fd_, reinterpret_cast<struct sockaddr *>(&addr.ss_), &addr.len_, 0,
+        sqe_flags());
     check_nerrno(fd, "failed to accept connection");
     co_return std::make_pair(addr, socket(loop_, fd));
   }
 
   /**
    * @brief Accept an incoming connection and attach it with the specified loop.
+   * If that loop requires fixed files, the socket is installed into its file
+   * table, see socket(loop, fd).
    *
    * @return task<std::pair<ip_address, socket>> A pair of the remote address
    * and the accepted socket
@@ -114,18 +270,54 @@ public:
   task<std::pair<ip_address, socket>> accept(std::shared_ptr<event_loop> loop) {
     ip_address addr;
     auto fd = co_await loop_->accept(
-        fd_, reinterpret_cast<struct sockaddr *>(&addr.ss_), &addr.len_);
+        fd_, reinterpret_cast<struct sockaddr *>(&addr.ss_), &addr.len_, 0,
+        sqe_flags());
     check_nerrno(fd, "failed to accept connection");
     co_return std::make_pair(addr, socket(loop, fd));
   }
 
+  /**
+   * @brief Accept an incoming connection straight into a free slot of the
+   * registered file table of the loop.
+   *
+   * @return task<std::pair<ip_address, socket>> A pair of the remote address
+   * and the accepted socket holding a direct descriptor
+   */
+  task<std::pair<ip_address, socket>> accept_direct() {
+    ip_address addr;
+    auto slot = loop_->files().acquire();
+    auto rc = co_await loop_->accept_direct(
+        fd_, reinterpret_cast<struct sockaddr *>(&addr.ss_), &addr.len_, 0,
+        slot, sqe_flags());
+    if (rc < 0) [[unlikely]] {
+      loop_->files().release(slot);
+      check_nerrno(rc, "failed to accept connection");
+    }
+    co_return std::make_pair(addr, socket(loop_, slot, true));
+  }
+
+  /**
+   * @brief Accept incoming connections with a single multishot accept.
+   *
+   * @param direct Whether to install accepted sockets as direct descriptors.
+   * The kernel picks their slots from the allocation range of the loop's file
+   * table, see event_loop::register_files_sparse.
+   * @return accept_stream The stream of accepted sockets.
+   */
+  accept_stream accept_multishot(bool direct = false) {
+    return accept_stream(loop_, fd_, direct, sqe_flags());
+  }
+
   /**
    * @brief Close the listener.
    *
    * @return task<void>
    */
   task<void> close() {
-    if (fd_ > 0) {
+    if (fixed_ && fd_ >= 0) {
+      co_await loop_->close_direct(fd_);
+      loop_->files().release(std::exchange(fd_, -1));
+    } else if (fd_ > 0) {
       co_await loop_->close(fd_);
       fd_ = -1;
     }
@@ -137,7 +329,12 @@ public:
    *
    */
   ~tcp_listener() {
-    if (fd_ > 0) {
+    if (fd_ < 0) {
+      return;
+    }
+    if (fixed_) {
+      loop_->close_direct_detach(fd_);
+    } else if (fd_ > 0) {
       loop_->close_detach(fd_);
     }
   }
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include "uringpp/event_loop.h"
+#include "uringpp/timer_wheel.h"
+
+namespace uringpp {
+
+/**
+ * @brief A restartable timer on the timer wheel of a loop, e.g. the idle
+ * timeout of a connection pushed back on every read. Rescheduling only
+ * relinks the timer in the wheel and submits nothing.
+ *
+ */
+class timer : public timer_entry {
+  std::shared_ptr<event_loop> loop_;
+  std::function<void()> callback_;
+
+  void fire() override { callback_(); }
+
+public:
+  /**
+   * @brief Construct a new timer object, not scheduled.
+   *
+   * @param loop The loop whose timer wheel to use.
+   * @param callback Called on the loop when the timer fires.
+   */
+  timer(std::shared_ptr<event_loop> loop, std::function<void()> callback)
+      : loop_(std::move(loop)), callback_(std::move(callback)) {}
+
+  /**
+   * @brief Schedule the timer to fire at a deadline, replacing its previous
+   * deadline if pending.
+   *
+   * @param deadline The deadline.
+   */
+  void expires_at(std::chrono::steady_clock::time_point deadline) {
+    loop_->add_timer(this, deadline);
+  }
+
+  /**
+   * @brief Schedule the timer to fire after a duration, replacing its
+   * previous deadline if pending.
+   *
+   * @param duration The duration from now.
+   */
+  template <class Rep, class Period>
+  void expires_after(std::chrono::duration<Rep, Period> duration) {
+    expires_at(std::chrono::steady_clock::now() + duration);
+  }
+
+  /**
+   * @brief Cancel the timer if pending.
+   *
+   */
+  void cancel() { loop_->cancel_timer(this); }
+
+  ~timer() { cancel(); }
+};
+
+} // namespace uringpp
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief A timer scheduled on a timer wheel. It is linked into the wheel
+ * intrusively, so scheduling needs no allocation, and must stay alive while
+ * pending.
+ *
+ */
+class timer_entry : public noncopyable {
+  friend class timer_wheel;
+  timer_entry *prev_ = nullptr;
+  timer_entry *next_ = nullptr;
+  uint64_t when_ = 0;
+  uint8_t level_ = 0;
+  uint8_t slot_ = 0;
+  bool pending_ = false;
+
+protected:
+  /**
+   * @brief Called by the wheel once the timer expires. The timer is no longer
+   * pending and may be rescheduled.
+   *
+   */
+  virtual void fire() = 0;
+
+public:
+  /**
+   * @brief Whether the timer is scheduled and has not fired yet.
+   *
+   * @return true if the timer is pending.
+   */
+  bool pending() const { return pending_; }
+
+  /**
+   * @brief Get the tick the timer expires at.
+   *
+   * @return uint64_t The expiry tick.
+   */
+  uint64_t when() const { return when_; }
+
+  virtual ~timer_entry() = default;
+};
+
+/**
+ * @brief A hierarchical timer wheel. Each of the kLevels levels has kSlots
+ * slots, a slot of level n spanning kSlots^n ticks. A timer is put on the
+ * level of the highest slot-sized digit in which its expiry differs from the
+ * current tick and cascades down as the wheel advances, so scheduling,
+ * cancelling and finding the next expiry take constant time regardless of the
+ * number of timers.
+ *
+ * The wheel does not read the clock. The event loop advances it in
+ * millisecond ticks and arms a single kernel timeout for its next expiry.
+ */
+class timer_wheel : public noncopyable {
+public:
+  static constexpr unsigned kSlotBits = 6;
+  static constexpr unsigned kSlots = 1 << kSlotBits;
+  static constexpr unsigned kLevels = 6;
+  static constexpr uint64_t kNever = UINT64_MAX;
+
+private:
+  static constexpr uint8_t kExpiredLevel = kLevels;
+
+  timer_entry *slots_[kLevels][kSlots] = {};
+  uint64_t occupied_[kLevels] = {};
+  timer_entry *expired_ = nullptr;
+  timer_entry *expired_tail_ = nullptr;
+  uint64_t elapsed_;
+  size_t size_ = 0;
+
+  timer_entry *&list_of(timer_entry const *entry) {
+    return entry->level_ == kExpiredLevel
+               ? expired_
+               : slots_[entry->level_][entry->slot_];
+  }
+
+  void link(timer_entry *entry);
+
+  void unlink(timer_entry *entry);
+
+  void place(timer_entry *entry);
+
+  uint64_t next_slot(unsigned level, unsigned *slot) const;
+
+public:
+  /**
+   * @brief Construct an empty timer wheel.
+   *
+   * @param now The current tick.
+   */
+  explicit timer_wheel(uint64_t now = 0) : elapsed_(now) {}
+
+  /**
+   * @brief Get the tick the wheel has advanced to.
+   *
+   * @return uint64_t The current tick of the wheel.
+   */
+  uint64_t elapsed() const { return elapsed_; }
+
+  /**
+   * @brief Get the number of pending timers.
+   *
+   * @return size_t The number of timers.
+   */
+  size_t size() const { return size_; }
+
+  /**
+   * @brief Whether no timer is pending.
+   *
+   * @return true if the wheel is empty.
+   */
+  bool empty() const { return size_ == 0; }
+
+  /**
+   * @brief Schedule a timer. A pending timer is rescheduled.
+   *
+   * @param entry The timer.
+   * @param when The expiry tick. Ticks already elapsed expire on the next
+   * advance.
+   */
+  void insert(timer_entry *entry, uint64_t when);
+
+  /**
+   * @brief Cancel a timer. Does nothing if the timer is not pending.
+   *
+   * @param entry The timer.
+   */
+  void remove(timer_entry *entry);
+
+  /**
+   * @brief Get the tick of the earliest slot holding timers. The slot may only
+   * hold timers to cascade to lower levels, so this never comes after the
+   * earliest expiry but may come before it.
+   *
+   * @return uint64_t The tick the wheel next needs to advance to, or kNever if
+   * it is empty.
+   */
+  uint64_t next_expiration() const;
+
+  /**
+   * @brief Advance the wheel and fire the timers expiring until then. Timers
+   * may be scheduled and cancelled from within fire().
+   *
+   * @param now The current tick.
+   * @return size_t The number of timers fired.
+   */
+  size_t advance(uint64_t now);
+};
+
+} // namespace uringpp
@@ -0,0 +1,668 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <liburing.h>
+#include <memory>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "uringpp/awaitable.h"
+#include "uringpp/buffer_ring.h"
+#include "uringpp/error.h"
+#include "uringpp/event_loop.h"
+#include "uringpp/ip_address.h"
+#include "uringpp/multishot.h"
+#include "uringpp/task.h"
+
+#include "uringpp/detail/debug.h"
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief How a UDP socket is set up.
+ *
+ */
+struct udp_options {
+  /** @brief Whether to set SO_REUSEPORT, e.g. to bind one socket per loop. */
+  bool reuse_port = false;
+  /**
+   * @brief Whether to enable UDP_GRO, so that the kernel may coalesce
+   * datagrams of a flow into a single received buffer.
+   */
+  bool gro = false;
+  /**
+   * @brief Whether to install the socket into the file table of the loop.
+   * Always set if the loop requires fixed files.
+   */
+  bool fixed = false;
+};
+
+/**
+ * @brief A datagram to send.
+ *
+ */
+struct udp_message {
+  /** @brief The payload. Must stay valid until the send completes. */
+  void const *data;
+  /** @brief The number of bytes of the payload. */
+  size_t size;
+  /** @brief The destination, or nullptr on a connected socket. */
+  ip_address const *to = nullptr;
+  /**
+   * @brief If not 0, the payload is split by the kernel into datagrams of
+   * this size (UDP_SEGMENT), the last one possibly shorter.
+   */
+  uint16_t segment_size = 0;
+};
+
+/**
+ * @brief A datagram received into a provided buffer, which is given back to
+ * the kernel when the datagram is destroyed.
+ *
+ */
+class datagram : public noncopyable {
+  provided_buffer buffer_;
+  uint8_t const *data_ = nullptr;
+  size_t size_ = 0;
+  ip_address peer_;
+  uint16_t segment_size_ = 0;
+  bool truncated_ = false;
+
+public:
+  datagram() = default;
+
+  /**
+   * @brief Construct a new datagram object
+   *
+   * @param buffer The buffer holding the datagram.
+   * @param data The start of the payload in the buffer.
+   * @param size The number of bytes of the payload.
+   * @param peer The address of the sender.
+   * @param segment_size The size of the coalesced datagrams, or 0.
+   * @param truncated Whether the payload did not fit in the buffer.
+   */
+  datagram(provided_buffer buffer, uint8_t const *data, size_t size,
+           ip_address const &peer, uint16_t segment_size, bool truncated)
+      : buffer_(std::move(buffer)), data_(data), size_(size), peer_(peer),
+        segment_size_(segment_size), truncated_(truncated) {}
+
+  /**
+   * @brief Get the payload.
+   *
+   * @return uint8_t const* The start of the payload.
+   */
+  uint8_t const *data() const { return data_; }
+
+  /**
+   * @brief Get the size of the payload.
+   *
+   * @return size_t The number of bytes.
+   */
+  size_t size() const { return size_; }
+
+  /**
+   * @brief Get the address of the sender.
+   *
+   * @return ip_address const& The address.
+   */
+  ip_address const &peer() const { return peer_; }
+
+  /**
+   * @brief Get the size of the datagrams coalesced by GRO. The payload holds
+   * datagrams of this size back to back, the last one possibly shorter.
+   *
+   * @return uint16_t The segment size, or 0 for a single datagram.
+   */
+  uint16_t segment_size() const { return segment_size_; }
+
+  /**
+   * @brief Whether the datagram was larger than the buffer and was cut.
+   *
+   */
+  bool truncated() const { return truncated_; }
+};
+
+namespace detail {
+
+/* Room for a UDP_GRO control message, the only one we ask for. */
+constexpr size_t kUdpControlSize = CMSG_SPACE(sizeof(int));
+
+static inline uint16_t udp_gro_size(cmsghdr const *cmsg) {
+  if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+    int size;
+    std::memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+    return size;
+  }
+  return 0;
+}
+
+/**
+ * @brief A msghdr describing a udp_message, with room for a UDP_SEGMENT
+ * control message.
+ *
+ */
+struct udp_outgoing {
+  msghdr msg_;
+  iovec iov_;
+  alignas(cmsghdr) uint8_t control_[CMSG_SPACE(sizeof(uint16_t))];
+
+  explicit udp_outgoing(udp_message const &m) {
+    std::memset(&msg_, 0, sizeof(msg_));
+    iov_.iov_base = const_cast<void *>(m.data);
+    iov_.iov_len = m.size;
+    msg_.msg_iov = &iov_;
+    msg_.msg_iovlen = 1;
+    if (m.to != nullptr) {
+      msg_.msg_name = const_cast<sockaddr_storage *>(&m.to->ss_);
+      msg_.msg_namelen = m.to->len_;
+    }
+    if (m.segment_size != 0) {
+      msg_.msg_control = control_;
+      msg_.msg_controllen = sizeof(control_);
+      auto *cmsg = CMSG_FIRSTHDR(&msg_);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      std::memcpy(CMSG_DATA(cmsg), &m.segment_size, sizeof(uint16_t));
+    }
+  }
+
+  udp_outgoing(udp_outgoing const &) = delete;
+};
+
+} // namespace detail
+
+/**
+ * @brief A stream of datagrams received by a single multishot recvmsg into
+ * buffers picked from a provided buffer ring. Each buffer starts with an
+ * io_uring_recvmsg_out header followed by the address of the sender, the
+ * control messages and the payload. On kernels without multishot receives a
+ * single-shot recvmsg is re-armed after every datagram instead.
+ *
+ */
+class datagram_stream : public noncopyable {
+  class operation : public multishot_operation,
+                    public provided_buffer_ring::waiter {
+    /* The headers of single-shot recvmsgs, oldest first. The kernel writes
+     * the address and control messages there rather than in the buffer. */
+    struct header {
+      msghdr msg_;
+      iovec iov_;
+      sockaddr_storage name_;
+      alignas(cmsghdr) uint8_t control_[detail::kUdpControlSize];
+    };
+
+    event_loop *loop_;
+    int fd_;
+    provided_buffer_ring *buffers_;
+    uint8_t sqe_flags_;
+    bool multishot_;
+    uint64_t armed_recycled_ = 0;
+    msghdr msg_;
+    std::deque<header> headers_;
+
+    datagram parse_multishot(int res, provided_buffer buffer) {
+      auto *out = ::io_uring_recvmsg_validate(buffer.data(), res, &msg_);
+      if (out == nullptr) [[unlikely]] {
+        throw_with("received a malformed recvmsg buffer");
+      }
+      ip_address peer;
+      peer.len_ = std::min<socklen_t>(out->namelen, sizeof(peer.ss_));
+      std::memcpy(&peer.ss_, ::io_uring_recvmsg_name(out), peer.len_);
+      uint16_t segment_size = 0;
+      for (auto *cmsg = ::io_uring_recvmsg_cmsg_firsthdr(out, &msg_);
+           cmsg != nullptr;
+           cmsg = ::io_uring_recvmsg_cmsg_nexthdr(out, &msg_, cmsg)) {
+        segment_size = std::max(segment_size, detail::udp_gro_size(cmsg));
+      }
+      auto *payload =
+          static_cast<uint8_t *>(::io_uring_recvmsg_payload(out, &msg_));
+      auto len = ::io_uring_recvmsg_payload_length(out, res, &msg_);
+      bool truncated = out->flags & MSG_TRUNC;
+      return datagram(std::move(buffer), payload, len, peer, segment_size,
+                      truncated);
+    }
+
+    datagram parse_single(int res, provided_buffer buffer) {
+      auto &h = headers_.front();
+      ip_address peer;
+      peer.len_ = std::min<socklen_t>(h.msg_.msg_namelen, sizeof(peer.ss_));
+      std::memcpy(&peer.ss_, &h.name_, peer.len_);
+      uint16_t segment_size = 0;
+      for (auto *cmsg = CMSG_FIRSTHDR(&h.msg_); cmsg != nullptr;
+           cmsg = CMSG_NXTHDR(&h.msg_, cmsg)) {
+        segment_size = std::max(segment_size, detail::udp_gro_size(cmsg));
+      }
+      bool truncated = h.msg_.msg_flags & MSG_TRUNC;
+      headers_.pop_front();
+      auto *payload = buffer.data();
+      return datagram(std::move(buffer), payload, res, peer, segment_size,
+                      truncated);
+    }
+
+  protected:
+    void prep(struct io_uring_sqe *sqe) override {
+      if (multishot_) {
+        ::io_uring_prep_recvmsg_multishot(sqe, fd_, &msg_, 0);
+      } else {
+        auto &h = headers_.emplace_back();
+        h.msg_ = msg_;
+        h.msg_.msg_name = &h.name_;
+        h.msg_.msg_control = h.control_;
+        h.iov_ = {nullptr, buffers_->buffer_size()};
+        h.msg_.msg_iov = &h.iov_;
+        h.msg_.msg_iovlen = 1;
+        ::io_uring_prep_recvmsg(sqe, fd_, &h.msg_, 0);
+      }
+      sqe->flags |= IOSQE_BUFFER_SELECT | sqe_flags_;
+      sqe->buf_group = buffers_->group_id();
+      armed_recycled_ = buffers_->recycled();
+    }
+
+    bool restart(int res) override {
+      if (res == -ENOBUFS) {
+        /* The failed single-shot recvmsg is dropped, not delivered. */
+        if (!multishot_) {
+          headers_.pop_back();
+        }
+        /* At capacity, re-arming would fail right away until a consumer
+         * recycles a buffer. */
+        if (buffers_->starved(armed_recycled_)) {
+          park();
+          buffers_->wait(this);
+        }
+        return true;
+      }
+      return res >= 0;
+    }
+
+    void discard(int, uint32_t flags) override {
+      if (flags & IORING_CQE_F_BUFFER) {
+        buffers_->recycle(flags >> IORING_CQE_BUFFER_SHIFT);
+      }
+      if (!multishot_) {
+        headers_.pop_front();
+      }
+    }
+
+    void on_recycle() override { loop_->unpark_multishot(this); }
+
+  public:
+    operation(event_loop *loop, int fd, provided_buffer_ring *buffers,
+              uint8_t sqe_flags)
+        : loop_(loop), fd_(fd), buffers_(buffers), sqe_flags_(sqe_flags),
+          multishot_(loop->has_multishot_recv()) {
+      std::memset(&msg_, 0, sizeof(msg_));
+      msg_.msg_namelen = sizeof(sockaddr_storage);
+      msg_.msg_controllen = detail::kUdpControlSize;
+    }
+
+    ~operation() { buffers_->cancel_wait(this); }
+
+    datagram take(completion c) {
+      provided_buffer buffer;
+      if (c.flags & IORING_CQE_F_BUFFER) {
+        buffer = provided_buffer(buffers_, c.flags >> IORING_CQE_BUFFER_SHIFT,
+                                 std::max(c.res, 0));
+      }
+      if (c.res < 0) {
+        if (!multishot_) {
+          headers_.pop_front();
+        }
+        check_nerrno(c.res, "failed to receive");
+      }
+      if (multishot_) {
+        return parse_multishot(c.res, std::move(buffer));
+      }
+      return parse_single(c.res, std::move(buffer));
+    }
+  };
+
+  std::shared_ptr<event_loop> loop_;
+  operation *op_;
+
+public:
+  /**
+   * @brief Start receiving from a socket.
+   *
+   * @param loop The event loop.
+   * @param fd The file descriptor of the socket.
+   * @param buffers The buffer ring to receive into. Its buffers must hold the
+   * recvmsg header, the address and the control messages on top of the
+   * largest datagram.
+   * @param sqe_flags The SQE flags to use, e.g. IOSQE_FIXED_FILE.
+   */
+  datagram_stream(std::shared_ptr<event_loop> loop, int fd,
+                  provided_buffer_ring &buffers, uint8_t sqe_flags = 0)
+      : loop_(loop), op_(new operation(loop.get(), fd, &buffers, sqe_flags)) {
+    loop_->arm_multishot(op_);
+  }
+
+  /**
+   * @brief Move construct a new datagram stream object
+   *
+   * @param other
+   */
+  datagram_stream(datagram_stream &&other) noexcept
+      : loop_(std::move(other.loop_)), op_(std::exchange(other.op_, nullptr)) {}
+
+  /**
+   * @brief Wait for the next datagram.
+   *
+   * @return An awaitable resolving to the datagram. Errors are thrown, and
+   * so is the end of the stream.
+   */
+  auto next() {
+    struct awaitable : multishot_operation::completion_awaitable {
+      operation *op_;
+      datagram await_resume() {
+        auto c = completion_awaitable::await_resume();
+        if (!c) {
+          throw std::runtime_error("datagram stream terminated");
+        }
+        return op_->take(*c);
+      }
+    };
+    return awaitable{op_->next(), op_};
+  }
+
+  /**
+   * @brief Destroy the datagram stream object. A pending multishot recvmsg is
+   * cancelled.
+   *
+   */
+  ~datagram_stream() {
+    if (op_ != nullptr) {
+      loop_->release_multishot(op_);
+    }
+  }
+};
+
+/**
+ * @brief A UDP socket. Receives are batched by a multishot recvmsg and GRO,
+ * sends by linking many sendmsgs into one submission and by GSO, which hands
+ * the kernel a whole train of datagrams in a single sendmsg.
+ *
+ */
+class udp_socket : public noncopyable {
+  std::shared_ptr<event_loop> loop_;
+  int fd_;
+  bool fixed_ = false;
+  ip_address local_;
+
+  udp_socket(std::shared_ptr<event_loop> loop, int fd, bool fixed,
+             ip_address const &local)
+      : loop_(loop), fd_(fd), fixed_(fixed), local_(local) {}
+
+  uint8_t sqe_flags() const { return fixed_ ? IOSQE_FIXED_FILE : 0; }
+
+  static udp_socket open(std::shared_ptr<event_loop> loop, int family,
+                         sockaddr const *addr, socklen_t addrlen,
+                         udp_options const &options) {
+    int fd = ::socket(family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    check_errno(fd, "failed to create socket");
+    try {
+      int32_t yes = 1;
+      if (options.reuse_port) {
+        check_errno(
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)),
+            "failed to set reuse port");
+      }
+      if (options.gro) {
+        check_errno(::setsockopt(fd, SOL_UDP, UDP_GRO, &yes, sizeof(yes)),
+                    "failed to enable gro");
+      }
+      check_errno(::bind(fd, addr, addrlen), "failed to bind");
+      ip_address local;
+      check_errno(::getsockname(fd, reinterpret_cast<sockaddr *>(&local.ss_),
+                                &local.len_),
+                  "failed to get socket name");
+      if (!options.fixed && !loop->fixed_files_required()) {
+        return udp_socket(loop, fd, false, local);
+      }
+      int slot = loop->files().install(fd);
+      ::close(fd);
+      return udp_socket(loop, slot, true, local);
+    } catch (...) {
+      ::close(fd);
+      throw;
+    }
+  }
+
+public:
+  /**
+   * @brief Create a socket bound to the given address.
+   *
+   * @param loop The event loop.
+   * @param hostname The hostname to bind to, or empty for any address.
+   * @param port The port to bind to, or "0" to let the kernel pick one.
+   * @param options How to set up the socket.
+   * @return udp_socket The socket object.
+   */
+  static udp_socket bind(std::shared_ptr<event_loop> loop,
+                         std::string const &hostname, std::string const &port,
+                         udp_options options = {}) {
+    struct addrinfo hints, *servinfo, *p;
+    ::bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if (auto rc = getaddrinfo(hostname.empty() ? nullptr : hostname.c_str(),
+                              port.c_str(), &hints, &servinfo);
+        rc != 0) {
+      throw_with("getaddrinfo: %s", gai_strerror(rc));
+    }
+    for (p = servinfo; p != nullptr; p = p->ai_next) {
+      try {
+        auto s = open(loop, p->ai_family, p->ai_addr, p->ai_addrlen, options);
+        URINGPP_LOG_DEBUG("binding udp %s:%s", get_in_addr_string(p).c_str(),
+                          port.c_str());
+        ::freeaddrinfo(servinfo);
+        return s;
+      } catch (std::runtime_error &e) {
+        URINGPP_LOG_ERROR("%s", e.what());
+      }
+    }
+    ::freeaddrinfo(servinfo);
+    throw std::runtime_error("try all addresses, failed to bind");
+  }
+
+  /**
+   * @brief Create a socket bound to an ephemeral port of any address, e.g.
+   * for a client.
+   *
+   * @param loop The event loop.
+   * @param family AF_INET or AF_INET6.
+   * @param options How to set up the socket.
+   * @return udp_socket The socket object.
+   */
+  static udp_socket create(std::shared_ptr<event_loop> loop,
+                           int family = AF_INET, udp_options options = {}) {
+    ip_address any;
+    std::memset(&any.ss_, 0, sizeof(any.ss_));
+    any.ss_.ss_family = family;
+    any.len_ = family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+    return open(loop, family, reinterpret_cast<sockaddr *>(&any.ss_),
+                any.len_, options);
+  }
+
+  /**
+   * @brief Move construct a new UDP socket object
+   *
+   * @param other
+   */
+  udp_socket(udp_socket &&other) noexcept
+      : loop_(std::move(other.loop_)), fd_(std::exchange(other.fd_, -1)),
+        fixed_(other.fixed_), local_(other.local_) {}
+
+  /**
+   * @brief Get the file descriptor, or the index in the file table of the
+   * loop if fixed.
+   *
+   * @return int The file descriptor.
+   */
+  int fd() const { return fd_; }
+
+  /**
+   * @brief Whether the socket is a direct descriptor.
+   *
+   */
+  bool fixed() const { return fixed_; }
+
+  /**
+   * @brief Get the address the socket is bound to.
+   *
+   * @return ip_address const& The local address.
+   */
+  ip_address const &local_address() const { return local_; }
+
+  /**
+   * @brief Set the default destination of sends and only receive from it.
+   *
+   * @param peer The peer address. Must stay valid until the connect
+   * completes.
+   * @return sqe_awaitable
+   */
+  sqe_awaitable connect(ip_address const &peer) {
+    return loop_->connect(
+        fd_, reinterpret_cast<sockaddr *>(const_cast<sockaddr_storage *>(
+                 &peer.ss_)),
+        peer.len_, sqe_flags());
+  }
+
+  /**
+   * @brief Send a datagram on a connected socket.
+   *
+   * @param buf The payload.
+   * @param len The number of bytes of the payload.
+   * @param flags The flags to use.
+   * @return sqe_awaitable
+   */
+  sqe_awaitable send(void const *buf, size_t len, int flags = 0) {
+    return loop_->send(fd_, buf, len, flags, sqe_flags());
+  }
+
+  /**
+   * @brief Send a datagram, or a train of them with GSO.
+   *
+   * @param message The datagram.
+   * @return task<int> The number of bytes sent. Errors are returned negated.
+   */
+  task<int> send_to(udp_message message) {
+    detail::udp_outgoing out(message);
+    int rc = co_await loop_->sendmsg(fd_, &out.msg_, 0, sqe_flags());
+    co_return rc;
+  }
+
+  /**
+   * @brief Send many datagrams at once. Their sendmsgs are hard-linked into
+   * chains which fit in the SQ, so that each chain is submitted as a whole
+   * and awaited with a single suspension. Datagrams of a chain are sent in
+   * order and a failed one does not stop the others.
+   *
+   * @param messages The datagrams.
+   * @return task<std::vector<int>> The number of bytes sent for each
+   * datagram. Errors are returned negated.
+   */
+  task<std::vector<int>> send_batch(std::span<udp_message const> messages) {
+    constexpr size_t kMaxChain = 64;
+    /* A chain must fit in the SQ at once; leave half of it to other ops. */
+    auto max_chain =
+        std::clamp<size_t>(loop_->sq_entries() / 2, 1, kMaxChain);
+    std::vector<int> results;
+    results.reserve(messages.size());
+    std::deque<detail::udp_outgoing> outgoing;
+    for (size_t i = 0; i < messages.size(); i += max_chain) {
+      auto n = std::min(max_chain, messages.size() - i);
+      outgoing.clear();
+      auto chain = loop_->chain(n, true);
+      for (size_t j = 0; j < n; ++j) {
+        auto &out = outgoing.emplace_back(messages[i + j]);
+        chain.add(loop_->sendmsg(fd_, &out.msg_, 0, sqe_flags()));
+      }
+      auto rcs = co_await chain;
+      results.insert(results.end(), rcs.begin(), rcs.end());
+    }
+    co_return results;
+  }
+
+  /**
+   * @brief Receive a datagram into a buffer.
+   *
+   * @param buf The buffer to receive into.
+   * @param len The size of the buffer.
+   * @param from Set to the address of the sender.
+   * @return task<int> The number of bytes received. Errors are thrown.
+   */
+  task<int> recv_from(void *buf, size_t len, ip_address &from) {
+    msghdr msg;
+    iovec iov{buf, len};
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &from.ss_;
+    msg.msg_namelen = sizeof(from.ss_);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    int rc = co_await loop_->recvmsg(fd_, &msg, 0, sqe_flags());
+    check_nerrno(rc, "failed to receive");
+    from.len_ = msg.msg_namelen;
+    co_return rc;
+  }
+
+  /**
+   * @brief Receive datagrams with a single multishot recvmsg into buffers
+   * picked by the kernel from a provided buffer ring.
+   *
+   * @param buffers The buffer ring to receive into.
+   * @return datagram_stream The stream of datagrams.
+   */
+  datagram_stream recv_multishot(provided_buffer_ring &buffers) {
+    return datagram_stream(loop_, fd_, buffers, sqe_flags());
+  }
+
+  /**
+   * @brief Close the socket.
+   *
+   * @return task<void>
+   */
+  task<void> close() {
+    if (fixed_ && fd_ >= 0) {
+      co_await loop_->close_direct(fd_);
+      loop_->files().release(std::exchange(fd_, -1));
+    } else if (fd_ >= 0) {
+      co_await loop_->close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  /**
+   * @brief Destroy the UDP socket object. If the socket is still open, it
+   * will be closed.
+   *
+   */
+  ~udp_socket() {
+    if (fd_ < 0) {
+      return;
+    }
+    if (fixed_) {
+      loop_->close_direct_detach(fd_);
+    } else {
+      loop_->close_detach(fd_);
+    }
+  }
+};
+
+} // namespace uringpp
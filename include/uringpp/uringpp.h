@@ -1,8 +1,27 @@
 #pragma once
 
+#include "uringpp/buffered_stream.h"
+#include "uringpp/bulk_io.h"
+#include "uringpp/codec.h"
+#include "uringpp/connection_pool.h"
 #include "uringpp/dir.h"
+#include "uringpp/dir_walker.h"
+#include "uringpp/direct_file.h"
 #include "uringpp/event_loop.h"
 #include "uringpp/file.h"
+#include "uringpp/io_queue.h"
+#include "uringpp/metrics.h"
+#include "uringpp/offload.h"
+#include "uringpp/pipe.h"
+#include "uringpp/proxy.h"
+#include "uringpp/resolver.h"
+#include "uringpp/rpc.h"
+#include "uringpp/runtime.h"
 #include "uringpp/socket.h"
+#include "uringpp/sync.h"
+#include "uringpp/task_group.h"
 #include "uringpp/task.h"
-#include "uringpp/tcp_listener.h"
\ No newline at end of file
+#include "uringpp/tcp_listener.h"
+#include "uringpp/timer.h"
+#include "uringpp/udp_socket.h"
+#include "uringpp/when.h"
\ No newline at end of file
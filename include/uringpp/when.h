@@ -0,0 +1,306 @@
+#pragma once
+
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "uringpp/awaitable.h"
+#include "uringpp/event_loop.h"
+#include "uringpp/sync.h"
+#include "uringpp/task.h"
+
+namespace uringpp {
+
+namespace detail {
+
+/* The result of a task in a combinator: void becomes std::monostate. */
+template <class T>
+using value_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+template <class T> struct is_task : std::false_type {};
+template <class T> struct is_task<task<T>> : std::true_type {};
+
+/* What when_all accepts: tasks, which are running, and operations. */
+template <class A>
+concept child = is_task<A>::value || std::same_as<A, sqe_awaitable>;
+
+template <class T> task<T> to_task(task<T> t) { return t; }
+
+/* Wrapping an operation awaits it, so user_data is set before the next
+ * submission. */
+inline task<int> to_task(sqe_awaitable op) {
+  int rc = co_await op;
+  co_return rc;
+}
+
+template <class T>
+task<void> collect(task<T> &t, std::optional<value_t<T>> &out,
+                   std::exception_ptr &error) {
+  try {
+    if constexpr (std::is_void_v<T>) {
+      co_await t;
+      out.emplace();
+    } else {
+      T value = co_await t;
+      out.emplace(std::move(value));
+    }
+  } catch (...) {
+    if (!error) {
+      error = std::current_exception();
+    }
+  }
+}
+
+template <class... T, size_t... I>
+task<std::tuple<value_t<T>...>> when_all(std::index_sequence<I...>,
+                                         task<T>... tasks) {
+  std::tuple<std::optional<value_t<T>>...> results;
+  std::exception_ptr error;
+  task<void> joins[] = {collect(tasks, std::get<I>(results), error)...};
+  for (auto &j : joins) {
+    co_await j;
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  co_return std::tuple<value_t<T>...>(std::move(*std::get<I>(results))...);
+}
+
+/* The result of when_any: the index of the winner, and its value. */
+template <class T>
+using any_result_t =
+    std::conditional_t<std::is_void_v<T>, size_t, std::pair<size_t, T>>;
+
+template <class T> struct race_state {
+  async_event done_;
+  size_t winner_ = SIZE_MAX;
+  std::optional<value_t<T>> value_;
+  std::exception_ptr error_;
+};
+
+template <class T>
+task<void> race(task<T> t, std::shared_ptr<race_state<T>> state, size_t i) {
+  try {
+    if constexpr (std::is_void_v<T>) {
+      co_await t;
+      if (state->winner_ == SIZE_MAX) {
+        state->winner_ = i;
+        state->done_.set();
+      }
+    } else {
+      T value = co_await t;
+      if (state->winner_ == SIZE_MAX) {
+        state->winner_ = i;
+        state->value_.emplace(std::move(value));
+        state->done_.set();
+      }
+    }
+  } catch (...) {
+    if (state->winner_ == SIZE_MAX) {
+      state->winner_ = i;
+      state->error_ = std::current_exception();
+      state->done_.set();
+    }
+  }
+}
+
+struct op_race_state {
+  async_event done_;
+  size_t winner_ = SIZE_MAX;
+  int rc_ = 0;
+};
+
+inline task<void> race(sqe_awaitable &op, op_race_state &state, size_t i) {
+  int rc = co_await op;
+  if (state.winner_ == SIZE_MAX) {
+    state.winner_ = i;
+    state.rc_ = rc;
+    state.done_.set();
+  }
+}
+
+} // namespace detail
+
+/**
+ * @brief Wait for several tasks or operations, which all run concurrently.
+ * Tasks start when created, so they are already running; operations are
+ * awaited by the call, and should be prepared right before it, as the loop
+ * may submit in between.
+ *
+ * @param children The tasks or sqe_awaitables.
+ * @return task<std::tuple<...>> The results in order of the arguments, with
+ * std::monostate for tasks returning void and the result of each operation.
+ * Once all children are done, the first exception thrown is rethrown.
+ */
+template <detail::child... A>
+  requires(sizeof...(A) > 0)
+auto when_all(A... children) {
+  return detail::when_all(std::index_sequence_for<A...>{},
+                          detail::to_task(std::move(children))...);
+}
+
+/**
+ * @brief Wait for tasks which all run concurrently.
+ *
+ * @param tasks The tasks.
+ * @return task<std::vector<T>> The results in order. Once all tasks are
+ * done, the first exception thrown is rethrown.
+ */
+template <class T>
+  requires(!std::is_void_v<T>)
+task<std::vector<T>> when_all(std::vector<task<T>> tasks) {
+  std::vector<std::optional<T>> results(tasks.size());
+  std::exception_ptr error;
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    try {
+      T value = co_await tasks[i];
+      results[i].emplace(std::move(value));
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  std::vector<T> values;
+  values.reserve(results.size());
+  for (auto &r : results) {
+    values.push_back(std::move(*r));
+  }
+  co_return values;
+}
+
+/**
+ * @brief Wait for tasks returning void which all run concurrently.
+ *
+ * @param tasks The tasks.
+ * @return task<void> Once all tasks are done, the first exception thrown is
+ * rethrown.
+ */
+inline task<void> when_all(std::vector<task<void>> tasks) {
+  std::exception_ptr error;
+  for (auto &t : tasks) {
+    try {
+      co_await t;
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+/**
+ * @brief Wait for operations submitted together, e.g. the reads of a
+ * scatter-gather request. The operations should be prepared right before the
+ * call, as the loop may submit in between.
+ *
+ * @param ops The operations.
+ * @return task<std::vector<int>> The result of each operation, in order.
+ */
+inline task<std::vector<int>> when_all(std::vector<sqe_awaitable> ops) {
+  std::vector<task<int>> tasks;
+  tasks.reserve(ops.size());
+  for (auto &op : ops) {
+    tasks.push_back(detail::to_task(op));
+  }
+  auto results = co_await when_all(std::move(tasks));
+  co_return results;
+}
+
+/**
+ * @brief Wait for the first of several tasks to finish. Tasks cannot be
+ * cancelled, so the others keep running detached and their results are
+ * dropped; have them watch e.g. an async_event to stop them early.
+ *
+ * @param tasks The tasks. Must not be empty.
+ * @return task<std::pair<size_t, T>> The index and result of the first task
+ * to finish, or just the index for tasks returning void. Rethrows if that
+ * task threw.
+ */
+template <class T>
+task<detail::any_result_t<T>> when_any(std::vector<task<T>> tasks) {
+  assert(!tasks.empty());
+  auto state = std::make_shared<detail::race_state<T>>();
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    detail::race(std::move(tasks[i]), state, i).detach();
+  }
+  co_await state->done_.wait();
+  if (state->error_) {
+    std::rethrow_exception(state->error_);
+  }
+  if constexpr (std::is_void_v<T>) {
+    co_return state->winner_;
+  } else {
+    co_return std::pair<size_t, T>(state->winner_, std::move(*state->value_));
+  }
+}
+
+/**
+ * @brief Wait for the first of several tasks to finish, see the overload
+ * taking a vector.
+ *
+ * @param first The first task.
+ * @param rest The other tasks, of the same type.
+ * @return task<...> The index and result of the first task to finish.
+ */
+template <class T, class... Rest>
+  requires(std::same_as<Rest, task<T>> && ...)
+task<detail::any_result_t<T>> when_any(task<T> first, Rest... rest) {
+  std::vector<task<T>> tasks;
+  tasks.reserve(1 + sizeof...(Rest));
+  tasks.push_back(std::move(first));
+  (tasks.push_back(std::move(rest)), ...);
+  return when_any(std::move(tasks));
+}
+
+/**
+ * @brief Wait for the first of several operations to complete and cancel the
+ * others with IORING_OP_ASYNC_CANCEL, e.g. to race a request to replicas.
+ * The operations should be prepared right before the call, as the loop may
+ * submit in between.
+ *
+ * @param loop The loop the operations were prepared on.
+ * @param ops The operations. Must not be empty.
+ * @return task<std::pair<size_t, int>> The index and result of the first
+ * operation to complete, once the others have completed too, usually with
+ * -ECANCELED.
+ */
+inline task<std::pair<size_t, int>> when_any(std::shared_ptr<event_loop> loop,
+                                             std::vector<sqe_awaitable> ops) {
+  assert(!ops.empty());
+  detail::op_race_state state;
+  std::vector<task<void>> racers;
+  racers.reserve(ops.size());
+  for (size_t i = 0; i < ops.size(); ++i) {
+    racers.push_back(detail::race(ops[i], state, i));
+  }
+  co_await state.done_.wait();
+  std::vector<sqe_awaitable> cancels;
+  for (size_t i = 0; i < ops.size(); ++i) {
+    if (!racers[i].h_.done()) {
+      cancels.push_back(loop->cancel(ops[i]));
+    }
+  }
+  /* The losers live in this frame and must complete before it goes. */
+  co_await when_all(std::move(cancels));
+  for (auto &r : racers) {
+    co_await r;
+  }
+  co_return std::pair<size_t, int>(state.winner_, state.rc_);
+}
+
+} // namespace uringpp
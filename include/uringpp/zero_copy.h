@@ -0,0 +1,45 @@
+#pragma once
+
+#include <coroutine>
+
+#include "uringpp/detail/noncopyable.h"
+
+namespace uringpp {
+
+/**
+ * @brief A zero-copy send (IORING_OP_SEND_ZC or IORING_OP_SENDMSG_ZC). The
+ * kernel posts a CQE with the result, flagged IORING_CQE_F_MORE, and later a
+ * second one flagged IORING_CQE_F_NOTIF once it no longer references the
+ * buffer. Sends which fall back to copying only post the first CQE.
+ *
+ * An operation either resumes its coroutine after the notification, when the
+ * buffer may be reused, or owns the buffer, resumes on the result and is freed
+ * by the event loop along with the buffer after the notification.
+ */
+class zero_copy_operation : public noncopyable {
+  friend class event_loop;
+  std::coroutine_handle<> h_;
+  int res_ = 0;
+  bool owned_;
+
+protected:
+  /**
+   * @brief Construct a new zero copy operation object
+   *
+   * @param owned Whether the operation is heap allocated and freed by the loop
+   * after the notification.
+   */
+  explicit zero_copy_operation(bool owned) : owned_(owned) {}
+
+public:
+  /**
+   * @brief Get the result of the send.
+   *
+   * @return int The number of bytes sent, or a negated errno.
+   */
+  int result() const { return res_; }
+
+  virtual ~zero_copy_operation() = default;
+};
+
+} // namespace uringpp
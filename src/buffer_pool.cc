@@ -0,0 +1,61 @@
+#include "uringpp/buffer_pool.h"
+
+#include <sys/mman.h>
+
+#include "uringpp/error.h"
+
+namespace uringpp {
+
+fixed_buffer_pool::fixed_buffer_pool(struct io_uring *ring, size_t buffer_size,
+                                     unsigned nr_buffers, bool huge_pages)
+    : ring_(ring), buffer_size_(buffer_size), capacity_(nr_buffers),
+      base_(nullptr), mapped_size_(0), huge_pages_(false) {
+  if (buffer_size == 0 || nr_buffers == 0) {
+    throw_with("fixed buffer pool needs a non-empty buffer size and count");
+  }
+  slab_size_ = (buffer_size + kSlabSize - 1) / kSlabSize * kSlabSize;
+  auto per_slab = slab_size_ / buffer_size_;
+  auto nr_slabs = (nr_buffers + per_slab - 1) / per_slab;
+  mapped_size_ = nr_slabs * slab_size_;
+  void *addr = MAP_FAILED;
+  if (huge_pages) {
+    addr = ::mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB | MAP_POPULATE, -1,
+                  0);
+    huge_pages_ = addr != MAP_FAILED;
+  }
+  if (addr == MAP_FAILED) {
+    addr = ::mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (addr == MAP_FAILED) [[unlikely]] {
+      check_errno(-1, "failed to allocate fixed buffers");
+    }
+    if (huge_pages) {
+      ::madvise(addr, mapped_size_, MADV_HUGEPAGE);
+    }
+  }
+  base_ = static_cast<uint8_t *>(addr);
+  std::vector<struct iovec> slabs(nr_slabs);
+  for (size_t i = 0; i < nr_slabs; ++i) {
+    slabs[i].iov_base = base_ + i * slab_size_;
+    slabs[i].iov_len = slab_size_;
+  }
+  if (auto rc = ::io_uring_register_buffers(ring_, slabs.data(), nr_slabs);
+      rc < 0) {
+    ::munmap(base_, mapped_size_);
+    check_nerrno(rc, "failed to register fixed buffers");
+  }
+  free_buffers_.reserve(nr_buffers);
+  for (unsigned i = nr_buffers; i > 0; --i) {
+    auto slab = (i - 1) / per_slab;
+    auto offset = (i - 1) % per_slab * buffer_size_;
+    free_buffers_.push_back(base_ + slab * slab_size_ + offset);
+  }
+}
+
+fixed_buffer_pool::~fixed_buffer_pool() {
+  ::io_uring_unregister_buffers(ring_);
+  ::munmap(base_, mapped_size_);
+}
+
+} // namespace uringpp
@@ -0,0 +1,72 @@
+#include "uringpp/buffer_ring.h"
+
+#include <algorithm>
+#include <sys/mman.h>
+#include <utility>
+
+#include "uringpp/error.h"
+
+namespace uringpp {
+
+provided_buffer_ring::provided_buffer_ring(struct io_uring *ring, uint16_t bgid,
+                                           unsigned entries,
+                                           size_t buffer_size,
+                                           unsigned initial_buffers)
+    : ring_(ring), bgid_(bgid), entries_(entries), buffer_size_(buffer_size) {
+  if (entries == 0 || (entries & (entries - 1)) != 0 || entries > 32768) {
+    throw_with("buffer ring entries must be a power of 2 up to 32768, got %u",
+               entries);
+  }
+  auto ring_size = entries_ * sizeof(struct io_uring_buf);
+  auto addr = ::mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (addr == MAP_FAILED) [[unlikely]] {
+    check_errno(-1, "failed to allocate buffer ring");
+  }
+  br_ = reinterpret_cast<struct io_uring_buf_ring *>(addr);
+  struct io_uring_buf_reg reg = {};
+  reg.ring_addr = reinterpret_cast<uint64_t>(br_);
+  reg.ring_entries = entries_;
+  reg.bgid = bgid_;
+  if (auto rc = ::io_uring_register_buf_ring(ring_, &reg, 0); rc < 0) {
+    ::munmap(br_, ring_size);
+    check_nerrno(rc, "failed to register buffer ring");
+  }
+  ::io_uring_buf_ring_init(br_);
+  buffers_.reserve(entries_);
+  grow(initial_buffers);
+}
+
+provided_buffer_ring::~provided_buffer_ring() {
+  ::io_uring_unregister_buf_ring(ring_, bgid_);
+  ::munmap(br_, entries_ * sizeof(struct io_uring_buf));
+}
+
+unsigned provided_buffer_ring::grow(unsigned count) {
+  count = std::min<unsigned>(count, entries_ - buffers_.size());
+  if (count == 0) {
+    return 0;
+  }
+  auto chunk = std::unique_ptr<uint8_t[]>(new uint8_t[count * buffer_size_]);
+  auto mask = ::io_uring_buf_ring_mask(entries_);
+  for (unsigned i = 0; i < count; ++i) {
+    auto bid = static_cast<uint16_t>(buffers_.size());
+    auto buf = chunk.get() + i * buffer_size_;
+    buffers_.push_back(buf);
+    ::io_uring_buf_ring_add(br_, buf, buffer_size_, bid, mask, i);
+  }
+  ::io_uring_buf_ring_advance(br_, count);
+  chunks_.push_back(std::move(chunk));
+  return count;
+}
+
+void provided_buffer_ring::notify_waiters() {
+  /* A waiter may wait again from its callback. */
+  auto waiters = std::exchange(waiters_, {});
+  for (auto *w : waiters) {
+    w->waiting_ = false;
+    w->on_recycle();
+  }
+}
+
+} // namespace uringpp
@@ -0,0 +1,257 @@
+#include "uringpp/buffered_stream.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <sys/socket.h>
+#include <utility>
+
+#include "uringpp/error.h"
+
+namespace uringpp {
+
+namespace {
+
+constexpr size_t kMaxSpareSegments = 16;
+
+} // namespace
+
+buffered_stream::buffered_stream(socket s, size_t read_buffer_size,
+                                 size_t segment_size)
+    : state_(std::make_shared<state>(std::move(s), segment_size)),
+      read_buffer_(std::max<size_t>(read_buffer_size, 1)) {}
+
+std::vector<char> &buffered_stream::writable_segment(size_t room) {
+  auto &pending = state_->pending_;
+  auto &spare = state_->spare_;
+  if (pending.empty() ||
+      pending.back().capacity() - pending.back().size() < room) {
+    if (room > state_->segment_size_ || spare.empty()) {
+      pending.emplace_back().reserve(std::max(room, state_->segment_size_));
+    } else {
+      pending.push_back(std::move(spare.back()));
+      spare.pop_back();
+    }
+  }
+  return pending.back();
+}
+
+void buffered_stream::write(void const *data, size_t len) {
+  if (state_->write_error_) [[unlikely]] {
+    std::rethrow_exception(state_->write_error_);
+  }
+  auto p = static_cast<char const *>(data);
+  state_->pending_bytes_ += len;
+  while (len > 0) {
+    auto &segment = writable_segment(1);
+    auto n = std::min(len, segment.capacity() - segment.size());
+    segment.insert(segment.end(), p, p + n);
+    p += n;
+    len -= n;
+  }
+  schedule_flush();
+}
+
+void buffered_stream::write(std::vector<char> &&data) {
+  if (data.size() < state_->segment_size_) {
+    write(data.data(), data.size());
+    return;
+  }
+  if (state_->write_error_) [[unlikely]] {
+    std::rethrow_exception(state_->write_error_);
+  }
+  state_->pending_bytes_ += data.size();
+  state_->pending_.push_back(std::move(data));
+  schedule_flush();
+}
+
+char *buffered_stream::prepare(size_t n) {
+  assert(state_->prepared_ == 0);
+  if (state_->write_error_) [[unlikely]] {
+    std::rethrow_exception(state_->write_error_);
+  }
+  auto &segment = writable_segment(n);
+  auto size = segment.size();
+  /* Stays within the capacity, so the segment is not reallocated. */
+  segment.resize(size + n);
+  state_->prepared_ = n;
+  return segment.data() + size;
+}
+
+void buffered_stream::commit(size_t n) {
+  assert(n <= state_->prepared_);
+  auto &segment = state_->pending_.back();
+  segment.resize(segment.size() - (state_->prepared_ - n));
+  state_->prepared_ = 0;
+  state_->pending_bytes_ += n;
+  schedule_flush();
+}
+
+task<void> buffered_stream::flush_pending(std::shared_ptr<state> s) {
+  /* Everything written until the end of the pass goes into one sendmsg. */
+  co_await s->socket_.loop()->defer();
+  while (!s->pending_.empty() && !s->write_error_) {
+    s->sending_.swap(s->pending_);
+    s->iovecs_.clear();
+    for (auto &segment : s->sending_) {
+      s->iovecs_.push_back({segment.data(), segment.size()});
+    }
+    auto *iov = s->iovecs_.data();
+    size_t iovcnt = s->iovecs_.size();
+    while (iovcnt > 0) {
+      struct msghdr msg = {};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = std::min<size_t>(iovcnt, IOV_MAX);
+      int rc = co_await s->socket_.sendmsg(&msg, MSG_NOSIGNAL);
+      if (rc <= 0) [[unlikely]] {
+        try {
+          check_nerrno(rc < 0 ? rc : -EPIPE, "failed to send");
+        } catch (...) {
+          s->write_error_ = std::current_exception();
+        }
+        break;
+      }
+      s->pending_bytes_ -= rc;
+      for (size_t sent = rc; sent > 0;) {
+        if (sent >= iov->iov_len) {
+          sent -= iov->iov_len;
+          ++iov;
+          --iovcnt;
+        } else {
+          iov->iov_base = static_cast<char *>(iov->iov_base) + sent;
+          iov->iov_len -= sent;
+          sent = 0;
+        }
+      }
+    }
+    for (auto &segment : s->sending_) {
+      if (segment.capacity() == s->segment_size_ &&
+          s->spare_.size() < kMaxSpareSegments) {
+        segment.clear();
+        s->spare_.push_back(std::move(segment));
+      }
+    }
+    s->sending_.clear();
+  }
+  s->flushing_ = false;
+  auto waiters = std::move(s->flush_waiters_);
+  s->flush_waiters_.clear();
+  for (auto h : waiters) {
+    h.resume();
+  }
+}
+
+task<void> buffered_stream::flush() {
+  struct awaitable {
+    state *state_;
+    bool await_ready() noexcept { return !state_->flushing_; }
+    void await_suspend(std::coroutine_handle<> h) {
+      state_->flush_waiters_.push_back(h);
+    }
+    void await_resume() noexcept {}
+  };
+  co_await awaitable{state_.get()};
+  if (state_->write_error_) [[unlikely]] {
+    std::rethrow_exception(state_->write_error_);
+  }
+}
+
+void buffered_stream::reserve(size_t capacity) {
+  if (read_head_ > 0) {
+    std::memmove(read_buffer_.data(), read_buffer_.data() + read_head_,
+                 read_tail_ - read_head_);
+    read_tail_ -= read_head_;
+    read_head_ = 0;
+  }
+  if (read_buffer_.size() < capacity) {
+    read_buffer_.resize(std::max(capacity, read_buffer_.size() * 2));
+  }
+}
+
+task<bool> buffered_stream::fill() {
+  if (read_head_ == read_tail_) {
+    read_head_ = read_tail_ = 0;
+  } else if (read_tail_ == read_buffer_.size()) {
+    reserve(read_tail_ - read_head_ + 1);
+  }
+  int rc = co_await state_->socket_.recv(read_buffer_.data() + read_tail_,
+                                 read_buffer_.size() - read_tail_);
+  check_nerrno(rc, "failed to receive");
+  read_tail_ += rc;
+  co_return rc > 0;
+}
+
+task<std::string_view> buffered_stream::read_until(std::string_view delimiter,
+                                                   size_t max_length) {
+  consume();
+  size_t scanned = 0;
+  for (;;) {
+    std::string_view data(read_buffer_.data() + read_head_,
+                          read_tail_ - read_head_);
+    if (auto pos = data.find(delimiter, scanned);
+        pos != std::string_view::npos && pos + delimiter.size() <= max_length) {
+      consumed_ = pos + delimiter.size();
+      co_return data.substr(0, consumed_);
+    }
+    if (data.size() >= max_length) {
+      throw_with("no delimiter found in %zu bytes", max_length);
+    }
+    /* The delimiter may straddle the data received next. */
+    scanned = data.size() < delimiter.size()
+                  ? 0
+                  : data.size() - delimiter.size() + 1;
+    bool more = co_await fill();
+    if (!more) {
+      if (data.empty()) {
+        co_return std::string_view();
+      }
+      throw_with("connection closed before delimiter");
+    }
+  }
+}
+
+task<std::string_view> buffered_stream::read_exact(size_t n) {
+  consume();
+  if (read_buffer_.size() - read_head_ < n) {
+    reserve(n);
+  }
+  while (read_tail_ - read_head_ < n) {
+    bool more = co_await fill();
+    if (!more) {
+      if (read_tail_ == read_head_) {
+        co_return std::string_view();
+      }
+      throw_with("connection closed after %zu of %zu bytes",
+                 read_tail_ - read_head_, n);
+    }
+  }
+  consumed_ = n;
+  co_return std::string_view(read_buffer_.data() + read_head_, n);
+}
+
+task<size_t> buffered_stream::read_some(void *buf, size_t len) {
+  consume();
+  if (read_head_ == read_tail_) {
+    if (len >= read_buffer_.size()) {
+      int rc = co_await state_->socket_.recv(buf, len);
+      check_nerrno(rc, "failed to receive");
+      co_return rc;
+    }
+    bool more = co_await fill();
+    if (!more) {
+      co_return 0;
+    }
+  }
+  auto n = std::min(len, read_tail_ - read_head_);
+  std::memcpy(buf, read_buffer_.data() + read_head_, n);
+  read_head_ += n;
+  co_return n;
+}
+
+task<void> buffered_stream::close() {
+  co_await flush();
+  co_await state_->socket_.close();
+}
+
+} // namespace uringpp
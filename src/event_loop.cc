@@ -1,35 +1,167 @@
 #include "uringpp/event_loop.h"
 
+#include <cerrno>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utility>
+
+#include "uringpp/offload.h"
 
 namespace uringpp {
 
+namespace {
+
+class offloaded_syscall : public detail::offloaded_call {
+  event_loop::message m_;
+  std::function<int()> call_;
+
+public:
+  offloaded_syscall(event_loop *loop, std::function<int()> call)
+      : m_{nullptr, nullptr, loop}, call_(std::move(call)) {}
+
+  void start(std::coroutine_handle<> h) override {
+    m_.h_ = h;
+    offload_pool::shared().submit([this]() {
+      auto rc = call_();
+      rc_ = rc < 0 ? -errno : rc;
+      m_.target_->post(&m_);
+    });
+  }
+};
+
+} // namespace
+
 std::shared_ptr<event_loop> event_loop::create(unsigned int entries,
                                                uint32_t flags, int wq_fd) {
   return std::make_shared<event_loop>(entries, flags, wq_fd);
 }
 
+std::shared_ptr<event_loop> event_loop::create(loop_options const &options) {
+  return std::make_shared<event_loop>(options);
+}
+
 event_loop::event_loop(unsigned int entries, uint32_t flags, int wq_fd,
                        int sq_thread_cpu, int sq_thread_idle)
-    : cqe_count_(0) {
-  struct io_uring_params params = {};
-  params.wq_fd = wq_fd > 0 ? wq_fd : 0;
-  params.flags = flags;
-  params.sq_thread_cpu = sq_thread_cpu;
-  params.sq_thread_idle = sq_thread_idle;
-  check_nerrno(::io_uring_queue_init_params(entries, &ring_, &params),
-               "failed to init io uring");
+    : event_loop(loop_options{.entries = entries,
+                              .flags = flags,
+                              .wq_fd = wq_fd,
+                              .sq_thread_cpu = sq_thread_cpu,
+                              .sq_thread_idle = sq_thread_idle,
+                              .coop_taskrun = false}) {}
+
+event_loop::event_loop(loop_options const &options)
+    : submit_batch_(options.submit_batch),
+      zero_copy_threshold_(options.zero_copy_threshold),
+      send_zc_threshold_(SIZE_MAX), sendmsg_zc_threshold_(SIZE_MAX),
+      fixed_files_required_(false), multishot_accept_(false),
+      multishot_recv_(false), supported_features_(0), baseline_ops_(false),
+      ready_budget_(options.ready_budget),
+      time_slice_ns_(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         options.time_slice)
+                         .count()),
+      pass_start_ns_(detail::monotonic_ns()), timers_(timer_now()),
+      timer_ts_{},
+      timer_armed_at_(0), timer_armed_(false), inbox_(nullptr),
+      wakeup_fd_(-1) {
+  uint32_t flags = options.flags;
+  if (options.wq_fd > 0) {
+    flags |= IORING_SETUP_ATTACH_WQ;
+  }
+  if (options.sqpoll) {
+    flags |= IORING_SETUP_SQPOLL;
+  }
+  if (options.iopoll) {
+    flags |= IORING_SETUP_IOPOLL;
+  }
+  bool sqpoll = flags & IORING_SETUP_SQPOLL;
+  if (sqpoll && options.sq_thread_cpu >= 0) {
+    flags |= IORING_SETUP_SQ_AFF;
+  }
+  /* Optional flags, oldest first. Newer ones are dropped on EINVAL. The
+   * task running flags are rejected with SQPOLL. */
+  uint32_t optional[4] = {};
+  size_t nr_optional = 0;
+  if (options.coop_taskrun) {
+    optional[nr_optional++] = IORING_SETUP_SUBMIT_ALL;
+    if (!sqpoll) {
+      optional[nr_optional++] = IORING_SETUP_COOP_TASKRUN;
+    }
+  }
+  if (options.single_issuer || options.defer_taskrun) {
+    optional[nr_optional++] = IORING_SETUP_SINGLE_ISSUER;
+  }
+  if (options.defer_taskrun && !sqpoll) {
+    optional[nr_optional++] = IORING_SETUP_DEFER_TASKRUN;
+  }
+  struct io_uring_params params;
+  int rc;
+  for (;;) {
+    params = {};
+    params.wq_fd = options.wq_fd > 0 ? options.wq_fd : 0;
+    params.flags = flags;
+    if (options.sq_thread_cpu >= 0) {
+      params.sq_thread_cpu = options.sq_thread_cpu;
+    }
+    if (options.sq_thread_idle >= 0) {
+      params.sq_thread_idle = options.sq_thread_idle;
+    }
+    for (size_t i = 0; i < nr_optional; ++i) {
+      params.flags |= optional[i];
+    }
+    rc = ::io_uring_queue_init_params(options.entries, &ring_, &params);
+    if (rc != -EINVAL || nr_optional == 0) {
+      break;
+    }
+    --nr_optional;
+  }
+  check_nerrno(rc, "failed to init io uring");
+  setup_flags_ = params.flags;
   try {
+    harvested_.reserve(ring_.cq.ring_entries);
     probe_ring probe(&ring_);
     supported_ops_ = probe.supported_ops();
+    wakeup_fd_ = ::eventfd(0, EFD_CLOEXEC);
+    check_errno(wakeup_fd_, "failed to create wakeup eventfd");
+    init_supported_features(params);
+    init_capabilities();
+    auto fixed_files = options.fixed_files;
+    if (sqpoll && !has_feature(feature::SQPOLL_NONFIXED)) {
+      fixed_files_required_ = true;
+      if (fixed_files == 0) {
+        fixed_files = loop_options::kDefaultFixedFiles;
+      }
+    }
+    if (fixed_files != 0) {
+      register_files_sparse(fixed_files);
+    }
   } catch (std::exception const &e) {
+    files_.reset();
+    if (wakeup_fd_ >= 0) {
+      ::close(wakeup_fd_);
+    }
     ::io_uring_queue_exit(&ring_);
     throw;
   }
-  init_supported_features(params);
+  if (!(setup_flags_ & IORING_SETUP_IOPOLL)) {
+    arm_wakeup();
+  }
 }
 
-event_loop::~event_loop() { ::io_uring_queue_exit(&ring_); }
+sqe_awaitable event_loop::offload_call(std::function<int()> call) {
+  return sqe_awaitable::offloaded(
+      new offloaded_syscall(this, std::move(call)));
+}
+
+event_loop::~event_loop() {
+  buffer_rings_.clear();
+  buffer_pool_.reset();
+  files_.reset();
+  ::io_uring_queue_exit(&ring_);
+  ::close(wakeup_fd_);
+}
 
 event_loop::probe_ring::probe_ring(struct io_uring *ring) {
   probe_ = ::io_uring_get_probe_ring(ring);
@@ -39,7 +171,9 @@ event_loop::probe_ring::probe_ring(struct io_uring *ring) {
 std::bitset<IORING_OP_LAST> event_loop::probe_ring::supported_ops() {
   std::bitset<IORING_OP_LAST> ops;
   for (uint8_t i = 0; i < probe_->ops_len; ++i) {
-    if (probe_->ops[i].flags & IO_URING_OP_SUPPORTED) {
+    /* Newer kernels may report ops this build does not know. */
+    if (probe_->ops[i].op < IORING_OP_LAST &&
+        (probe_->ops[i].flags & IO_URING_OP_SUPPORTED)) {
       ops.set(probe_->ops[i].op);
     }
   }
@@ -51,7 +185,7 @@ event_loop::probe_ring::~probe_ring() { ::io_uring_free_probe(probe_); }
 void event_loop::check_feature(uint32_t features, uint32_t test_bit,
                                enum feature efeat) {
   if (features & test_bit) {
-    supported_features_.insert(efeat);
+    supported_features_ |= 1u << static_cast<unsigned>(efeat);
   }
 }
 
@@ -73,4 +207,24 @@ void event_loop::init_supported_features(struct io_uring_params const &params) {
   check_feature(params.features, IORING_FEAT_RSRC_TAGS, feature::RSRC_TAGS);
 }
 
+void event_loop::init_capabilities() {
+  /* Ops the loop never uses may be missing: they are then checked when the
+   * loop preps them. */
+  baseline_ops_ = true;
+  for (int op = 0; op < URINGPP_BASELINE_OP; ++op) {
+    baseline_ops_ = baseline_ops_ && supported_ops_[op];
+  }
+  if (supported_ops_[IORING_OP_SEND_ZC]) {
+    send_zc_threshold_ = zero_copy_threshold_;
+  }
+  if (supported_ops_[IORING_OP_SENDMSG_ZC]) {
+    sendmsg_zc_threshold_ = zero_copy_threshold_;
+  }
+  /* The probe does not report op flags: multishot accept landed in 5.19
+   * along with IORING_OP_SOCKET, multishot recv in 6.0 with
+   * IORING_OP_SEND_ZC. */
+  multishot_accept_ = supported_ops_[IORING_OP_SOCKET];
+  multishot_recv_ = supported_ops_[IORING_OP_SEND_ZC];
+}
+
 } // namespace uringpp
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include "uringpp/file_table.h"
+
+#include "uringpp/error.h"
+
+namespace uringpp {
+
+fixed_file_table::fixed_file_table(struct io_uring *ring, unsigned size,
+                                   unsigned kernel_slots)
+    : ring_(ring), size_(size), kernel_offset_(0) {
+  if (kernel_slots > size) {
+    throw_with("%u kernel slots do not fit a file table of %u", kernel_slots,
+               size);
+  }
+  kernel_offset_ = size - kernel_slots;
+  check_nerrno(::io_uring_register_files_sparse(ring_, size_),
+               "failed to register sparse files");
+  if (kernel_slots != 0) {
+    if (auto rc = ::io_uring_register_file_alloc_range(ring_, kernel_offset_,
+                                                       kernel_slots);
+        rc < 0) {
+      ::io_uring_unregister_files(ring_);
+      check_nerrno(rc, "failed to register file allocation range");
+    }
+  }
+  free_slots_.reserve(kernel_offset_);
+  for (unsigned slot = kernel_offset_; slot > 0; --slot) {
+    free_slots_.push_back(slot - 1);
+  }
+}
+
+fixed_file_table::~fixed_file_table() { ::io_uring_unregister_files(ring_); }
+
+unsigned fixed_file_table::acquire() {
+  auto slot = allocate();
+  if (slot < 0) [[unlikely]] {
+    throw_with("no free slot in the file table of %u", size_);
+  }
+  return slot;
+}
+
+unsigned fixed_file_table::install(int fd) {
+  auto slot = acquire();
+  if (auto rc = ::io_uring_register_files_update(ring_, slot, &fd, 1);
+      rc < 0) {
+    release(slot);
+    check_nerrno(rc, "failed to install file");
+  }
+  return slot;
+}
+
+} // namespace uringpp
@@ -0,0 +1,125 @@
+#include "uringpp/metrics.h"
+
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+
+#include "uringpp/error.h"
+
+namespace uringpp {
+
+namespace {
+
+constexpr double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+class prometheus_writer {
+  std::string &out_;
+  std::string_view prefix_;
+  std::string_view labels_;
+
+  void append(char const *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    /* Lines carry user labels of any length: size first, then format. */
+    va_list args;
+    va_start(args, fmt);
+    va_list copy;
+    va_copy(copy, args);
+    int n = std::vsnprintf(nullptr, 0, fmt, copy);
+    va_end(copy);
+    if (n < 0) [[unlikely]] {
+      va_end(args);
+      throw_with("failed to format metrics");
+    }
+    auto size = out_.size();
+    out_.resize(size + n + 1);
+    std::vsnprintf(out_.data() + size, n + 1, fmt, args);
+    va_end(args);
+    out_.resize(size + n);
+  }
+
+  /* The labels of a sample: the extra labels, then the given one. */
+  std::string labels(std::string_view label) const {
+    std::string l;
+    l.append(labels_);
+    if (!labels_.empty() && !label.empty()) {
+      l.push_back(',');
+    }
+    l.append(label);
+    return l.empty() ? l : "{" + l + "}";
+  }
+
+public:
+  prometheus_writer(std::string &out, std::string_view prefix,
+                    std::string_view labels)
+      : out_(out), prefix_(prefix), labels_(labels) {}
+
+  void type(char const *name, char const *type) {
+    append("# TYPE %.*s_%s %s\n", static_cast<int>(prefix_.size()),
+           prefix_.data(), name, type);
+  }
+
+  void counter(char const *name, uint64_t value,
+               std::string_view label = {}) {
+    append("%.*s_%s%s %" PRIu64 "\n", static_cast<int>(prefix_.size()),
+           prefix_.data(), name, labels(label).c_str(), value);
+  }
+
+  void summary(char const *name, histogram_snapshot const &h, double scale,
+               std::string const &label = {}) {
+    for (auto q : kQuantiles) {
+      char ql[32];
+      std::snprintf(ql, sizeof(ql), "quantile=\"%g\"", q);
+      auto l = label.empty() ? std::string(ql) : label + "," + ql;
+      append("%.*s_%s%s %g\n", static_cast<int>(prefix_.size()),
+             prefix_.data(), name, labels(l).c_str(),
+             static_cast<double>(h.quantile(q)) * scale);
+    }
+    append("%.*s_%s_sum%s %g\n", static_cast<int>(prefix_.size()),
+           prefix_.data(), name, labels(label).c_str(),
+           static_cast<double>(h.sum) * scale);
+    append("%.*s_%s_count%s %" PRIu64 "\n", static_cast<int>(prefix_.size()),
+           prefix_.data(), name, labels(label).c_str(), h.total);
+  }
+};
+
+std::string opcode_label(unsigned op) {
+  return "opcode=\"" + std::to_string(op) + "\"";
+}
+
+} // namespace
+
+std::string metrics_snapshot::to_prometheus(std::string_view prefix,
+                                            std::string_view labels) const {
+  std::string out;
+  prometheus_writer w(out, prefix, labels);
+  w.type("sqes_total", "counter");
+  for (unsigned op = 0; op < IORING_OP_LAST; ++op) {
+    if (sqes_by_op[op] != 0) {
+      w.counter("sqes_total", sqes_by_op[op], opcode_label(op));
+    }
+  }
+  w.type("submits_total", "counter");
+  w.counter("submits_total", submits);
+  w.type("enters_total", "counter");
+  w.counter("enters_total", enters);
+  w.type("sq_full_total", "counter");
+  w.counter("sq_full_total", sq_full);
+  w.type("wakeups_total", "counter");
+  w.counter("wakeups_total", wakeups);
+  w.type("cqes_total", "counter");
+  w.counter("cqes_total", cqes);
+  w.type("cq_overflow_total", "counter");
+  w.counter("cq_overflow_total", cq_overflow);
+  w.type("cqes_per_wakeup", "summary");
+  w.summary("cqes_per_wakeup", cqes_per_wakeup, 1);
+  w.type("op_latency_seconds", "summary");
+  for (unsigned op = 0; op < IORING_OP_LAST; ++op) {
+    if (latency_ns[op]) {
+      w.summary("op_latency_seconds", *latency_ns[op], 1e-9,
+                opcode_label(op));
+    }
+  }
+  return out;
+}
+
+} // namespace uringpp
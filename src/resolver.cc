@@ -0,0 +1,693 @@
+#include "uringpp/resolver.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <net/if.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <optional>
+#include <sstream>
+#include <unistd.h>
+#include <utility>
+
+#include "uringpp/error.h"
+
+namespace uringpp {
+
+namespace {
+
+constexpr uint16_t kTypeA = 1;
+constexpr uint16_t kTypeSOA = 6;
+constexpr uint16_t kTypeAAAA = 28;
+constexpr uint16_t kClassIN = 1;
+constexpr uint16_t kDnsPort = 53;
+/* Without EDNS, answers over UDP are at most 512 bytes. */
+constexpr size_t kMaxMessage = 512;
+constexpr size_t kHeaderSize = 12;
+
+std::string lowercase(std::string_view s) {
+  std::string out(s);
+  for (auto &c : out) {
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  return out;
+}
+
+bool parse_numeric(std::string const &host, uint16_t port, ip_address &out) {
+  out = ip_address{};
+  std::memset(&out.ss_, 0, sizeof(out.ss_));
+  auto in = reinterpret_cast<sockaddr_in *>(&out.ss_);
+  if (::inet_pton(AF_INET, host.c_str(), &in->sin_addr) == 1) {
+    in->sin_family = AF_INET;
+    in->sin_port = htons(port);
+    out.len_ = sizeof(sockaddr_in);
+    return true;
+  }
+  auto in6 = reinterpret_cast<sockaddr_in6 *>(&out.ss_);
+  auto scope = host.find('%');
+  auto addr = host.substr(0, scope);
+  if (::inet_pton(AF_INET6, addr.c_str(), &in6->sin6_addr) != 1) {
+    return false;
+  }
+  if (scope != std::string::npos) {
+    in6->sin6_scope_id = ::if_nametoindex(host.c_str() + scope + 1);
+    if (in6->sin6_scope_id == 0) {
+      return false;
+    }
+  }
+  in6->sin6_family = AF_INET6;
+  in6->sin6_port = htons(port);
+  out.len_ = sizeof(sockaddr_in6);
+  return true;
+}
+
+void set_port(ip_address &address, uint16_t port) {
+  set_in_port(reinterpret_cast<sockaddr *>(&address.ss_), htons(port));
+}
+
+uint16_t read16(uint8_t const *p) { return (p[0] << 8) | p[1]; }
+
+uint32_t read32(uint8_t const *p) {
+  return (static_cast<uint32_t>(read16(p)) << 16) | read16(p + 2);
+}
+
+void write16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+/* Skip a possibly compressed name, returning nullptr if it is malformed. */
+uint8_t const *skip_name(uint8_t const *p, uint8_t const *end) {
+  while (p < end) {
+    uint8_t len = *p;
+    if ((len & 0xc0) == 0xc0) {
+      return p + 2 <= end ? p + 2 : nullptr;
+    }
+    if (len & 0xc0) {
+      return nullptr;
+    }
+    p += 1 + len;
+    if (len == 0) {
+      return p <= end ? p : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+/* TTLs with the top bit set are treated as 0 (RFC 2181). */
+uint32_t read_ttl(uint8_t const *p) {
+  auto ttl = read32(p);
+  return (ttl & 0x80000000) ? 0 : ttl;
+}
+
+/* How telling a failure is: a name tried with several search domains
+ * reports the most telling one, e.g. a timeout rather than the NXDOMAIN of
+ * another domain. */
+int failure_rank(detail::dns_answer::status status) {
+  switch (status) {
+  case detail::dns_answer::ok:
+    return 4;
+  case detail::dns_answer::no_data:
+    return 3;
+  case detail::dns_answer::timed_out:
+    return 2;
+  case detail::dns_answer::server_failure:
+    return 1;
+  case detail::dns_answer::no_such_name:
+    return 0;
+  }
+  return 0;
+}
+
+std::string_view status_string(detail::dns_answer::status status) {
+  switch (status) {
+  case detail::dns_answer::ok:
+    return "ok";
+  case detail::dns_answer::no_such_name:
+    return "no such host";
+  case detail::dns_answer::no_data:
+    return "no address";
+  case detail::dns_answer::server_failure:
+    return "name server failure";
+  case detail::dns_answer::timed_out:
+    return "timed out";
+  }
+  return "unknown error";
+}
+
+/* Closes a query socket, which may live in the fixed file table. */
+struct socket_closer {
+  event_loop *loop_;
+  int fd_;
+  bool fixed_;
+  ~socket_closer() {
+    if (fixed_) {
+      loop_->close_direct_detach(fd_);
+    } else {
+      loop_->close_detach(fd_);
+    }
+  }
+};
+
+/* Send or receive exactly len bytes on a stream socket. Returns 0, or a
+ * negated errno, -ECANCELED once the deadline passes. */
+task<int> transfer(event_loop &loop, int fd, uint8_t *buf, size_t len,
+                   bool send, uint8_t sqe_flags,
+                   std::chrono::steady_clock::time_point deadline) {
+  while (len > 0) {
+    /* Not a conditional in the co_await expression: GCC 12 evaluates both
+     * arms there, preparing both ops. */
+    int rc;
+    if (send) {
+      rc = co_await loop.with_deadline(
+          loop.send(fd, buf, len, MSG_NOSIGNAL, sqe_flags), deadline);
+    } else {
+      rc = co_await loop.with_deadline(loop.recv(fd, buf, len, 0, sqe_flags),
+                                       deadline);
+    }
+    if (rc <= 0) {
+      co_return rc < 0 ? rc : -ECONNRESET;
+    }
+    buf += rc;
+    len -= rc;
+  }
+  co_return 0;
+}
+
+} // namespace
+
+namespace detail {
+
+size_t encode_dns_query(uint16_t id, std::string_view name, uint16_t qtype,
+                        uint8_t *buf, size_t size) {
+  if (!name.empty() && name.back() == '.') {
+    name.remove_suffix(1);
+  }
+  /* The encoded name is one byte longer than the dotted one, plus the root. */
+  if (name.empty() || name.size() > 253 ||
+      kHeaderSize + name.size() + 2 + 4 > size) {
+    return 0;
+  }
+  std::memset(buf, 0, kHeaderSize);
+  write16(buf, id);
+  /* A standard query with recursion desired. */
+  write16(buf + 2, 0x0100);
+  write16(buf + 4, 1);
+  auto p = buf + kHeaderSize;
+  while (!name.empty()) {
+    auto dot = name.find('.');
+    auto label = name.substr(0, dot);
+    if (label.empty() || label.size() > 63) {
+      return 0;
+    }
+    *p++ = label.size();
+    std::memcpy(p, label.data(), label.size());
+    p += label.size();
+    name.remove_prefix(dot == std::string_view::npos ? name.size() : dot + 1);
+  }
+  *p++ = 0;
+  write16(p, qtype);
+  write16(p + 2, kClassIN);
+  return p + 4 - buf;
+}
+
+bool decode_dns_response(uint8_t const *query, size_t query_len,
+                         uint8_t const *response, size_t len, uint16_t qtype,
+                         dns_answer &answer) {
+  if (len < query_len || read16(response) != read16(query)) {
+    return false;
+  }
+  auto flags = read16(response + 2);
+  /* Not a response, or not to a standard query. */
+  if (!(flags & 0x8000) || (flags & 0x7800) || read16(response + 4) != 1) {
+    return false;
+  }
+  /* Servers may change the case of the question. */
+  for (size_t i = kHeaderSize; i < query_len; ++i) {
+    if (std::tolower(query[i]) != std::tolower(response[i])) {
+      return false;
+    }
+  }
+  answer = {};
+  /* The records of a truncated answer may be missing any of the addresses,
+   * so none is used. */
+  if (flags & 0x0200) {
+    answer.status_ = dns_answer::server_failure;
+    answer.truncated_ = true;
+    return true;
+  }
+  switch (flags & 0xf) {
+  case 0:
+    answer.status_ = dns_answer::no_data;
+    break;
+  case 3:
+    answer.status_ = dns_answer::no_such_name;
+    break;
+  default:
+    answer.status_ = dns_answer::server_failure;
+    return true;
+  }
+  auto end = response + len;
+  auto p = response + query_len;
+  unsigned nr_answers = read16(response + 6);
+  unsigned nr_authority = read16(response + 8);
+  uint32_t ttl = UINT32_MAX;
+  for (unsigned i = 0; i < nr_answers + nr_authority; ++i) {
+    p = skip_name(p, end);
+    if (p == nullptr || p + 10 > end) {
+      break;
+    }
+    auto type = read16(p);
+    auto rclass = read16(p + 2);
+    auto rr_ttl = read_ttl(p + 4);
+    size_t rdlength = read16(p + 8);
+    auto rdata = p + 10;
+    p = rdata + rdlength;
+    if (p > end || rclass != kClassIN) {
+      break;
+    }
+    if (i < nr_answers) {
+      /* CNAMEs are skipped: a recursive server adds the records of their
+       * target to the answer. */
+      size_t addr_len = qtype == kTypeA ? 4 : 16;
+      if (type != qtype || rdlength != addr_len) {
+        continue;
+      }
+      ip_address address;
+      std::memset(&address.ss_, 0, sizeof(address.ss_));
+      if (qtype == kTypeA) {
+        auto in = reinterpret_cast<sockaddr_in *>(&address.ss_);
+        in->sin_family = AF_INET;
+        std::memcpy(&in->sin_addr, rdata, 4);
+        address.len_ = sizeof(sockaddr_in);
+      } else {
+        auto in6 = reinterpret_cast<sockaddr_in6 *>(&address.ss_);
+        in6->sin6_family = AF_INET6;
+        std::memcpy(&in6->sin6_addr, rdata, 16);
+        address.len_ = sizeof(sockaddr_in6);
+      }
+      answer.addresses_.push_back(address);
+      answer.status_ = dns_answer::ok;
+      ttl = std::min(ttl, rr_ttl);
+    } else if (answer.status_ != dns_answer::ok && type == kTypeSOA) {
+      /* The negative TTL is the lower of the TTL and the minimum field of
+       * the SOA record (RFC 2308). */
+      auto q = skip_name(rdata, p);
+      q = q ? skip_name(q, p) : nullptr;
+      if (q != nullptr && q + 20 <= p) {
+        ttl = std::min({ttl, rr_ttl, read_ttl(q + 16)});
+      }
+    }
+  }
+  answer.ttl_ = ttl == UINT32_MAX ? 0 : ttl;
+  return true;
+}
+
+} // namespace detail
+
+resolver_config resolver_config::system(char const *path) {
+  resolver_config config;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find_first_of("#;"));
+    std::istringstream tokens(line);
+    std::string key, value;
+    if (!(tokens >> key)) {
+      continue;
+    }
+    if (key == "nameserver" && tokens >> value) {
+      ip_address address;
+      if (parse_numeric(value, kDnsPort, address)) {
+        config.nameservers.push_back(address);
+      }
+    } else if (key == "search" || key == "domain") {
+      config.search.clear();
+      while (tokens >> value) {
+        config.search.push_back(value);
+      }
+    } else if (key == "options") {
+      while (tokens >> value) {
+        auto colon = value.find(':');
+        if (colon == std::string::npos) {
+          continue;
+        }
+        unsigned n = 0;
+        auto digits = value.c_str() + colon + 1;
+        auto [ptr, ec] =
+            std::from_chars(digits, value.c_str() + value.size(), n);
+        if (ec != std::errc{} || ptr == digits) {
+          continue;
+        }
+        auto option = value.substr(0, colon);
+        if (option == "ndots") {
+          config.ndots = std::min(n, 15u);
+        } else if (option == "timeout") {
+          config.timeout = std::chrono::seconds(std::clamp(n, 1u, 30u));
+        } else if (option == "attempts") {
+          config.attempts = std::clamp(n, 1u, 5u);
+        }
+      }
+    }
+  }
+  if (config.nameservers.empty()) {
+    ip_address local;
+    parse_numeric("127.0.0.1", kDnsPort, local);
+    config.nameservers.push_back(local);
+  }
+  return config;
+}
+
+resolver::resolver(resolver_config config, char const *hosts)
+    : config_(std::move(config)), ids_(std::random_device{}()) {
+  if (hosts != nullptr) {
+    load_hosts(hosts);
+  }
+}
+
+resolver &resolver::local() {
+  static thread_local resolver r;
+  return r;
+}
+
+void resolver::load_hosts(char const *path) {
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream tokens(line);
+    std::string addr, name;
+    ip_address address;
+    if (!(tokens >> addr) || !parse_numeric(addr, 0, address)) {
+      continue;
+    }
+    while (tokens >> name) {
+      hosts_.emplace(lowercase(name), address);
+    }
+  }
+}
+
+void resolver::store(std::string const &key, detail::dns_answer const &answer) {
+  std::chrono::seconds ttl;
+  if (answer.status_ == detail::dns_answer::ok) {
+    ttl = std::min<std::chrono::seconds>(std::chrono::seconds(answer.ttl_),
+                                         config_.max_ttl);
+  } else if (answer.status_ == detail::dns_answer::no_such_name ||
+             answer.status_ == detail::dns_answer::no_data) {
+    ttl = answer.ttl_ != 0 ? std::min<std::chrono::seconds>(
+                                 std::chrono::seconds(answer.ttl_),
+                                 config_.max_ttl)
+                           : config_.negative_ttl;
+  } else {
+    /* Timeouts and server failures are retried by the next lookup. */
+    return;
+  }
+  if (ttl.count() <= 0) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (cache_.size() >= config_.max_entries) {
+    std::erase_if(cache_,
+                  [now](auto const &entry) {
+                    return entry.second.expires_ <= now;
+                  });
+    if (cache_.size() >= config_.max_entries) {
+      cache_.clear();
+    }
+  }
+  cache_[key] = cache_entry{answer, now + ttl};
+}
+
+std::vector<std::string> resolver::candidates(std::string const &name) const {
+  if (name.back() == '.') {
+    return {name.substr(0, name.size() - 1)};
+  }
+  auto dots = std::count(name.begin(), name.end(), '.');
+  std::vector<std::string> names;
+  if (static_cast<unsigned>(dots) >= config_.ndots) {
+    names.push_back(name);
+  }
+  for (auto const &domain : config_.search) {
+    names.push_back(name + "." + domain);
+  }
+  if (static_cast<unsigned>(dots) < config_.ndots) {
+    names.push_back(name);
+  }
+  return names;
+}
+
+task<detail::dns_answer> resolver::exchange(std::shared_ptr<event_loop> loop,
+                                            ip_address const &nameserver,
+                                            std::string const &name,
+                                            uint16_t qtype) {
+  detail::dns_answer answer;
+  uint8_t query[kMaxMessage];
+  auto id = static_cast<uint16_t>(ids_());
+  auto query_len = detail::encode_dns_query(id, name, qtype, query,
+                                            sizeof(query));
+  if (query_len == 0) {
+    answer.status_ = detail::dns_answer::no_such_name;
+    co_return answer;
+  }
+  int fd = ::socket(nameserver.ss_.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  check_errno(fd, "failed to create socket");
+  /* Connecting a UDP socket does not block, and filters out datagrams from
+   * other addresses. */
+  if (::connect(fd, reinterpret_cast<sockaddr const *>(&nameserver.ss_),
+                nameserver.len_) < 0) {
+    ::close(fd);
+    answer.status_ = detail::dns_answer::server_failure;
+    co_return answer;
+  }
+  bool fixed = loop->fixed_files_required();
+  if (fixed) {
+    int slot = loop->files().install(fd);
+    ::close(fd);
+    fd = slot;
+  }
+  socket_closer guard{loop.get(), fd, fixed};
+  uint8_t sqe_flags = fixed ? IOSQE_FIXED_FILE : 0;
+  int rc = co_await loop->send(fd, query, query_len, 0, sqe_flags);
+  if (rc < 0) {
+    answer.status_ = detail::dns_answer::server_failure;
+    co_return answer;
+  }
+  auto deadline = std::chrono::steady_clock::now() + config_.timeout;
+  uint8_t response[kMaxMessage];
+  for (;;) {
+    int n = co_await loop->with_deadline(
+        loop->recv(fd, response, sizeof(response), 0, sqe_flags), deadline);
+    if (n < 0) {
+      answer.status_ = n == -ECANCELED ? detail::dns_answer::timed_out
+                                       : detail::dns_answer::server_failure;
+      co_return answer;
+    }
+    /* Stray datagrams, e.g. a late answer to an earlier query, are
+     * ignored. */
+    bool answered = detail::decode_dns_response(query, query_len, response, n,
+                                                qtype, answer);
+    if (answered && answer.truncated_) {
+      auto full = co_await exchange_tcp(loop, nameserver, query, query_len,
+                                        qtype, deadline);
+      co_return full;
+    }
+    if (answered) {
+      co_return answer;
+    }
+  }
+}
+
+task<detail::dns_answer>
+resolver::exchange_tcp(std::shared_ptr<event_loop> loop,
+                       ip_address nameserver, uint8_t const *query,
+                       size_t query_len, uint16_t qtype,
+                       std::chrono::steady_clock::time_point deadline) {
+  detail::dns_answer answer;
+  answer.status_ = detail::dns_answer::server_failure;
+  int fd = ::socket(nameserver.ss_.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  check_errno(fd, "failed to create socket");
+  bool fixed = loop->fixed_files_required();
+  if (fixed) {
+    int slot = loop->files().install(fd);
+    ::close(fd);
+    fd = slot;
+  }
+  socket_closer guard{loop.get(), fd, fixed};
+  uint8_t sqe_flags = fixed ? IOSQE_FIXED_FILE : 0;
+  auto failed = [&answer](int rc) {
+    answer.status_ = rc == -ECANCELED ? detail::dns_answer::timed_out
+                                      : detail::dns_answer::server_failure;
+    return answer;
+  };
+  int rc = co_await loop->with_deadline(
+      loop->connect(fd, reinterpret_cast<sockaddr *>(&nameserver.ss_),
+                    nameserver.len_, sqe_flags),
+      deadline);
+  if (rc < 0) {
+    co_return failed(rc);
+  }
+  /* Over TCP, messages are prefixed with their length (RFC 1035 4.2.2). */
+  uint8_t request[2 + kMaxMessage];
+  write16(request, query_len);
+  std::memcpy(request + 2, query, query_len);
+  rc = co_await transfer(*loop, fd, request, 2 + query_len, true, sqe_flags,
+                         deadline);
+  if (rc < 0) {
+    co_return failed(rc);
+  }
+  uint8_t length[2];
+  rc = co_await transfer(*loop, fd, length, 2, false, sqe_flags, deadline);
+  if (rc < 0) {
+    co_return failed(rc);
+  }
+  std::vector<uint8_t> response(read16(length));
+  rc = co_await transfer(*loop, fd, response.data(), response.size(), false,
+                         sqe_flags, deadline);
+  if (rc < 0) {
+    co_return failed(rc);
+  }
+  bool answered = detail::decode_dns_response(
+      query, query_len, response.data(), response.size(), qtype, answer);
+  if (!answered || answer.truncated_) {
+    answer = {};
+    answer.status_ = detail::dns_answer::server_failure;
+  }
+  co_return answer;
+}
+
+task<detail::dns_answer> resolver::query(std::shared_ptr<event_loop> loop,
+                                         std::string const &name,
+                                         uint16_t qtype) {
+  detail::dns_answer answer;
+  for (unsigned attempt = 0; attempt < config_.attempts; ++attempt) {
+    for (auto const &nameserver : config_.nameservers) {
+      answer = co_await exchange(loop, nameserver, name, qtype);
+      if (answer.status_ != detail::dns_answer::server_failure &&
+          answer.status_ != detail::dns_answer::timed_out) {
+        co_return answer;
+      }
+    }
+  }
+  co_return answer;
+}
+
+task<detail::dns_answer> resolver::lookup(std::shared_ptr<event_loop> loop,
+                                          std::string const &name,
+                                          uint16_t qtype) {
+  auto key = std::to_string(qtype) + ':' + name;
+  if (auto it = cache_.find(key); it != cache_.end()) {
+    if (it->second.expires_ > std::chrono::steady_clock::now()) {
+      co_return it->second.answer_;
+    }
+    cache_.erase(it);
+  }
+  detail::dns_answer best;
+  best.status_ = detail::dns_answer::no_such_name;
+  bool has_best = false;
+  for (auto const &candidate : candidates(name)) {
+    auto answer = co_await query(loop, candidate, qtype);
+    /* The first answer is kept even if it is an NXDOMAIN, for the negative
+     * TTL of its SOA record. */
+    if (!has_best ||
+        failure_rank(answer.status_) > failure_rank(best.status_)) {
+      best = std::move(answer);
+      has_best = true;
+    }
+    if (best.status_ == detail::dns_answer::ok) {
+      break;
+    }
+  }
+  store(key, best);
+  co_return best;
+}
+
+task<std::vector<ip_address>>
+resolver::resolve(std::shared_ptr<event_loop> loop, std::string const &host,
+                  uint16_t port, int family) {
+  std::vector<ip_address> addresses;
+  ip_address numeric;
+  if (parse_numeric(host, port, numeric)) {
+    if (family == AF_UNSPEC || family == numeric.ss_.ss_family) {
+      addresses.push_back(numeric);
+      co_return addresses;
+    }
+    throw_with("failed to resolve %s: address family mismatch",
+               host.c_str());
+  }
+  if (host.empty() || host == ".") {
+    throw_with("failed to resolve %s: invalid name", host.c_str());
+  }
+  auto name = lowercase(host);
+  auto [first, last] =
+      hosts_.equal_range(name.back() == '.' ? name.substr(0, name.size() - 1)
+                                            : name);
+  for (int f : {AF_INET6, AF_INET}) {
+    if (family != AF_UNSPEC && family != f) {
+      continue;
+    }
+    for (auto it = first; it != last; ++it) {
+      if (it->second.ss_.ss_family == f) {
+        addresses.push_back(it->second);
+        set_port(addresses.back(), port);
+      }
+    }
+  }
+  if (!addresses.empty()) {
+    co_return addresses;
+  }
+  /* Both families are queried at once. */
+  std::optional<task<detail::dns_answer>> aaaa, a;
+  if (family != AF_INET) {
+    aaaa.emplace(lookup(loop, name, kTypeAAAA));
+  }
+  if (family != AF_INET6) {
+    a.emplace(lookup(loop, name, kTypeA));
+  }
+  auto status = detail::dns_answer::no_such_name;
+  for (auto *t : {&aaaa, &a}) {
+    if (!*t) {
+      continue;
+    }
+    auto answer = co_await **t;
+    for (auto address : answer.addresses_) {
+      set_port(address, port);
+      addresses.push_back(address);
+    }
+    if (answer.status_ != detail::dns_answer::ok &&
+        failure_rank(answer.status_) > failure_rank(status)) {
+      status = answer.status_;
+    }
+  }
+  if (addresses.empty()) {
+    throw_with("failed to resolve %s: %s", host.c_str(),
+               status_string(status).data());
+  }
+  co_return addresses;
+}
+
+task<std::vector<ip_address>>
+resolver::resolve(std::shared_ptr<event_loop> loop, std::string const &host,
+                  std::string const &service, int family) {
+  unsigned port = 0;
+  auto end = service.c_str() + service.size();
+  auto [ptr, ec] = std::from_chars(service.c_str(), end, port);
+  if (ec != std::errc{} || ptr != end || port > UINT16_MAX) {
+    struct servent entry, *result = nullptr;
+    char buf[1024];
+    if (::getservbyname_r(service.c_str(), "tcp", &entry, buf, sizeof(buf),
+                          &result) != 0 ||
+        result == nullptr) {
+      throw_with("failed to resolve service %s", service.c_str());
+    }
+    port = ntohs(result->s_port);
+  }
+  auto addresses = co_await resolve(loop, host, port, family);
+  co_return addresses;
+}
+
+} // namespace uringpp
@@ -0,0 +1,84 @@
+#include "uringpp/runtime.h"
+
+#include <algorithm>
+#include <future>
+#include <pthread.h>
+#include <sched.h>
+
+#include "uringpp/error.h"
+
+namespace uringpp {
+
+/* hardware_concurrency() returns 0 when the count is unknown. */
+static unsigned nr_cpus() {
+  return std::max(std::thread::hardware_concurrency(), 1U);
+}
+
+runtime::runtime(unsigned nr_loops, loop_options const &options, bool pin)
+    : stopped_(false) {
+  if (nr_loops == 0) {
+    nr_loops = nr_cpus();
+  }
+  loops_.resize(nr_loops);
+  try {
+    for (size_t i = 0; i < nr_loops; ++i) {
+      auto loop_options = options;
+      loop_options.wq_fd = i == 0 ? -1 : loops_[0]->fd();
+      start_loop(i, loop_options, pin);
+    }
+  } catch (...) {
+    stop();
+    join();
+    throw;
+  }
+}
+
+void runtime::start_loop(size_t index, loop_options options, bool pin) {
+  std::promise<std::shared_ptr<event_loop>> created;
+  auto future = created.get_future();
+  threads_.emplace_back([this, index, options, pin, &created]() {
+    std::shared_ptr<event_loop> loop;
+    try {
+      if (pin) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % nr_cpus(), &cpus);
+        check_rc(::pthread_setaffinity_np(::pthread_self(), sizeof(cpus),
+                                          &cpus),
+                 "failed to pin loop thread");
+      }
+      loop = event_loop::create(options);
+      created.set_value(loop);
+    } catch (...) {
+      created.set_exception(std::current_exception());
+      return;
+    }
+    loop->run_until(
+        [this]() { return stopped_.load(std::memory_order_acquire); });
+  });
+  loops_[index] = future.get();
+}
+
+void runtime::stop() {
+  stopped_.store(true, std::memory_order_release);
+  for (auto &loop : loops_) {
+    if (loop) {
+      loop->wake();
+    }
+  }
+}
+
+void runtime::join() {
+  for (auto &thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+runtime::~runtime() {
+  stop();
+  join();
+}
+
+} // namespace uringpp
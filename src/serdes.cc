@@ -0,0 +1,74 @@
+#include "uringpp/detail/serdes.h"
+
+#include <cstring>
+
+namespace uringpp {
+namespace detail {
+
+namespace {
+
+#if __has_builtin(__builtin_shufflevector)
+#if defined(__SSSE3__) || defined(__ARM_NEON)
+#define URINGPP_VECTOR_TARGET
+bool has_vector_byteswap() { return true; }
+#elif defined(__x86_64__) || defined(__i386__)
+/* Built without SSSE3, e.g. for baseline x86-64: compile the shuffle for it
+ * anyway and use it if the CPU has it. */
+#define URINGPP_VECTOR_TARGET __attribute__((target("ssse3")))
+bool has_vector_byteswap() {
+  static bool const ssse3 = __builtin_cpu_supports("ssse3");
+  return ssse3;
+}
+#endif
+#endif
+
+#ifdef URINGPP_VECTOR_TARGET
+/* Swaps whole 16-byte blocks and returns the number of elements done. */
+template <size_t Size>
+URINGPP_VECTOR_TARGET size_t copy_swapped_vector(uint8_t *out,
+                                                 uint8_t const *in, size_t n) {
+  using bytes16 = uint8_t __attribute__((vector_size(16)));
+  size_t i = 0;
+  for (; (i + 16 / Size) <= n; i += 16 / Size) {
+    bytes16 v;
+    std::memcpy(&v, in + i * Size, sizeof(v));
+    if constexpr (Size == 2) {
+      v = __builtin_shufflevector(v, v, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10,
+                                  13, 12, 15, 14);
+    } else if constexpr (Size == 4) {
+      v = __builtin_shufflevector(v, v, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8,
+                                  15, 14, 13, 12);
+    } else {
+      v = __builtin_shufflevector(v, v, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13,
+                                  12, 11, 10, 9, 8);
+    }
+    std::memcpy(out + i * Size, &v, sizeof(v));
+  }
+  return i;
+}
+#endif
+
+} // namespace
+
+template <size_t Size>
+void copy_swapped(uint8_t *out, uint8_t const *in, size_t n) {
+  size_t i = 0;
+#ifdef URINGPP_VECTOR_TARGET
+  if (n >= 16 / Size && has_vector_byteswap()) {
+    i = copy_swapped_vector<Size>(out, in, n);
+  }
+#endif
+  for (; i < n; ++i) {
+    typename wire_bits<Size>::type bits;
+    std::memcpy(&bits, in + i * Size, Size);
+    bits = byteswap(bits);
+    std::memcpy(out + i * Size, &bits, Size);
+  }
+}
+
+template void copy_swapped<2>(uint8_t *, uint8_t const *, size_t);
+template void copy_swapped<4>(uint8_t *, uint8_t const *, size_t);
+template void copy_swapped<8>(uint8_t *, uint8_t const *, size_t);
+
+} // namespace detail
+} // namespace uringpp
@@ -0,0 +1,156 @@
+#include "uringpp/timer_wheel.h"
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+namespace uringpp {
+
+namespace {
+
+constexpr uint64_t kWheelSpan =
+    uint64_t{1} << (timer_wheel::kSlotBits * timer_wheel::kLevels);
+
+} // namespace
+
+void timer_wheel::link(timer_entry *entry) {
+  if (entry->level_ == kExpiredLevel) {
+    /* Expired timers fire in the order they expired. */
+    entry->prev_ = expired_tail_;
+    entry->next_ = nullptr;
+    if (expired_tail_ != nullptr) {
+      expired_tail_->next_ = entry;
+    } else {
+      expired_ = entry;
+    }
+    expired_tail_ = entry;
+    return;
+  }
+  auto &head = slots_[entry->level_][entry->slot_];
+  entry->prev_ = nullptr;
+  entry->next_ = head;
+  if (head != nullptr) {
+    head->prev_ = entry;
+  }
+  head = entry;
+  occupied_[entry->level_] |= uint64_t{1} << entry->slot_;
+}
+
+void timer_wheel::unlink(timer_entry *entry) {
+  auto &head = list_of(entry);
+  if (entry->prev_ != nullptr) {
+    entry->prev_->next_ = entry->next_;
+  } else {
+    head = entry->next_;
+  }
+  if (entry->next_ != nullptr) {
+    entry->next_->prev_ = entry->prev_;
+  } else if (entry->level_ == kExpiredLevel) {
+    expired_tail_ = entry->prev_;
+  }
+  if (head == nullptr && entry->level_ != kExpiredLevel) {
+    occupied_[entry->level_] &= ~(uint64_t{1} << entry->slot_);
+  }
+  entry->prev_ = entry->next_ = nullptr;
+}
+
+void timer_wheel::place(timer_entry *entry) {
+  /* Timers past the span of the wheel wait in the last slot of the top level
+   * ahead of the current one and are placed again when it comes up. */
+  auto top_slot_span = kWheelSpan >> kSlotBits;
+  auto last = (elapsed_ & ~(top_slot_span - 1)) + kWheelSpan - 1;
+  auto when = std::clamp(entry->when_, elapsed_, last);
+  auto masked = std::min((elapsed_ ^ when) | (kSlots - 1), kWheelSpan - 1);
+  unsigned level = (63 - std::countl_zero(masked)) / kSlotBits;
+  entry->level_ = level;
+  entry->slot_ = (when >> (level * kSlotBits)) & (kSlots - 1);
+  link(entry);
+}
+
+uint64_t timer_wheel::next_slot(unsigned level, unsigned *slot) const {
+  if (occupied_[level] == 0) {
+    return kNever;
+  }
+  unsigned shift = level * kSlotBits;
+  unsigned current = (elapsed_ >> shift) & (kSlots - 1);
+  *slot = (current + std::countr_zero(std::rotr(occupied_[level], current))) &
+          (kSlots - 1);
+  uint64_t level_span = uint64_t{1} << (shift + kSlotBits);
+  uint64_t deadline =
+      (elapsed_ & ~(level_span - 1)) + (uint64_t{*slot} << shift);
+  if (*slot < current) {
+    deadline += level_span;
+  }
+  return deadline;
+}
+
+void timer_wheel::insert(timer_entry *entry, uint64_t when) {
+  remove(entry);
+  entry->when_ = when;
+  entry->pending_ = true;
+  ++size_;
+  place(entry);
+}
+
+void timer_wheel::remove(timer_entry *entry) {
+  if (!entry->pending_) {
+    return;
+  }
+  unlink(entry);
+  entry->pending_ = false;
+  --size_;
+}
+
+uint64_t timer_wheel::next_expiration() const {
+  uint64_t next = kNever;
+  for (unsigned level = 0; level < kLevels; ++level) {
+    unsigned slot;
+    next = std::min(next, next_slot(level, &slot));
+  }
+  return next;
+}
+
+size_t timer_wheel::advance(uint64_t now) {
+  for (;;) {
+    uint64_t deadline = kNever;
+    unsigned level = 0;
+    unsigned slot = 0;
+    for (unsigned l = 0; l < kLevels; ++l) {
+      unsigned s;
+      if (auto d = next_slot(l, &s); d < deadline) {
+        deadline = d;
+        level = l;
+        slot = s;
+      }
+    }
+    if (deadline > now) {
+      break;
+    }
+    elapsed_ = std::max(elapsed_, deadline);
+    auto *entry = std::exchange(slots_[level][slot], nullptr);
+    occupied_[level] &= ~(uint64_t{1} << slot);
+    while (entry != nullptr) {
+      auto *next = entry->next_;
+      if (entry->when_ <= elapsed_) {
+        entry->level_ = kExpiredLevel;
+        link(entry);
+      } else {
+        place(entry);
+      }
+      entry = next;
+    }
+  }
+  elapsed_ = std::max(elapsed_, now);
+  size_t fired = 0;
+  while (expired_ != nullptr) {
+    auto *entry = expired_;
+    unlink(entry);
+    entry->pending_ = false;
+    --size_;
+    ++fired;
+    entry->fire();
+  }
+  return fired;
+}
+
+} // namespace uringpp